@@ -0,0 +1,73 @@
+/*------------------------------------------------------------------------*
+ NAME:     buildpyramid.cpp
+
+ PURPOSE:  One-time build of the min/max pyramids described in pyramid.h
+           for the DEMs that maxtopo searches (GT3, AD1, REP, REM).  Each
+           pyramid is written beside its DEM where the dataset settings
+           place it, and is picked up by the region queries with no other
+           changes.  Rebuild a pyramid whenever its DEM is replaced.
+
+ DATE:     17 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "querytopo.h"
+#include "pyramid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+int main(int argc, char *argv[])
+{
+  int opt,base,demid,i,status;
+  const char *dsfile;
+  struct topocontext *ctx;
+
+  // Check input
+  base = PYRAMIDDEFAULTBASE;
+  dsfile = NULL;
+  while ((opt=getopt(argc,argv,"b:d:"))!=-1)
+  {
+    if (opt=='b'&&(base=atoi(optarg))>=2&&base<=4096) continue;
+    if (opt=='d') { dsfile = optarg; continue; }
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind<1)
+  {
+    printf("Usage: buildpyramid [-b block pixels] [-d dataset file] <DEM id (GT3, AD1, REP, REM)> ...\n");
+    exit(0);
+  }
+  if ((ctx=inittopocontext())==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+  if ((status=loaddatasets(ctx,dsfile))!=0)
+  {
+    if (status==-1) printf("Cannot read dataset file - exiting\n");
+    else printf("Line %d of dataset file not understood - exiting\n",status);
+    exit(-1);
+  }
+
+  // Build each pyramid asked for in turn
+  for (i=optind;i<argc;i++)
+  {
+    for (demid=DEM_GT3;demid<NDEMPRODUCTS&&strcmp(argv[i],demproductname(demid));demid++);
+    if (demid!=DEM_GT3&&demid!=DEM_AD1&&demid!=DEM_REP&&demid!=DEM_REM)
+    {
+      printf("No pyramid for DEM %s - exiting\n",argv[i]);
+      exit(-1);
+    }
+    if (buildpyramid(ctx,demid,base)==-1)
+    {
+      printf("Cannot build the pyramid of %s - exiting\n",argv[i]);
+      exit(-1);
+    }
+    printf("%s pyramid written\n",argv[i]);
+  }
+  closetopocontext(ctx);
+  return(0);
+
+}
@@ -0,0 +1,83 @@
+/*------------------------------------------------------------------------*
+ NAME:     buildrefgrid.cpp
+
+ PURPOSE:  One-time build of the pre-referenced DEM copies described in
+           refgrid.h for the DEMs querytopo2 reads (GT3, AD1, REP, REM).
+           Each copy holds every pixel above both the WGS-84 ellipsoid
+           and the geoid, and is written beside its DEM where the dataset
+           settings place it.  querytopo2 -v then reads the copies, taking
+           a point's height and geoid height from the same reads.  Rebuild
+           a copy whenever its DEM or the geoid is replaced.
+
+ DATE:     17 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "querytopo.h"
+#include "refgrid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+int main(int argc, char *argv[])
+{
+  int opt,demid,i,status;
+  double geoidmb;
+  const char *dsfile;
+  struct topocontext *ctx;
+
+  // Check input
+  dsfile = NULL;
+  geoidmb = 1024.0;
+  while ((opt=getopt(argc,argv,"d:g:"))!=-1)
+  {
+    if (opt=='d') { dsfile = optarg; continue; }
+    if (opt=='g'&&(geoidmb=atof(optarg))>=0.0) continue;
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind<1)
+  {
+    printf("Usage: buildrefgrid [-d dataset file] [-g geoid MB] <DEM id (GT3, AD1, REP, REM)> ...\n");
+    exit(0);
+  }
+  if ((ctx=inittopocontext())==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+  if ((status=loaddatasets(ctx,dsfile))!=0)
+  {
+    if (status==-1) printf("Cannot read dataset file - exiting\n");
+    else printf("Line %d of dataset file not understood - exiting\n",status);
+    exit(-1);
+  }
+
+  // Every pixel needs a geoid height, so keep the geoid in memory
+  if (setgeoidmemory(ctx,(long long)(geoidmb*1048576.0),0)==-1)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+
+  // Build each copy asked for in turn
+  for (i=optind;i<argc;i++)
+  {
+    for (demid=DEM_GT3;demid<NDEMPRODUCTS&&strcmp(argv[i],demproductname(demid));demid++);
+    if (demid!=DEM_GT3&&demid!=DEM_AD1&&demid!=DEM_REP&&demid!=DEM_REM)
+    {
+      printf("No pre-referenced copy for DEM %s - exiting\n",argv[i]);
+      exit(-1);
+    }
+    if (buildrefgrid(ctx,demid)==-1)
+    {
+      printf("Cannot build the pre-referenced copy of %s - exiting\n",argv[i]);
+      exit(-1);
+    }
+    printf("%s pre-referenced copy written\n",argv[i]);
+  }
+  closetopocontext(ctx);
+  return(0);
+
+}
@@ -0,0 +1,4153 @@
+/*------------------------------------------------------------------------*
+ NAME:     libquerytopo.cpp
+
+ PURPOSE:  Queries global topographic and geoid databases and returns
+           topography and geoid heights for given lat/lon (in deg) points.
+           This is the library half of querytopo2: every open file and
+           setting lives in a topocontext, so the queries can be linked
+           into other programs and called from many threads at once.
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "/home/sonntag/Include/mission.h"
+#include "querytopo.h"
+#include "tiledgrid.h"
+#include "pyramid.h"
+#include "refgrid.h"
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+
+
+#define EGM96PATH "/usr/local/share/geoid/egm96/WW15MGH.DAC\0"
+#define EGM08PATH "/usr/local/share/geoid/egm2008/Und_min1x1_egm2008_isw=82_WGS84_TideFree_SE\0"
+#define GTOPO30PATH "/usr/local/share/dem/gtopo30\0"
+#define BEDMAP2PATH "/usr/local/share/dem/bedmap2/bedmap2_surface.flt\0"
+#define ARCTICDEM100PATH "/usr/local/share/dem/arcticdem100/arcticdem_mosaic_100m_v3.0.flt\0"
+#define REMP100PATH "/usr/local/share/dem/rema100/REMA_100m_peninsula_dem_filled.flt\0"
+#define REMA100PATH "/usr/local/share/dem/rema100/REMA_100m_dem.flt\0"
+#define GIMP90PATH "/usr/local/share/dem/gimp90/gimp90m.dem\0"
+#define DATASETSPATH "/usr/local/share/dem/datasets.conf"  // read if present and $QUERYTOPO_DATASETS is not set
+#define C 299792458.0
+#define WE 7.292115147e-5
+#define MU 3.986005005e14
+#define PI (4.0*atan((double)(1.0)))
+#define AE 6378137.0
+#define FLAT (1.0/298.257223563)
+#define RAD2NM (180.0*60.0/PI)
+#define RAD2KM (RAD2NM*6076.1*12.0*2.54/100.0/1000.0)
+
+#define IO_STDIO 0  // fseek/fread through a buffered FILE
+#define IO_MMAP 1   // read-only mapping of the whole file, corners are plain loads
+
+struct gridfile
+{
+  FILE *fptr;      // open stream when using the stdio backend
+  char *map;       // base of the mapping when using the mmap backend
+  long long size;  // length of the mapping in bytes
+  int status;      // 0 not yet opened, 1 open, -1 could not be opened
+  int tiledim;     // pixels on a side of a tile in a .tfl file, 0 for a row-major grid
+  long long nx,ny,ntilesx;     // grid and tile counts of a .tfl file
+  struct tileentry *tiles;     // tile index of a .tfl file
+  int owntiles;                // tiles was allocated rather than pointing into the map
+  struct tileslot *slots;      // recently decoded compressed tiles of a .tfl file
+};
+
+// Compressed tiles are decoded whole, so the last few decoded tiles of
+// each file are kept for the neighbouring points that land in them.
+// Slots are direct mapped by tile number and locked individually.
+#define NTILESLOTS 64
+
+struct tileslot
+{
+  pthread_mutex_t lock;
+  long long tile;          // tile held in data, -1 if none
+  float *data;             // tiledim*tiledim decoded pixels, then as many packed bytes
+};
+
+
+// Polar stereographic projection (Snyder 1987, eqs 15-9, 21-33, 21-34),
+// reduced to the constants that depend only on the standard parallel,
+// central meridian and ellipsoid.  Same results as geod2ps to well under
+// a millimetre.
+#define PSBLOCK 256  // points projected per pass
+
+struct psprojection
+{
+  double sign;             // 1 for a north polar projection, -1 for south
+  double lonv;             // central meridian in deg, sign applied
+  double e;                // eccentricity of the ellipsoid
+  double scale;            // a*k0*mc/tc, m
+};
+
+// Lowest and highest EGM2008 node of a 1x1 deg cell, the nodes on its
+// edges included, found the first time a region query needs them
+struct geoidcell
+{
+  float min,max;
+  int done;                // set once min and max are filled
+};
+
+#define NDEMFILES 38
+#define NGEOIDFILES 2
+
+// Where each DEM product and geoid is read from and how its heights are
+// used.  Indexed by enum demproduct, followed by the two geoids.  These
+// start out as built in and may be changed by a dataset file.
+#define DS_E08 NDEMPRODUCTS          // EGM2008 geoid
+#define DS_E96 (NDEMPRODUCTS+1)      // EGM96 geoid
+#define NDATASETS (NDEMPRODUCTS+2)
+#define MAXPATHLEN 1024
+
+struct dataset
+{
+  char path[MAXPATHLEN];   // grid file, or the directory holding the GTOPO30 tiles
+  int geoidref;            // 1 if heights are relative to the geoid, 0 the WGS-84 ellipsoid
+  int priority;            // order among the polar DEMs covering a point, lowest first, 0 if off
+};
+
+struct topocontext
+{
+  int iobackend;                           // IO_MMAP or IO_STDIO
+  pthread_mutex_t lock;                    // serializes opening of grid files
+  struct gridfile demfiles[NDEMFILES];     // one handle per DEM file, opened on first use
+             // 0-32 corresponding GTOPO30 tile file
+             // 33 GIMP90 file
+             // 34 Bedmap-2 file
+             // 35 ArcticDEM-100m file
+             // 36 REMA Peninsula-100m filled file
+             // 37 REMA-100m file
+  struct gridfile geoidfiles[NGEOIDFILES]; // one handle per geoid file, opened on first use
+             // 0 EGM2008 file
+             // 1 EGM96 file
+  struct gridfile pyramidfiles[NDEMPRODUCTS]; // min/max pyramid of each DEM, opened on first use
+  struct gridfile reffiles[NDEMFILES];     // pre-referenced copy of each DEM file, opened on first use
+  int prereferenced;                       // 1 to read the pre-referenced copies where there are any
+  struct blockcache *cache;                // block cache for the 100m polar DEMs, NULL if off
+  int spatialsort;                         // 1 to query each batch in space-filling-curve order
+  struct psprojection polar[2];            // 0 ArcticDEM (north), 1 REMA (south) polar stereographic
+  float *egm08;                            // resident EGM2008 grid in m, NULL if read from file
+  short *egm08cm;                          // resident EGM2008 grid in cm, NULL if not packed
+  short *egm96;                            // resident EGM96 grid in cm, NULL if read from file
+  struct geoidcell *geoidcells;            // EGM2008 range of each 1 deg cell, NULL until a region query
+  struct dataset datasets[NDATASETS];      // paths, datums and priorities of the DEMs and geoids
+};
+
+// Built-in dataset settings, and the ids used for them in a dataset file
+struct datasetdefault
+{
+  const char *name;
+  const char *path;
+  int geoidref;
+  int priority;
+};
+
+static const struct datasetdefault datasetdefaults[NDATASETS] =
+{
+  {"---", "",               0, 0},
+  {"GT3", GTOPO30PATH,      1, 0},  // the fallback everywhere, so not prioritized
+  {"BM2", BEDMAP2PATH,      1, 0},
+  {"G90", GIMP90PATH,       0, 0},
+  {"AD1", ARCTICDEM100PATH, 0, 1},
+  {"REP", REMP100PATH,      0, 1},
+  {"REM", REMA100PATH,      0, 2},
+  {"E08", EGM08PATH,        1, 0},
+  {"E96", EGM96PATH,        1, 0},
+};
+
+#define EGM08NX 21602
+#define EGM08NY 10801
+#define EGM96NX 1440
+#define EGM96NY 721
+#define GEOIDCMNODATA (-32768)  // no-data value of a grid packed in cm
+
+
+// Block cache for the float32 polar DEMs.  Pixels are loaded in square
+// blocks of BLOCKDIM x BLOCKDIM and kept in least-recently-used order up
+// to a memory budget.  The cache is split into shards, each with its own
+// lock, hash table and LRU list, so threads rarely wait on each other.
+#define BLOCKDIM 256
+#define NCACHESHARDS 16
+
+struct cacheblock
+{
+  struct gridfile *gf;             // file the block came from
+  long long blockrow,blockcol;     // position of the block in the grid
+  float *data;                     // BLOCKDIM rows of BLOCKDIM pixels
+  struct cacheblock *prev,*next;   // LRU list, most recently used first
+  struct cacheblock *hnext;        // hash chain
+};
+
+struct cacheshard
+{
+  pthread_mutex_t lock;
+  long maxblocks,nblocks;
+  long nhash;
+  struct cacheblock **hash;
+  struct cacheblock *head,*tail;
+  long long hits,misses;
+};
+
+struct blockcache
+{
+  struct cacheshard shards[NCACHESHARDS];
+};
+
+
+// Point index and its position along a space-filling curve, for sorting
+struct keyedpoint
+{
+  unsigned long long key;
+  long i;
+};
+
+// Masks for spreading the bits of a 32-bit value to every other bit, by shift
+static const unsigned long long mortonmask[17] =
+  {0,0x5555555555555555ULL,0x3333333333333333ULL,0,0x0f0f0f0f0f0f0f0fULL,0,0,0,
+   0x00ff00ff00ff00ffULL,0,0,0,0,0,0,0,0x0000ffff0000ffffULL};
+
+
+// Bilinear interpolation shared by every grid.  The readers gather, for a
+// block of up to QBLOCK points, the four samples around each point in the
+// order q11,q21,q12,q22 and its position u,v within the cell, measured in
+// pixels from q11 towards q21 and q12.  The kernel turns stored samples
+// into heights, applies the grid's no data (-9999) policy and weights the
+// corners, with no branches or divisions so the compiler can vectorize it.
+#define QBLOCK 256         // points per pass of the kernel
+#define NODATA_FLAG 0      // a no data corner makes the result -9999
+#define NODATA_ZERO 1      // a no data corner counts as 0
+
+struct beint16             // big-endian int16 sample, as on file for GTOPO30 and EGM96
+{
+  unsigned short raw;
+};
+#define BEINT16NODATA 0xf1d8  // raw of a big-endian -9999, given to corners that can't be read
+
+struct geoidcm             // int16 geoid height in cm, GEOIDCMNODATA if none
+{
+  short cm;
+};
+
+// Height of a stored sample, and the height that stored no data decodes to
+static inline double samplevalue(float s) { return(s); }
+static inline double samplevalue(short s) { return(s); }
+static inline double samplevalue(struct beint16 s) { return((short)__builtin_bswap16(s.raw)); }
+static inline double samplevalue(struct geoidcm s) { return(s.cm*0.01); }
+static inline double nodatavalue(const float *q) { return(-9999.0); }
+static inline double nodatavalue(const short *q) { return(-9999.0); }
+static inline double nodatavalue(const struct beint16 *q) { return(-9999.0); }
+static inline double nodatavalue(const struct geoidcm *q) { return(GEOIDCMNODATA*0.01); }
+
+template <class T,int nodata>
+void bilinear(long n,const T *__restrict q,const double *__restrict u,const double *__restrict v,
+              double *__restrict p)
+{
+  long i;
+  double q11,q21,q12,q22,nd,r;
+  bool flag;
+
+  nd = nodatavalue(q);
+  for (i=0;i<n;i++)
+  {
+    q11 = samplevalue(q[4*i]);
+    q21 = samplevalue(q[4*i+1]);
+    q12 = samplevalue(q[4*i+2]);
+    q22 = samplevalue(q[4*i+3]);
+    flag = (q11==nd)|(q21==nd)|(q12==nd)|(q22==nd);
+    if (nodata==NODATA_ZERO)
+    {
+      q11 = (q11==nd) ? 0.0 : q11;
+      q21 = (q21==nd) ? 0.0 : q21;
+      q12 = (q12==nd) ? 0.0 : q12;
+      q22 = (q22==nd) ? 0.0 : q22;
+      flag = false;
+    }
+    r = (1.0-v[i])*((1.0-u[i])*q11+u[i]*q21)+v[i]*((1.0-u[i])*q12+u[i]*q22);
+    p[i] = flag ? -9999.0 : r;
+  }
+
+}
+
+
+// Finds the pixels k1,k2 either side of position d (in pixels) along an
+// axis of n pixels and returns the fraction of the way from k1 to k2.
+// On the last pixel centre both are that pixel and the fraction is 0.
+// Beyond the outermost pixel centres both are the edge pixel and the
+// fraction is NaN, the interpolation there being undefined, as it is for
+// a NaN position.
+static inline double gridaxis(double d,long long n,long long *k1,long long *k2)
+{
+  if (!(d>=0.0))
+  {
+    *k1 = *k2 = 0;
+    return(NAN);
+  }
+  if (d>=(n-1))
+  {
+    *k1 = *k2 = n-1;
+    return((d==(n-1)) ? 0.0 : NAN);
+  }
+  *k1 = (long long)d;
+  *k2 = *k1+1;
+  return(d-*k1);
+}
+
+struct topocontext *inittopocontext()
+{
+  int i;
+  struct topocontext *ctx;
+  void initpsprojection(struct psprojection *,double,double,double,double,double);
+
+  if ((ctx=(struct topocontext *)malloc(sizeof(struct topocontext)))==NULL) return(NULL);
+  ctx->iobackend = IO_MMAP;
+  ctx->cache = NULL;
+  ctx->spatialsort = 0;
+  ctx->prereferenced = 0;
+  initpsprojection(&ctx->polar[0],70.0,-45.0,1.0,AE,FLAT);
+  initpsprojection(&ctx->polar[1],-71.0,0.0,1.0,AE,FLAT);
+  ctx->egm08 = NULL;
+  ctx->egm08cm = NULL;
+  ctx->egm96 = NULL;
+  ctx->geoidcells = NULL;
+  pthread_mutex_init(&ctx->lock,NULL);
+  for (i=0;i<NDATASETS;i++)
+  {
+    strcpy(ctx->datasets[i].path,datasetdefaults[i].path);
+    ctx->datasets[i].geoidref = datasetdefaults[i].geoidref;
+    ctx->datasets[i].priority = datasetdefaults[i].priority;
+  }
+
+  // No DEM or geoid files are open at start
+  memset(ctx->demfiles,0,sizeof(ctx->demfiles));
+  memset(ctx->geoidfiles,0,sizeof(ctx->geoidfiles));
+  memset(ctx->pyramidfiles,0,sizeof(ctx->pyramidfiles));
+  memset(ctx->reffiles,0,sizeof(ctx->reffiles));
+  return(ctx);
+}
+
+
+int closetopocontext(struct topocontext *ctx)
+{
+  int i;
+  int closegridfile(struct gridfile *);
+  void freeblockcache(struct blockcache *);
+  void freegeoidmemory(struct topocontext *);
+
+  if (ctx==NULL) return(0);
+  freeblockcache(ctx->cache);
+  freegeoidmemory(ctx);
+  for (i=0;i<NDEMFILES;i++) closegridfile(&ctx->demfiles[i]);
+  for (i=0;i<NGEOIDFILES;i++) closegridfile(&ctx->geoidfiles[i]);
+  for (i=0;i<NDEMPRODUCTS;i++) closegridfile(&ctx->pyramidfiles[i]);
+  for (i=0;i<NDEMFILES;i++) closegridfile(&ctx->reffiles[i]);
+  free(ctx->geoidcells);
+  pthread_mutex_destroy(&ctx->lock);
+  free(ctx);
+  return(0);
+}
+
+
+int setiobackend(struct topocontext *ctx,const char *name)
+{
+  if (!strcmp(name,"mmap")) ctx->iobackend = IO_MMAP;
+  else if (!strcmp(name,"stdio")) ctx->iobackend = IO_STDIO;
+  else return(-1);
+  return(0);
+}
+
+
+int opengridfile(struct gridfile *gf,const char *path,int iobackend,long long nx,long long ny)
+{
+  int len;
+  char tiledpath[MAXPATHLEN+20];
+  int openrawfile(struct gridfile *,const char *,int);
+  int readtiledheader(struct gridfile *,long long,long long);
+  int closegridfile(struct gridfile *);
+
+  // Prefer a tiled copy of a .flt raster, made by tileflt alongside it,
+  // if it holds a grid of the nx by ny pixels expected
+  len = strlen(path);
+  if (len>4&&len<(int)sizeof(tiledpath)&&!strcmp(path+len-4,".flt"))
+  {
+    strcpy(tiledpath,path);
+    strcpy(tiledpath+len-4,".tfl");
+    if (openrawfile(gf,tiledpath,iobackend)==0)
+    {
+      if (readtiledheader(gf,nx,ny)==0) return(0);
+      closegridfile(gf);
+    }
+  }
+  return(openrawfile(gf,path,iobackend));
+}
+
+
+int openrawfile(struct gridfile *gf,const char *path,int iobackend)
+{
+  int fd;
+  void *map;
+  struct stat sb;
+
+  gf->fptr = NULL;
+  gf->map = NULL;
+  gf->size = 0;
+  gf->tiledim = 0;
+  gf->tiles = NULL;
+  gf->owntiles = 0;
+  gf->slots = NULL;
+
+  // Map the whole file read-only, pages are then served straight from the page cache
+  if (iobackend==IO_MMAP)
+  {
+    if ((fd=open(path,O_RDONLY))==-1) return(-1);
+    if (fstat(fd,&sb)==0&&sb.st_size>0)
+    {
+      map = mmap(NULL,sb.st_size,PROT_READ,MAP_SHARED,fd,0);
+      if (map!=MAP_FAILED)
+      {
+        gf->map = (char *)map;
+        gf->size = sb.st_size;
+        madvise(map,sb.st_size,MADV_RANDOM);  // point lookups and block loads gain nothing from readahead
+      }
+    }
+    close(fd);
+    if (gf->map!=NULL) return(0);
+  }
+
+  // Stdio backend, also the fallback if the file could not be mapped
+  if ((gf->fptr=fopen(path,"r"))==NULL) return(-1);
+  return(0);
+}
+
+
+int readtiledheader(struct gridfile *gf,long long nx,long long ny)
+{
+  long long ntiles,k;
+  struct tiledheader hdr;
+  int readgridfile(struct gridfile *,long long,void *,int);
+
+  // Check this is a tiled grid we understand
+  if (readgridfile(gf,0,&hdr,sizeof(hdr))==-1) return(-1);
+  if (memcmp(hdr.magic,TILEDMAGIC,8)||hdr.version!=TILEDVERSION) return(-1);
+  if (hdr.tiledim<=0||hdr.nx!=nx||hdr.ny!=ny) return(-1);
+  if (hdr.ntilesx!=(hdr.nx+hdr.tiledim-1)/hdr.tiledim) return(-1);
+  if (hdr.ntilesy!=(hdr.ny+hdr.tiledim-1)/hdr.tiledim) return(-1);
+  ntiles = (long long)hdr.ntilesx*hdr.ntilesy;
+
+  // Use the tile index in place when mapped, otherwise read it in
+  if (gf->map!=NULL)
+  {
+    if (hdr.indexoffset<0||hdr.indexoffset%8||hdr.indexoffset+ntiles*sizeof(struct tileentry)>gf->size)
+      return(-1);
+    gf->tiles = (struct tileentry *)(gf->map+hdr.indexoffset);
+  }
+  else
+  {
+    if ((gf->tiles=(struct tileentry *)malloc(ntiles*sizeof(struct tileentry)))==NULL) return(-1);
+    gf->owntiles = 1;
+    for (k=0;k<ntiles;k+=65536)
+      if (readgridfile(gf,hdr.indexoffset+k*sizeof(struct tileentry),gf->tiles+k,
+                       (ntiles-k<65536 ? ntiles-k : 65536)*sizeof(struct tileentry))==-1)
+        return(-1);
+  }
+
+  // Slots for decoded tiles, their buffers are allocated on first use
+  if ((gf->slots=(struct tileslot *)malloc(NTILESLOTS*sizeof(struct tileslot)))==NULL) return(-1);
+  for (k=0;k<NTILESLOTS;k++)
+  {
+    pthread_mutex_init(&gf->slots[k].lock,NULL);
+    gf->slots[k].tile = -1;
+    gf->slots[k].data = NULL;
+  }
+  gf->tiledim = hdr.tiledim;
+  gf->nx = hdr.nx;
+  gf->ny = hdr.ny;
+  gf->ntilesx = hdr.ntilesx;
+  return(0);
+}
+
+
+int closegridfile(struct gridfile *gf)
+{
+  int i;
+
+  if (gf->slots!=NULL)
+  {
+    for (i=0;i<NTILESLOTS;i++)
+    {
+      pthread_mutex_destroy(&gf->slots[i].lock);
+      free(gf->slots[i].data);
+    }
+    free(gf->slots);
+  }
+  if (gf->owntiles) free(gf->tiles);
+  if (gf->map!=NULL) munmap(gf->map,gf->size);
+  if (gf->fptr!=NULL) fclose(gf->fptr);
+  gf->fptr = NULL;
+  gf->map = NULL;
+  gf->size = 0;
+  gf->status = 0;
+  gf->tiledim = 0;
+  gf->tiles = NULL;
+  gf->owntiles = 0;
+  gf->slots = NULL;
+  return(0);
+}
+
+
+struct gridfile *getgridfile(struct topocontext *ctx,struct gridfile *gf,const char *path,long long nx,
+                             long long ny)
+{
+  int status;
+
+  // Open the file the first time it is needed and keep it open until the
+  // context is closed.  A .flt grid is nx by ny pixels, its tiled copy only
+  // being used if it is too; other files pass 0 for both.  A failed open is remembered so we don't retry it on
+  // every point.  Threads sharing the context may race to open the same
+  // file, so the open itself is done under the context lock.
+  status = __atomic_load_n(&gf->status,__ATOMIC_ACQUIRE);
+  if (status==0)
+  {
+    pthread_mutex_lock(&ctx->lock);
+    if (gf->status==0)
+      __atomic_store_n(&gf->status,(opengridfile(gf,path,ctx->iobackend,nx,ny)==0) ? 1 : -1,__ATOMIC_RELEASE);
+    status = gf->status;
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  if (status==1) return(gf);
+  return(NULL);
+}
+
+
+int readgridfile(struct gridfile *gf,long long offset,void *buf,int len)
+{
+  if (gf->map!=NULL)
+  {
+    if (offset<0||offset+len>gf->size) return(-1);
+    memcpy(buf,gf->map+offset,len);
+    return(0);
+  }
+  if (gf->fptr==NULL) return(-1);
+  flockfile(gf->fptr);  // keep the seek and read together when threaded
+  fseek(gf->fptr,offset,SEEK_SET);
+  len = fread(buf,len,1,gf->fptr);
+  funlockfile(gf->fptr);
+  if (len!=1) return(-1);
+  return(0);
+}
+
+int readgridspan(struct gridfile *gf,long long nx,long long row,long long col,long long n,float *buf)
+{
+  // Reads n float32 pixels along a row of a grid, starting at (row,col),
+  // from either a row-major .flt file or a tiled .tfl file
+  long long k,seg,tile,r,c,i;
+  struct tileentry *te;
+  int readtileslot(struct gridfile *,long long,long long,long long,long long,float *);
+
+  if (gf->tiledim==0) return(readgridfile(gf,4*(row*nx+col),buf,4*n));
+  if (row<0||row>=gf->ny||col<0||col+n>gf->nx) return(-1);
+  for (k=0;k<n;k+=seg)
+  {
+    r = row%gf->tiledim;
+    c = (col+k)%gf->tiledim;
+    seg = gf->tiledim-c;
+    if (seg>n-k) seg = n-k;
+    tile = (row/gf->tiledim)*gf->ntilesx+(col+k)/gf->tiledim;
+    te = &gf->tiles[tile];
+    if (te->codec==TILECODEC_RAW)
+    {
+      if (readgridfile(gf,te->offset+4*(r*gf->tiledim+c),buf+k,4*seg)==-1) return(-1);
+    }
+    else if (te->codec==TILECODEC_CONST)
+    {
+      for (i=0;i<seg;i++) buf[k+i] = te->value;
+    }
+    else if (te->codec==TILECODEC_DEFLATE)
+    {
+      if (readtileslot(gf,tile,r,c,seg,buf+k)==-1) return(-1);
+    }
+    else
+      return(-1);
+  }
+  return(0);
+}
+
+
+int readtileslot(struct gridfile *gf,long long tile,long long r,long long c,long long n,float *buf)
+{
+  // Copies n pixels of row r of a compressed tile, starting at column c,
+  // decoding the tile into its slot first unless it is already there
+  int status,npix;
+  uLongf len;
+  unsigned char *packed,*zdata;
+  struct tileentry *te;
+  struct tileslot *slot;
+  int readgridfile(struct gridfile *,long long,void *,int);
+
+  te = &gf->tiles[tile];
+  slot = &gf->slots[tile%NTILESLOTS];
+  npix = gf->tiledim*gf->tiledim;
+  status = 0;
+  pthread_mutex_lock(&slot->lock);
+  if (slot->tile!=tile)
+  {
+    slot->tile = -1;
+    if (slot->data==NULL) slot->data = (float *)malloc(8*(long long)npix);
+    if (slot->data==NULL||te->size<=0||te->size>4*npix) status = -1;
+    packed = (unsigned char *)(slot->data+npix);
+
+    // The compressed bytes are used in place when mapped, otherwise they
+    // are read into the back half of the slot and inflated from there
+    zdata = NULL;
+    if (status==0&&gf->map!=NULL)
+    {
+      if (te->offset<0||te->offset+te->size>gf->size)
+        status = -1;
+      else
+        zdata = (unsigned char *)gf->map+te->offset;
+    }
+    else if (status==0)
+    {
+      if ((zdata=(unsigned char *)malloc(te->size))==NULL||readgridfile(gf,te->offset,zdata,te->size)==-1)
+        status = -1;
+    }
+    len = 4*npix;
+    if (status==0&&(uncompress(packed,&len,zdata,te->size)!=Z_OK||len!=(uLongf)(4*npix)))
+      status = -1;
+    if (gf->map==NULL) free(zdata);
+    if (status==0)
+    {
+      unpacktile(packed,slot->data,npix);
+      slot->tile = tile;
+    }
+  }
+  if (status==0) memcpy(buf,slot->data+r*gf->tiledim+c,4*n);
+  pthread_mutex_unlock(&slot->lock);
+  return(status);
+}
+
+
+int readgridcorners(struct topocontext *ctx,struct gridfile *gf,long long nx,long long ny,
+                    long long n1,long long n2,long long m1,long long m2,
+                    float *q11,float *q21,float *q12,float *q22)
+{
+  // Reads the four bilinear corners of a float32 grid, through the block
+  // cache if one is set up, otherwise straight from the file.  A corner
+  // that can't be read is -9999, and -1 is returned.
+  int k,status;
+  long long row[4],col[4];
+  float *val[4];
+  int readcachedcorners(struct blockcache *,struct gridfile *,long long,long long,
+                        long long,long long,long long,long long,float *,float *,float *,float *);
+
+  if (ctx->cache!=NULL)
+    return(readcachedcorners(ctx->cache,gf,nx,ny,n1,n2,m1,m2,q11,q21,q12,q22));
+  row[0] = row[1] = n1;
+  row[2] = row[3] = n2;
+  col[0] = col[2] = m1;
+  col[1] = col[3] = m2;
+  val[0] = q11;
+  val[1] = q21;
+  val[2] = q12;
+  val[3] = q22;
+  status = 0;
+  for (k=0;k<4;k++)
+    if (readgridspan(gf,nx,row[k],col[k],1,val[k])==-1)
+    {
+      *val[k] = -9999.0;
+      status = -1;
+    }
+  return(status);
+}
+
+
+int setcachesize(struct topocontext *ctx,long long bytes)
+{
+  int i;
+  long maxblocks;
+  struct cacheshard *shard;
+  void freeblockcache(struct blockcache *);
+
+  // Drop any existing cache, a budget of 0 turns caching off
+  freeblockcache(ctx->cache);
+  ctx->cache = NULL;
+  maxblocks = bytes/((long long)BLOCKDIM*BLOCKDIM*sizeof(float)*NCACHESHARDS);
+  if (bytes<=0) return(0);
+  if (maxblocks<1) maxblocks = 1;
+
+  // Set up empty shards, block memory is allocated as blocks are first loaded
+  if ((ctx->cache=(struct blockcache *)calloc(1,sizeof(struct blockcache)))==NULL) return(-1);
+  for (i=0;i<NCACHESHARDS;i++)
+  {
+    shard = &ctx->cache->shards[i];
+    shard->maxblocks = maxblocks;
+    shard->nhash = 2*maxblocks+1;
+    if ((shard->hash=(struct cacheblock **)calloc(shard->nhash,sizeof(struct cacheblock *)))==NULL)
+    {
+      freeblockcache(ctx->cache);
+      ctx->cache = NULL;
+      return(-1);
+    }
+    pthread_mutex_init(&shard->lock,NULL);
+  }
+  return(0);
+}
+
+
+void freeblockcache(struct blockcache *cache)
+{
+  int i;
+  struct cacheblock *blk,*next;
+
+  if (cache==NULL) return;
+  for (i=0;i<NCACHESHARDS;i++)
+  {
+    if (cache->shards[i].hash==NULL) continue;
+    for (blk=cache->shards[i].head;blk!=NULL;blk=next)
+    {
+      next = blk->next;
+      free(blk->data);
+      free(blk);
+    }
+    free(cache->shards[i].hash);
+    pthread_mutex_destroy(&cache->shards[i].lock);
+  }
+  free(cache);
+}
+
+
+int getcachestats(struct topocontext *ctx,long long *hits,long long *misses)
+{
+  int i;
+
+  *hits = 0;
+  *misses = 0;
+  if (ctx->cache==NULL) return(0);
+  for (i=0;i<NCACHESHARDS;i++)
+  {
+    pthread_mutex_lock(&ctx->cache->shards[i].lock);
+    *hits += ctx->cache->shards[i].hits;
+    *misses += ctx->cache->shards[i].misses;
+    pthread_mutex_unlock(&ctx->cache->shards[i].lock);
+  }
+  return(0);
+}
+
+
+unsigned long long hashblock(struct gridfile *gf,long long blockrow,long long blockcol)
+{
+  unsigned long long h;
+
+  h = (unsigned long long)(size_t)gf;
+  h = h*0x9e3779b97f4a7c15ULL+(unsigned long long)blockrow;
+  h = h*0x9e3779b97f4a7c15ULL+(unsigned long long)blockcol;
+  return(h^(h>>29));
+}
+
+
+struct cacheblock *getcacheblock(struct cacheshard *shard,unsigned long long h,struct gridfile *gf,
+                                 long long nx,long long ny,long long blockrow,long long blockcol)
+{
+  // Returns the requested block, loading it if necessary.  The caller
+  // holds the shard lock.
+  long long r,r0,c0,nr,nc;
+  long bucket;
+  struct cacheblock *blk,**pp;
+
+  // Look for the block in the shard, moving a hit to the front of the LRU list
+  bucket = (h/NCACHESHARDS)%shard->nhash;
+  for (blk=shard->hash[bucket];blk!=NULL;blk=blk->hnext)
+    if (blk->gf==gf&&blk->blockrow==blockrow&&blk->blockcol==blockcol) break;
+  if (blk!=NULL)
+  {
+    shard->hits++;
+    if (blk!=shard->head)
+    {
+      blk->prev->next = blk->next;
+      if (blk->next!=NULL) blk->next->prev = blk->prev;
+      else shard->tail = blk->prev;
+      blk->prev = NULL;
+      blk->next = shard->head;
+      shard->head->prev = blk;
+      shard->head = blk;
+    }
+    return(blk);
+  }
+  shard->misses++;
+
+  // Take a new block while under budget, otherwise evict the least recently used
+  if (shard->nblocks<shard->maxblocks)
+  {
+    if ((blk=(struct cacheblock *)malloc(sizeof(struct cacheblock)))==NULL) return(NULL);
+    if ((blk->data=(float *)malloc((long long)BLOCKDIM*BLOCKDIM*sizeof(float)))==NULL)
+    {
+      free(blk);
+      return(NULL);
+    }
+    shard->nblocks++;
+  }
+  else
+  {
+    blk = shard->tail;
+    shard->tail = blk->prev;
+    if (shard->tail!=NULL) shard->tail->next = NULL;
+    else shard->head = NULL;
+    pp = &shard->hash[(hashblock(blk->gf,blk->blockrow,blk->blockcol)/NCACHESHARDS)%shard->nhash];
+    while (*pp!=blk) pp = &(*pp)->hnext;
+    *pp = blk->hnext;
+  }
+
+  // Read the block a row at a time, blocks on the right and bottom edges
+  // of the grid are only partly filled.  A block that cannot be read is
+  // dropped rather than cached.
+  r0 = blockrow*BLOCKDIM;
+  c0 = blockcol*BLOCKDIM;
+  nr = (ny-r0<BLOCKDIM) ? ny-r0 : BLOCKDIM;
+  nc = (nx-c0<BLOCKDIM) ? nx-c0 : BLOCKDIM;
+  for (r=0;r<nr;r++)
+    if (readgridspan(gf,nx,r0+r,c0,nc,blk->data+r*BLOCKDIM)==-1)
+    {
+      free(blk->data);
+      free(blk);
+      shard->nblocks--;
+      return(NULL);
+    }
+  blk->gf = gf;
+  blk->blockrow = blockrow;
+  blk->blockcol = blockcol;
+
+  // Insert at the front of the LRU list and into the hash table
+  blk->prev = NULL;
+  blk->next = shard->head;
+  if (shard->head!=NULL) shard->head->prev = blk;
+  shard->head = blk;
+  if (shard->tail==NULL) shard->tail = blk;
+  blk->hnext = shard->hash[bucket];
+  shard->hash[bucket] = blk;
+  return(blk);
+}
+
+
+int readcachedcorners(struct blockcache *cache,struct gridfile *gf,long long nx,long long ny,
+                      long long n1,long long n2,long long m1,long long m2,
+                      float *q11,float *q21,float *q12,float *q22)
+{
+  // Reads the four bilinear corners of a float32 grid through the block
+  // cache.  Corners in the same block are served under one lock.  Corners
+  // outside the grid, or in a block that cannot be read, are no data.
+  int k;
+  long long row[4],col[4],brow,bcol,lastbrow,lastbcol;
+  unsigned long long h;
+  float *val[4];
+  struct cacheshard *shard;
+  struct cacheblock *blk;
+
+  row[0] = n1;  col[0] = m1;  val[0] = q11;
+  row[1] = n1;  col[1] = m2;  val[1] = q21;
+  row[2] = n2;  col[2] = m1;  val[2] = q12;
+  row[3] = n2;  col[3] = m2;  val[3] = q22;
+  shard = NULL;
+  blk = NULL;
+  lastbrow = -1;
+  lastbcol = -1;
+  for (k=0;k<4;k++) *val[k] = -9999.0;
+  for (k=0;k<4;k++)
+  {
+    if (row[k]<0||row[k]>=ny||col[k]<0||col[k]>=nx) continue;
+    brow = row[k]/BLOCKDIM;
+    bcol = col[k]/BLOCKDIM;
+    if (blk==NULL||brow!=lastbrow||bcol!=lastbcol)
+    {
+      if (shard!=NULL) pthread_mutex_unlock(&shard->lock);
+      h = hashblock(gf,brow,bcol);
+      shard = &cache->shards[h%NCACHESHARDS];
+      pthread_mutex_lock(&shard->lock);
+      if ((blk=getcacheblock(shard,h,gf,nx,ny,brow,bcol))==NULL)
+      {
+        pthread_mutex_unlock(&shard->lock);
+        return(-1);
+      }
+      lastbrow = brow;
+      lastbcol = bcol;
+    }
+    else
+      shard->hits++;
+    *val[k] = blk->data[(row[k]-brow*BLOCKDIM)*BLOCKDIM+(col[k]-bcol*BLOCKDIM)];
+  }
+  if (shard!=NULL) pthread_mutex_unlock(&shard->lock);
+  return(0);
+}
+
+
+double querytopo(struct topocontext *ctx,double lat, double lon, char *demid)
+{
+  int p;
+  double x,y,topo;
+  void querygtopo30(struct topocontext *,long,const double *,const double *,double *);
+  void queryarcticdem100(struct topocontext *,long,const double *,const double *,double *);
+  void queryremp(struct topocontext *,long,const double *,const double *,double *);
+  void queryrema(struct topocontext *,long,const double *,const double *,double *);
+  int polardem(struct topocontext *,int,double,double);
+  void projectps(const struct psprojection *,long,const double *,const double *,double *,double *);
+
+  // Try ArcticDEM-100m in the northern hemisphere, REMA Peninsula or REMA
+  // in the southern by position, answers relative to the WGS-84 ellipsoid
+  projectps(ctx->polar,1,&lat,&lon,&x,&y);
+  p = polardem(ctx,lat<0.0,x,y);
+  topo = -9999.0;
+  if (p==DEM_AD1) queryarcticdem100(ctx,1,&x,&y,&topo);
+  if (p==DEM_REP) queryremp(ctx,1,&x,&y,&topo);
+  if (p==DEM_REM) queryrema(ctx,1,&x,&y,&topo);
+
+  // Go to GTOPO30 if no polar DEM applies or it returned unknown
+  if (topo==-9999.0)
+  {
+    p = DEM_GT3;
+    querygtopo30(ctx,1,&lat,&lon,&topo);  // answer is relative to mean sea level
+  }
+
+  // Return the result
+  strcpy(demid,demproductname(p));
+  return(topo);
+
+}
+
+
+int polardem(struct topocontext *ctx,int south,double x,double y)
+{
+  // Picks the polar DEM to query first at polar stereographic x,y in the
+  // given hemisphere, the lowest priority of those covering the point, or
+  // DEM_GT3 if none does
+  int p;
+  double rempx[5],rempy[5],remax[5],remay[5];
+  bool pointinpolygon(double,double,double *,double *,int);
+
+  // Every northern point tries ArcticDEM-100m, which answers unknown off its grid
+  if (!south) return((ctx->datasets[DEM_AD1].priority>0) ? DEM_AD1 : DEM_GT3);
+
+  // Define the REMA Peninsula (filled) boundary
+  rempx[0] = -2700000.0;  rempy[0] =  1800000.0;
+  rempx[1] = -1900000.0;  rempy[1] =  1800000.0;
+  rempx[2] = -1900000.0;  rempy[2] =   800000.0;
+  rempx[3] = -2700000.0;  rempy[3] =   800000.0;
+  rempx[4] = -2700000.0;  rempy[4] =  1800000.0;
+
+  // Define the REMA boundary
+  remax[0] = -2700000.0;  remay[0] =  2300000.0;
+  remax[1] =  2800000.0;  remay[1] =  2300000.0;
+  remax[2] =  2800000.0;  remay[2] = -2204200.0;
+  remax[3] = -2700000.0;  remay[3] = -2204200.0;
+  remax[4] = -2700000.0;  remay[4] =  2300000.0;
+
+  p = DEM_GT3;
+  if (ctx->datasets[DEM_REP].priority>0&&pointinpolygon(x,y,rempx,rempy,5)) p = DEM_REP;
+  if (ctx->datasets[DEM_REM].priority>0&&pointinpolygon(x,y,remax,remay,5)&&
+      (p==DEM_GT3||ctx->datasets[DEM_REM].priority<ctx->datasets[DEM_REP].priority)) p = DEM_REM;
+  return(p);
+
+}
+
+
+const char *demproductname(int demid)
+{
+  static const char *names[NDEMPRODUCTS] = {"---","GT3","BM2","G90","AD1","REP","REM"};
+
+  if (demid<0||demid>=NDEMPRODUCTS) return("---");
+  return(names[demid]);
+}
+
+
+int querytopobatch(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+                   double *topo,double *geoid,int *demid,char *geoidid)
+{
+  // Batch form of querytopo and querygeoid.  Points are grouped by source
+  // DEM, and each group is projected and queried in its own loop.  Heights
+  // are returned relative to the geoid (htrefflag=1), the WGS-84 ellipsoid
+  // (htrefflag=2) or the native reference of each DEM (htrefflag=0).
+  // Points with latitude out of bounds, or a NaN or infinite latitude or
+  // longitude, get demid DEM_NONE.
+  long i,k,m,ngt3,count[NDEMPRODUCTS],first[NDEMPRODUCTS];
+  long *order,*gt3,*geo,*idx;
+  int p,ref,fromref;
+  double *x,*y,*gx,*gy,*gp,*gg;
+  char *done,*served;
+  unsigned long long *kxy,*kll;
+  struct keyedpoint *work;
+  void querygtopo30(struct topocontext *,long,const double *,const double *,double *);
+  void queryarcticdem100(struct topocontext *,long,const double *,const double *,double *);
+  void queryremp(struct topocontext *,long,const double *,const double *,double *);
+  void queryrema(struct topocontext *,long,const double *,const double *,double *);
+  int queryrefarcticdem100(struct topocontext *,long,const double *,const double *,int,double *,double *,char *);
+  int queryrefremp(struct topocontext *,long,const double *,const double *,int,double *,double *,char *);
+  int queryrefrema(struct topocontext *,long,const double *,const double *,int,double *,double *,char *);
+  void querygtopo30ref(struct topocontext *,long,const double *,const double *,int,double *,double *,char *,char *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  int polardem(struct topocontext *,int,double,double);
+  void projectps(const struct psprojection *,long,const double *,const double *,double *,double *);
+  unsigned long long mortonkey(double,double);
+  void sortbykey(long *,long,const unsigned long long *,struct keyedpoint *);
+
+  // Allocate work space
+  strcpy(geoidid,"E08\0");
+  if (n<=0) return(0);
+  x = (double *)malloc(n*sizeof(double));
+  y = (double *)malloc(n*sizeof(double));
+  gx = (double *)malloc(n*sizeof(double));
+  gy = (double *)malloc(n*sizeof(double));
+  gp = (double *)malloc(n*sizeof(double));
+  order = (long *)malloc(n*sizeof(long));
+  gt3 = (long *)malloc(n*sizeof(long));
+  geo = NULL;
+  kxy = kll = NULL;
+  work = NULL;
+  if (ctx->spatialsort)
+  {
+    geo = (long *)malloc(n*sizeof(long));
+    kxy = (unsigned long long *)malloc(n*sizeof(unsigned long long));
+    kll = (unsigned long long *)malloc(n*sizeof(unsigned long long));
+    work = (struct keyedpoint *)malloc(n*sizeof(struct keyedpoint));
+  }
+  ref = (ctx->prereferenced&&htrefflag!=0);
+  gg = NULL;
+  done = served = NULL;
+  if (ref)
+  {
+    gg = (double *)malloc(n*sizeof(double));
+    done = (char *)calloc(n,sizeof(char));
+    served = (char *)malloc(n*sizeof(char));
+  }
+  if (x==NULL||y==NULL||gx==NULL||gy==NULL||gp==NULL||order==NULL||gt3==NULL||
+      (ctx->spatialsort&&(geo==NULL||kxy==NULL||kll==NULL||work==NULL))||
+      (ref&&(gg==NULL||done==NULL||served==NULL)))
+  {
+    free(x);
+    free(y);
+    free(gx);
+    free(gy);
+    free(gp);
+    free(order);
+    free(gt3);
+    free(geo);
+    free(kxy);
+    free(kll);
+    free(work);
+    free(gg);
+    free(done);
+    free(served);
+    return(-1);
+  }
+
+  // Project every point about its own pole
+  projectps(ctx->polar,n,lat,lon,x,y);
+
+  // Northern hemisphere points try ArcticDEM-100m first, southern
+  // hemisphere points go to REMA Peninsula, REMA or GTOPO30 by position
+  for (i=0;i<n;i++)
+  {
+    demid[i] = DEM_NONE;
+    if (!isfinite(lon[i])) continue;
+    if (lat[i]>=0.0&&lat[i]<=90.0) demid[i] = polardem(ctx,0,x[i],y[i]);
+    if (lat[i]>=-90.0&&lat[i]<0.0) demid[i] = polardem(ctx,1,x[i],y[i]);
+  }
+
+  // Sort the point indices by DEM
+  for (p=0;p<NDEMPRODUCTS;p++) count[p] = 0;
+  for (i=0;i<n;i++) count[demid[i]]++;
+  first[0] = 0;
+  for (p=1;p<NDEMPRODUCTS;p++) first[p] = first[p-1]+count[p-1];
+  for (i=0;i<n;i++) order[first[demid[i]]++] = i;
+  for (p=0;p<NDEMPRODUCTS;p++) first[p] -= count[p];
+
+  // Optionally order each group along a Morton curve through its native
+  // grid, 100 m pixels for the polar DEMs and 30" for GTOPO30, so nearby
+  // points are read together.  Results still land in input order.
+  if (ctx->spatialsort)
+  {
+    for (i=0;i<n;i++)
+    {
+      kll[i] = mortonkey((lon[i]+180.0)*120.0,(90.0-lat[i])*120.0);
+      if (demid[i]==DEM_AD1||demid[i]==DEM_REP||demid[i]==DEM_REM)
+        kxy[i] = mortonkey((x[i]+4.0e6)/100.0,(4.0e6-y[i])/100.0);
+      else
+        kxy[i] = kll[i];
+    }
+    for (p=0;p<NDEMPRODUCTS;p++) sortbykey(order+first[p],count[p],kxy,work);
+  }
+
+  // Query each polar DEM in turn, its points gathered in query order,
+  // collecting points that need GTOPO30.  A pre-referenced copy, if used,
+  // gives the geoid height as well.
+  ngt3 = 0;
+  for (k=first[DEM_GT3];k<first[DEM_GT3]+count[DEM_GT3];k++) gt3[ngt3++] = order[k];
+  for (p=DEM_AD1;p<=DEM_REM;p++)
+  {
+    idx = order+first[p];
+    m = count[p];
+    for (k=0;k<m;k++)
+    {
+      gx[k] = x[idx[k]];
+      gy[k] = y[idx[k]];
+    }
+    fromref = 0;
+    if (ref&&p==DEM_AD1) fromref = (queryrefarcticdem100(ctx,m,gx,gy,htrefflag,gp,gg,geoidid)==0);
+    if (ref&&p==DEM_REP) fromref = (queryrefremp(ctx,m,gx,gy,htrefflag,gp,gg,geoidid)==0);
+    if (ref&&p==DEM_REM) fromref = (queryrefrema(ctx,m,gx,gy,htrefflag,gp,gg,geoidid)==0);
+    if (!fromref&&p==DEM_AD1) queryarcticdem100(ctx,m,gx,gy,gp);  // answer is relative to the WGS-84 ellipsoid
+    if (!fromref&&p==DEM_REP) queryremp(ctx,m,gx,gy,gp);
+    if (!fromref&&p==DEM_REM) queryrema(ctx,m,gx,gy,gp);
+    for (k=0;k<m;k++)
+    {
+      i = idx[k];
+      topo[i] = gp[k];
+      if (topo[i]==-9999.0) gt3[ngt3++] = i;
+      else if (fromref&&!isnan(gg[k]))
+      {
+        geoid[i] = gg[k];
+        done[i] = 1;
+      }
+    }
+  }
+
+  // Query GTOPO30 where no polar DEM applies or one returned a no data flag
+  if (ctx->spatialsort) sortbykey(gt3,ngt3,kll,work);
+  for (k=0;k<ngt3;k++)
+  {
+    gx[k] = lat[gt3[k]];
+    gy[k] = lon[gt3[k]];
+  }
+  if (ref)
+  {
+    querygtopo30ref(ctx,ngt3,gx,gy,htrefflag,gp,gg,served,geoidid);
+    for (m=0,k=0;k<ngt3;k++)
+    {
+      i = gt3[k];
+      if (!served[k])
+      {
+        gt3[m] = i;
+        gx[m] = gx[k];
+        gy[m++] = gy[k];
+        continue;
+      }
+      topo[i] = gp[k];
+      geoid[i] = gg[k];
+      demid[i] = DEM_GT3;
+      done[i] = 1;
+    }
+    ngt3 = m;
+  }
+  querygtopo30(ctx,ngt3,gx,gy,gp);  // answer is relative to mean sea level
+  for (k=0;k<ngt3;k++)
+  {
+    i = gt3[k];
+    topo[i] = gp[k];
+    demid[i] = DEM_GT3;
+  }
+
+  // Query the geoid and reference the topo heights as requested, along
+  // the curve through the geoid grid if sorting
+  if (ctx->spatialsort)
+  {
+    for (i=0;i<n;i++) geo[i] = i;
+    sortbykey(geo,n,kll,work);
+  }
+  for (m=0,k=0;k<n;k++)
+  {
+    i = (geo!=NULL) ? geo[k] : k;
+    if (demid[i]==DEM_NONE)
+    {
+      topo[i] = -9999.0;
+      geoid[i] = -9999.0;
+      continue;
+    }
+    if (done!=NULL&&done[i])
+    {
+      if (isnan(topo[i])) topo[i] = -9999.0;
+      continue;
+    }
+    order[m] = i;
+    gx[m] = lat[i];
+    gy[m++] = lon[i];
+  }
+  querygeoidbatch(ctx,m,gx,gy,gp,geoidid);
+  for (k=0;k<m;k++)
+  {
+    i = order[k];
+    geoid[i] = gp[k];
+    if (ctx->datasets[demid[i]].geoidref&&htrefflag==2) topo[i] = topo[i]+geoid[i];
+    if (!ctx->datasets[demid[i]].geoidref&&htrefflag==1) topo[i] = topo[i]-geoid[i];
+    if (isnan(topo[i])) topo[i] = -9999.0;
+  }
+
+  free(x);
+  free(y);
+  free(gx);
+  free(gy);
+  free(gp);
+  free(order);
+  free(gt3);
+  free(geo);
+  free(kxy);
+  free(kll);
+  free(work);
+  free(gg);
+  free(done);
+  free(served);
+  return(0);
+
+}
+
+
+int setspatialsort(struct topocontext *ctx,int on)
+{
+  ctx->spatialsort = (on!=0);
+  return(0);
+}
+
+
+unsigned long long mortonkey(double col,double row)
+{
+  // Interleaves the bits of a grid column and row, clamped to 32 bits each
+  unsigned long long c,r;
+  int b;
+
+  c = (col>0.0) ? ((col<4294967295.0) ? (unsigned long long)col : 4294967295ULL) : 0;
+  r = (row>0.0) ? ((row<4294967295.0) ? (unsigned long long)row : 4294967295ULL) : 0;
+  for (b=16;b>=1;b/=2)
+  {
+    c = (c|(c<<b))&mortonmask[b];
+    r = (r|(r<<b))&mortonmask[b];
+  }
+  return(c|(r<<1));
+
+}
+
+
+int comparekeys(const void *a,const void *b)
+{
+  const struct keyedpoint *pa = (const struct keyedpoint *)a;
+  const struct keyedpoint *pb = (const struct keyedpoint *)b;
+
+  if (pa->key<pb->key) return(-1);
+  if (pa->key>pb->key) return(1);
+  return((pa->i>pb->i)-(pa->i<pb->i));  // keep input order among equal keys
+
+}
+
+
+void sortbykey(long *idx,long m,const unsigned long long *key,struct keyedpoint *work)
+{
+  // Reorders the point indices idx[0..m-1] by ascending key[idx]
+  long k;
+  int comparekeys(const void *,const void *);
+
+  for (k=0;k<m;k++)
+  {
+    work[k].key = key[idx[k]];
+    work[k].i = idx[k];
+  }
+  qsort(work,m,sizeof(struct keyedpoint),comparekeys);
+  for (k=0;k<m;k++) idx[k] = work[k].i;
+
+}
+
+
+// Projected DEM products.  Each is described once here and its reader is
+// generated from querygrid(), so the geometry is known at compile time:
+// the pixel size becomes a multiply and the row and column arithmetic is
+// folded.  A new product is a descriptor line and a reader.
+#define SAMPLE_FLOAT32 0   // native float32 pixels, read through the block cache
+#define SAMPLE_INT16 1     // native int16 pixels
+#define EDGE_CLAMP 0       // points beyond the outer pixel centres use the edge pixels
+#define EDGE_NODATA 1      // points beyond the outer pixel centres are unknown (-9999)
+
+struct griddesc
+{
+  int file;                // index of the file in demfiles
+  int product;             // enum demproduct, for its path in datasets
+  double x0,y0;            // x of the left and y of the top edge of the grid, m
+  double res;              // pixel size, m
+  long long nx,ny;         // columns and rows
+  int sample;              // SAMPLE_FLOAT32 or SAMPLE_INT16
+  int nodata;              // NODATA_FLAG or NODATA_ZERO
+  int edge;                // EDGE_CLAMP or EDGE_NODATA
+};
+
+static constexpr struct griddesc gimp90grid = {33,DEM_G90,-639955.0,-655595.0,90.0,16620,30000,SAMPLE_INT16,NODATA_ZERO,EDGE_CLAMP};
+static constexpr struct griddesc bedmap2grid = {34,DEM_BM2,-3333500.0,3333500.0,1000.0,6667,6667,SAMPLE_FLOAT32,NODATA_FLAG,EDGE_CLAMP};
+static constexpr struct griddesc arcticdem100grid = {35,DEM_AD1,-4000000.0,4100000.0,100.0,74000,75000,SAMPLE_FLOAT32,NODATA_FLAG,EDGE_NODATA};
+static constexpr struct griddesc remp100grid = {36,DEM_REP,-2700000.0,1800000.0,100.0,8000,10000,SAMPLE_FLOAT32,NODATA_FLAG,EDGE_CLAMP};
+static constexpr struct griddesc rema100grid = {37,DEM_REM,-2700000.0,2300000.0,100.0,55000,45042,SAMPLE_FLOAT32,NODATA_FLAG,EDGE_CLAMP};
+
+static const struct griddesc *griddescs[NDEMPRODUCTS] =
+  {NULL,NULL,&bedmap2grid,&gimp90grid,&arcticdem100grid,&remp100grid,&rema100grid};
+
+template <int sample> struct sampletype;
+template <> struct sampletype<SAMPLE_FLOAT32> { typedef float type; };
+template <> struct sampletype<SAMPLE_INT16> { typedef short type; };
+
+
+template <const struct griddesc &g>
+void querygrid(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  typedef typename sampletype<g.sample>::type T;
+  long long m1,m2,n1,n2,lastm1,lastm2,lastn1,lastn2;
+  long i,k,m;
+  char out[QBLOCK];
+  T q[4*QBLOCK];
+  double mdbl,ndbl,u[QBLOCK],v[QBLOCK];
+  struct gridfile *gf;
+
+  // Open the DEM file if not already open
+  gf = getgridfile(ctx,&ctx->demfiles[g.file],ctx->datasets[g.product].path,g.nx,g.ny);
+
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+    lastm1 = lastm2 = lastn1 = lastn2 = -1;
+
+    // Determine the surrounding grid cells and read their four pixels from
+    // the DEM file, or the block cache for float32.  Points outside the
+    // DEM or without a file get dummy corners.
+    for (i=0;i<m;i++)
+    {
+      mdbl = (x[k+i]-g.x0)*(1.0/g.res)-0.5;
+      ndbl = (g.y0-y[k+i])*(1.0/g.res)-0.5;
+      out[i] = (g.edge==EDGE_NODATA&&!(mdbl>=0.0&&mdbl<=(g.nx-1)&&ndbl>=0.0&&ndbl<=(g.ny-1)));
+      if (out[i]||gf==NULL)
+      {
+        u[i] = v[i] = 0.0;
+        q[4*i] = q[4*i+1] = q[4*i+2] = q[4*i+3] = 0;
+        lastm1 = -1;
+        continue;
+      }
+      u[i] = gridaxis(mdbl,g.nx,&m1,&m2);
+      v[i] = gridaxis(ndbl,g.ny,&n1,&n2);
+
+      // Consecutive points along a line often fall in the same cell, so
+      // the previous point's corners are reused without another read
+      if (m1==lastm1&&n1==lastn1&&m2==lastm2&&n2==lastn2)
+      {
+        memcpy(&q[4*i],&q[4*i-4],4*sizeof(T));
+        continue;
+      }
+      lastm1 = m1;
+      lastm2 = m2;
+      lastn1 = n1;
+      lastn2 = n2;
+      if constexpr (g.sample==SAMPLE_FLOAT32)
+        readgridcorners(ctx,gf,g.nx,g.ny,n1,n2,m1,m2,&q[4*i],&q[4*i+1],&q[4*i+2],&q[4*i+3]);
+      else
+      {
+        if (readgridfile(gf,sizeof(T)*(n1*g.nx+m1),&q[4*i],sizeof(T))==-1) q[4*i] = -9999;
+        if (readgridfile(gf,sizeof(T)*(n1*g.nx+m2),&q[4*i+1],sizeof(T))==-1) q[4*i+1] = -9999;
+        if (readgridfile(gf,sizeof(T)*(n2*g.nx+m1),&q[4*i+2],sizeof(T))==-1) q[4*i+2] = -9999;
+        if (readgridfile(gf,sizeof(T)*(n2*g.nx+m2),&q[4*i+3],sizeof(T))==-1) q[4*i+3] = -9999;
+      }
+    }
+
+    // Compute terrain at requested points by bilinear interpolation
+    bilinear<T,g.nodata>(m,q,u,v,p+k);
+    for (i=0;i<m;i++)
+    {
+      if (out[i]) p[k+i] = -9999.0;
+      else if (gf==NULL) p[k+i] = -9999.9;
+    }
+  }
+
+}
+
+
+void queryremp(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygrid<remp100grid>(ctx,n,x,y,p);
+}
+
+
+void queryrema(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygrid<rema100grid>(ctx,n,x,y,p);
+}
+
+
+void querygimp90(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygrid<gimp90grid>(ctx,n,x,y,p);
+}
+
+
+void querybedmap2(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygrid<bedmap2grid>(ctx,n,x,y,p);
+}
+
+
+void queryarcticdem100(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygrid<arcticdem100grid>(ctx,n,x,y,p);
+}
+
+
+// Rows of a grid in its own projection, as the gridded output walks them.
+// Both grid rows either side of the points are read a span at a time and
+// the row weight is found once, so each point costs only its column.
+// Points further apart than RESAMPLEDENSE pixels gain nothing from the
+// spans and have their corners read singly as in querygrid.
+#define RESAMPLESPAN 4096  // pixels of each grid row read at a time
+#define RESAMPLEDENSE 16.0
+
+template <const struct griddesc &g>
+void querygridrow(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  // querygrid for n points on one row, all at y[0] with x increasing
+  long long m1,m2,n1,n2,c0,len,last,j;
+  long i,k,m;
+  char out[QBLOCK];
+  bool rowout;
+  float q[4*QBLOCK],*row1,*row2;
+  double mdbl,ndbl,v0,u[QBLOCK],v[QBLOCK];
+  struct gridfile *gf;
+
+  gf = getgridfile(ctx,&ctx->demfiles[g.file],ctx->datasets[g.product].path,g.nx,g.ny);
+  row1 = NULL;
+  if (g.sample==SAMPLE_FLOAT32&&gf!=NULL&&n>1&&x[n-1]-x[0]<=RESAMPLEDENSE*g.res*(n-1))
+    row1 = (float *)malloc(2*RESAMPLESPAN*sizeof(float));
+  if (row1==NULL)
+  {
+    querygrid<g>(ctx,n,x,y,p);
+    return;
+  }
+  row2 = row1+RESAMPLESPAN;
+
+  // The grid rows and weight shared by every point
+  ndbl = (g.y0-y[0])*(1.0/g.res)-0.5;
+  rowout = (g.edge==EDGE_NODATA&&(ndbl<0.0||ndbl>(g.ny-1)));
+  v0 = gridaxis(ndbl,g.ny,&n1,&n2);
+  last = (long long)((x[n-1]-g.x0)*(1.0/g.res)+0.5);
+  c0 = len = 0;
+
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+    for (i=0;i<m;i++)
+    {
+      mdbl = (x[k+i]-g.x0)*(1.0/g.res)-0.5;
+      out[i] = (rowout||(g.edge==EDGE_NODATA&&(mdbl<0.0||mdbl>(g.nx-1))));
+      if (out[i])
+      {
+        u[i] = v[i] = 0.0;
+        q[4*i] = q[4*i+1] = q[4*i+2] = q[4*i+3] = 0;
+        continue;
+      }
+      u[i] = gridaxis(mdbl,g.nx,&m1,&m2);
+      v[i] = v0;
+
+      // Read the next spans once the point leaves the ones in hand, only
+      // as far as the last point needs
+      if (m1<c0||m2>=c0+len)
+      {
+        c0 = m1;
+        len = ((last>m2) ? last : m2)-c0+1;
+        if (len>g.nx-c0) len = g.nx-c0;
+        if (len>RESAMPLESPAN) len = RESAMPLESPAN;
+        if (readgridspan(gf,g.nx,n1,c0,len,row1)==-1||readgridspan(gf,g.nx,n2,c0,len,row2)==-1)
+          for (j=0;j<len;j++) row1[j] = row2[j] = -9999.0;
+      }
+      q[4*i] = row1[m1-c0];
+      q[4*i+1] = row1[m2-c0];
+      q[4*i+2] = row2[m1-c0];
+      q[4*i+3] = row2[m2-c0];
+    }
+
+    // Compute terrain at requested points by bilinear interpolation
+    bilinear<float,g.nodata>(m,q,u,v,p+k);
+    for (i=0;i<m;i++) if (out[i]) p[k+i] = -9999.0;
+  }
+  free(row1);
+
+}
+
+
+void queryrowremp(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygridrow<remp100grid>(ctx,n,x,y,p);
+}
+
+
+void queryrowrema(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygridrow<rema100grid>(ctx,n,x,y,p);
+}
+
+
+void queryrowarcticdem100(struct topocontext *ctx,long n,const double *x,const double *y,double *p)
+{
+  querygridrow<arcticdem100grid>(ctx,n,x,y,p);
+}
+
+
+int resamplegrid(struct topocontext *ctx,const struct gridspec *g,int htrefflag,long row0,long nrows,
+                 float *topo)
+{
+  // Rows of a lat/lon grid are queried as batches, whose points already
+  // share cells along the row.  Rows of a polar stereographic grid go
+  // straight to the polar DEMs in their own projection, and only points
+  // that need a geoid height or GTOPO30 are taken back to lat/lon.
+  char geoidid[10];
+  int p,south,status,*demid;
+  long i,k,m,r,n;
+  long *idx;
+  double yv,*x,*y,*lat,*lon,*h,*gh,*gx,*gy,*gp;
+  bool *need;
+  void querygtopo30(struct topocontext *,long,const double *,const double *,double *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  int polardem(struct topocontext *,int,double,double);
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+
+  // Allocate work space
+  n = g->nx;
+  if (n<=0||nrows<=0) return(0);
+  x = (double *)malloc(n*sizeof(double));
+  y = (double *)malloc(n*sizeof(double));
+  lat = (double *)malloc(n*sizeof(double));
+  lon = (double *)malloc(n*sizeof(double));
+  h = (double *)malloc(n*sizeof(double));
+  gh = (double *)malloc(n*sizeof(double));
+  gx = (double *)malloc(n*sizeof(double));
+  gy = (double *)malloc(n*sizeof(double));
+  gp = (double *)malloc(n*sizeof(double));
+  demid = (int *)malloc(n*sizeof(int));
+  idx = (long *)malloc(n*sizeof(long));
+  need = (bool *)malloc(n*sizeof(bool));
+  if (x==NULL||y==NULL||lat==NULL||lon==NULL||h==NULL||gh==NULL||gx==NULL||gy==NULL||gp==NULL||
+      demid==NULL||idx==NULL||need==NULL)
+  {
+    free(x);
+    free(y);
+    free(lat);
+    free(lon);
+    free(h);
+    free(gh);
+    free(gx);
+    free(gy);
+    free(gp);
+    free(demid);
+    free(idx);
+    free(need);
+    return(-1);
+  }
+
+  south = (g->proj==GRID_SOUTH);
+  status = 0;
+  for (r=0;r<nrows&&status==0;r++)
+  {
+    yv = g->y0-(row0+r)*g->spacing;
+
+    // A lat/lon row
+    if (g->proj==GRID_LATLON)
+    {
+      for (i=0;i<n;i++)
+      {
+        lat[i] = yv;
+        lon[i] = g->x0+i*g->spacing;
+        while (lon[i]<=-180.0) lon[i] += 360.0;
+        while (lon[i]>180.0) lon[i] -= 360.0;
+      }
+      status = querytopobatch(ctx,n,lat,lon,htrefflag,h,gh,demid,geoidid);
+      for (i=0;i<n;i++) topo[r*n+i] = h[i];
+      continue;
+    }
+
+    // A polar stereographic row, each polar DEM's points in x order
+    for (i=0;i<n;i++)
+    {
+      x[i] = g->x0+i*g->spacing;
+      y[i] = yv;
+      demid[i] = polardem(ctx,south,x[i],y[i]);
+    }
+    for (p=DEM_AD1;p<=DEM_REM;p++)
+    {
+      for (m=0,i=0;i<n;i++)
+        if (demid[i]==p)
+        {
+          idx[m] = i;
+          gx[m++] = x[i];
+        }
+      if (m==0) continue;
+      if (p==DEM_AD1) queryrowarcticdem100(ctx,m,gx,y,gp);
+      if (p==DEM_REP) queryrowremp(ctx,m,gx,y,gp);
+      if (p==DEM_REM) queryrowrema(ctx,m,gx,y,gp);
+      for (k=0;k<m;k++)
+      {
+        i = idx[k];
+        h[i] = gp[k];
+        if (h[i]==-9999.0) demid[i] = DEM_GT3;
+      }
+    }
+
+    // Lat/lon of the points that need it, then GTOPO30 where no polar DEM
+    // applies or one returned a no data flag
+    for (i=0;i<n;i++)
+    {
+      need[i] = (demid[i]==DEM_GT3||(ctx->datasets[demid[i]].geoidref&&htrefflag==2)||
+                 (!ctx->datasets[demid[i]].geoidref&&htrefflag==1));
+      if (need[i]) unprojectps(&ctx->polar[south],x[i],y[i],&lat[i],&lon[i]);
+    }
+    for (m=0,i=0;i<n;i++)
+      if (demid[i]==DEM_GT3)
+      {
+        idx[m] = i;
+        gx[m] = lat[i];
+        gy[m++] = lon[i];
+      }
+    querygtopo30(ctx,m,gx,gy,gp);
+    for (k=0;k<m;k++) h[idx[k]] = gp[k];
+
+    // Reference the heights as requested
+    for (m=0,i=0;i<n;i++)
+      if ((ctx->datasets[demid[i]].geoidref&&htrefflag==2)||(!ctx->datasets[demid[i]].geoidref&&htrefflag==1))
+      {
+        idx[m] = i;
+        gx[m] = lat[i];
+        gy[m++] = lon[i];
+      }
+    querygeoidbatch(ctx,m,gx,gy,gp,geoidid);
+    for (k=0;k<m;k++)
+    {
+      i = idx[k];
+      h[i] += (htrefflag==2) ? gp[k] : -gp[k];
+    }
+    for (i=0;i<n;i++) topo[r*n+i] = (isnan(h[i])) ? -9999.0 : h[i];
+  }
+
+  free(x);
+  free(y);
+  free(lat);
+  free(lon);
+  free(h);
+  free(gh);
+  free(gx);
+  free(gy);
+  free(gp);
+  free(demid);
+  free(idx);
+  free(need);
+  return(status);
+
+}
+
+
+int loaddatasets(struct topocontext *ctx,const char *filename)
+{
+  char line[MAXPATHLEN+256];
+  int lineno,status;
+  struct dataset ds[NDATASETS];
+  FILE *fptr;
+  int parsedataset(char *,struct dataset *);
+
+  // Find the dataset file, if any
+  if (filename==NULL&&(filename=getenv("QUERYTOPO_DATASETS"))==NULL)
+  {
+    filename = DATASETSPATH;
+    if (access(filename,F_OK)!=0) return(0);
+  }
+  if ((fptr=fopen(filename,"r"))==NULL) return(-1);
+
+  // Apply it to a copy of the settings, so a bad file changes nothing
+  memcpy(ds,ctx->datasets,sizeof(ds));
+  status = 0;
+  for (lineno=1;status==0&&fgets(line,sizeof(line),fptr)!=NULL;lineno++)
+    if (parsedataset(line,ds)==-1) status = lineno;
+  fclose(fptr);
+  if (status==0) memcpy(ctx->datasets,ds,sizeof(ds));
+  return(status);
+
+}
+
+
+int parsedataset(char *line,struct dataset *ds)
+{
+  // Applies one line of a dataset file,
+  //   <id> <priority|off|-> <geoid|ellipsoid|-> <path|-> [<x0> <y0> <res> <nx> <ny>]
+  // Returns -1 if the line is not understood.
+  char name[16],prio[16],datum[16],path[MAXPATHLEN];
+  int i,nf,priority,geoidref;
+  long long nx,ny;
+  double x0,y0,res;
+  const struct griddesc *g;
+
+  // Skip blank lines and comments
+  for (i=0;line[i]==' '||line[i]=='\t';i++);
+  if (line[i]=='#'||line[i]=='\n'||line[i]=='\r'||line[i]=='\0') return(0);
+
+  nf = sscanf(line,"%15s %15s %15s %1023s %lf %lf %lf %lld %lld",name,prio,datum,path,&x0,&y0,&res,&nx,&ny);
+  if (nf!=4&&nf!=9) return(-1);
+  for (i=1;i<NDATASETS&&strcmp(name,datasetdefaults[i].name);i++);
+  if (i==NDATASETS) return(-1);
+
+  // Priority and vertical datum, - keeps the current one
+  priority = ds[i].priority;
+  if (!strcmp(prio,"off")) priority = 0;
+  else if (strcmp(prio,"-")&&(priority=atoi(prio))<1) return(-1);
+  geoidref = ds[i].geoidref;
+  if (!strcmp(datum,"geoid")) geoidref = 1;
+  else if (!strcmp(datum,"ellipsoid")) geoidref = 0;
+  else if (strcmp(datum,"-")) return(-1);
+
+  // Geometry, if given, must be that of the built-in reader, to catch a
+  // path to the wrong product
+  if (nf==9&&(i>=NDEMPRODUCTS||(g=griddescs[i])==NULL||
+              x0!=g->x0||y0!=g->y0||res!=g->res||nx!=g->nx||ny!=g->ny)) return(-1);
+
+  ds[i].priority = priority;
+  ds[i].geoidref = geoidref;
+  if (strcmp(path,"-")) strcpy(ds[i].path,path);
+  return(0);
+
+}
+
+
+
+// GTOPO30 tiles, numbered as in the DEM id table above.  Each tile covers
+// longitudes (lon0,lon0+nlon/120] and latitudes (lat0-nlat/120,lat0].  The
+// tiles form a regular 40x50 deg grid north of 60S and a 60x30 deg grid
+// south of it, so gtopo30tileindex() can find a tile without searching.
+struct gtopo30tile
+{
+  const char *name;  // file name within the GTOPO30 directory
+  double lat0;       // latitude of top edge (deg)
+  double lon0;       // longitude of left edge (deg)
+  int nlat;          // rows of 30" pixels
+  int nlon;          // columns of 30" pixels
+};
+
+static const struct gtopo30tile gtopo30tiles[33] =
+{
+  {"W180N90.DEM",   90.0, -180.0, 6000, 4800},  //  0
+  {"W140N90.DEM",   90.0, -140.0, 6000, 4800},  //  1
+  {"W100N90.DEM",   90.0, -100.0, 6000, 4800},  //  2
+  {"W060N90.DEM",   90.0,  -60.0, 6000, 4800},  //  3
+  {"W020N90.DEM",   90.0,  -20.0, 6000, 4800},  //  4
+  {"E020N90.DEM",   90.0,   20.0, 6000, 4800},  //  5
+  {"E060N90.DEM",   90.0,   60.0, 6000, 4800},  //  6
+  {"E100N90.DEM",   90.0,  100.0, 6000, 4800},  //  7
+  {"E140N90.DEM",   90.0,  140.0, 6000, 4800},  //  8
+  {"W180N40.DEM",   40.0, -180.0, 6000, 4800},  //  9
+  {"W140N40.DEM",   40.0, -140.0, 6000, 4800},  // 10
+  {"W100N40.DEM",   40.0, -100.0, 6000, 4800},  // 11
+  {"W060N40.DEM",   40.0,  -60.0, 6000, 4800},  // 12
+  {"W020N40.DEM",   40.0,  -20.0, 6000, 4800},  // 13
+  {"E020N40.DEM",   40.0,   20.0, 6000, 4800},  // 14
+  {"E060N40.DEM",   40.0,   60.0, 6000, 4800},  // 15
+  {"E100N40.DEM",   40.0,  100.0, 6000, 4800},  // 16
+  {"E140N40.DEM",   40.0,  140.0, 6000, 4800},  // 17
+  {"W180S10.DEM",  -10.0, -180.0, 6000, 4800},  // 18
+  {"W140S10.DEM",  -10.0, -140.0, 6000, 4800},  // 19
+  {"W100S10.DEM",  -10.0, -100.0, 6000, 4800},  // 20
+  {"W060S10.DEM",  -10.0,  -60.0, 6000, 4800},  // 21
+  {"W020S10.DEM",  -10.0,  -20.0, 6000, 4800},  // 22
+  {"E020S10.DEM",  -10.0,   20.0, 6000, 4800},  // 23
+  {"E060S10.DEM",  -10.0,   60.0, 6000, 4800},  // 24
+  {"E100S10.DEM",  -10.0,  100.0, 6000, 4800},  // 25
+  {"E140S10.DEM",  -10.0,  140.0, 6000, 4800},  // 26
+  {"W180S60.DEM",  -60.0, -180.0, 3600, 7200},  // 27
+  {"W120S60.DEM",  -60.0, -120.0, 3600, 7200},  // 28
+  {"W060S60.DEM",  -60.0,  -60.0, 3600, 7200},  // 29
+  {"W000S60.DEM",  -60.0,    0.0, 3600, 7200},  // 30
+  {"E060S60.DEM",  -60.0,   60.0, 3600, 7200},  // 31
+  {"E120S60.DEM",  -60.0,  120.0, 3600, 7200},  // 32
+};
+
+
+int gtopo30tileindex(double lat,double lon)
+{
+  int row,col;
+
+  // Three rows of nine 40x50 deg tiles from 90N down to 60S
+  if (lat>-60.0)
+  {
+    row = int(floor((90.0-lat)/50.0));
+    col = int(ceil((lon+180.0)/40.0))-1;
+    if (row<0) row = 0;
+    if (row>2) row = 2;
+    if (col<0) col = 0;
+    if (col>8) col = 8;
+    return(9*row+col);
+  }
+
+  // One row of six 60x30 deg tiles south of 60S
+  col = int(ceil((lon+180.0)/60.0))-1;
+  if (col<0) col = 0;
+  if (col>5) col = 5;
+  return(27+col);
+}
+
+
+void querygtopo30(struct topocontext *ctx,long n,const double *lat,const double *lon,double *p)
+{
+  char filename[MAXPATHLEN+20],fixed[QBLOCK];
+  struct beint16 q[4*QBLOCK];
+  int t,lastt;
+  long long nlon,nlat,n1,n2,m1,m2,lastm1,lastm2,lastn1,lastn2;
+  long i,k,m;
+  double u[QBLOCK],v[QBLOCK],fixedp[QBLOCK];
+  const struct gtopo30tile *tile;
+  struct gridfile *gf;
+
+  lastt = -1;
+  gf = NULL;
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+    lastm1 = lastm2 = lastn1 = lastn2 = -1;
+    for (i=0;i<m;i++)
+    {
+      fixed[i] = 1;
+      u[i] = v[i] = 0.0;
+      q[4*i].raw = q[4*i+1].raw = q[4*i+2].raw = q[4*i+3].raw = 0;
+
+      // Find the tile containing the point
+      if (lat[k+i]<=-89.9)  // Special case for bottom of GTOPO30 grids
+      {
+        fixedp[i] = 2772.0;
+        continue;
+      }
+      t = gtopo30tileindex(lat[k+i],lon[k+i]);
+      tile = &gtopo30tiles[t];
+
+      // Open this GTOPO30 DEM tile if not already open, unless the
+      // previous point was in it too
+      if (t!=lastt)
+      {
+        snprintf(filename,sizeof(filename),"%s/%s",ctx->datasets[DEM_GT3].path,tile->name);
+        gf = getgridfile(ctx,&ctx->demfiles[t],filename,0,0);
+        lastt = t;
+        lastm1 = -1;
+      }
+      if (gf==NULL)
+      {
+        fixedp[i] = -9999.9;
+        continue;
+      }
+      fixed[i] = 0;
+
+      // Determine the surrounding grid cells.  At the top or bottom edge of
+      // a tile the interpolation is along the edge only, likewise at the
+      // right or left edge, and at a corner it is the corner pixel.
+      nlon = tile->nlon;
+      nlat = tile->nlat;
+      u[i] = gridaxis(120.0*(lon[k+i]-tile->lon0)-0.5,nlon,&m1,&m2);
+      v[i] = gridaxis(120.0*(tile->lat0-lat[k+i])-0.5,nlat,&n1,&n2);
+      if (m1==m2) u[i] = 0.0;
+      if (n1==n2) v[i] = 0.0;
+
+      // Read the four surrounding pixels from the DEM file, or take the
+      // previous point's if it was in the same cell
+      if (m1==lastm1&&n1==lastn1&&m2==lastm2&&n2==lastn2&&i>0&&!fixed[i-1])
+      {
+        memcpy(&q[4*i],&q[4*i-4],4*sizeof(struct beint16));
+        continue;
+      }
+      lastm1 = m1;
+      lastm2 = m2;
+      lastn1 = n1;
+      lastn2 = n2;
+      if (readgridfile(gf,2*(n1*nlon+m1),&q[4*i],2)==-1) q[4*i].raw = BEINT16NODATA;
+      if (readgridfile(gf,2*(n1*nlon+m2),&q[4*i+1],2)==-1) q[4*i+1].raw = BEINT16NODATA;
+      if (readgridfile(gf,2*(n2*nlon+m1),&q[4*i+2],2)==-1) q[4*i+2].raw = BEINT16NODATA;
+      if (readgridfile(gf,2*(n2*nlon+m2),&q[4*i+3],2)==-1) q[4*i+3].raw = BEINT16NODATA;
+    }
+
+    // Compute terrain at requested points by bilinear interpolation
+    bilinear<struct beint16,NODATA_ZERO>(m,q,u,v,p+k);
+    for (i=0;i<m;i++) if (fixed[i]) p[k+i] = fixedp[i];
+  }
+
+}
+
+
+// Pre-referenced DEMs.  buildrefgrid writes a .ref file (see refgrid.h)
+// beside a DEM, or each GTOPO30 tile, holding its pixels above both the
+// ellipsoid and the geoid.  With setprereferenced on, querytopobatch
+// reads those in place of the DEM, so a point's height in the reference
+// asked for and its geoid height come from the same four corners.  The
+// geoid grid is then read only for points no .ref file covers.
+int setprereferenced(struct topocontext *ctx,int on)
+{
+  ctx->prereferenced = (on!=0);
+  return(0);
+}
+
+
+void refgridpath(struct topocontext *ctx,int demid,int tile,char *path)
+{
+  // The .ref file sits beside its DEM or GTOPO30 tile, path must hold
+  // MAXPATHLEN+20
+  int len;
+
+  if (demid==DEM_GT3)
+  {
+    snprintf(path,MAXPATHLEN+20,"%s/%.7s.ref",ctx->datasets[DEM_GT3].path,gtopo30tiles[tile].name);
+    return;
+  }
+  len = strlen(ctx->datasets[demid].path);
+  if (len>4&&!strcmp(ctx->datasets[demid].path+len-4,".flt")) len -= 4;
+  snprintf(path,MAXPATHLEN+20,"%.*s.ref",len,ctx->datasets[demid].path);
+}
+
+
+struct gridfile *getrefgrid(struct topocontext *ctx,int demid,int tile,long long nx,long long ny,
+                            char *geoidid)
+{
+  // The .ref file of a DEM or GTOPO30 tile, if one was built for a grid
+  // of this size, with the id of the geoid it was referenced with
+  char path[MAXPATHLEN+20];
+  struct refgridheader hdr;
+  struct gridfile *gf;
+
+  refgridpath(ctx,demid,tile,path);
+  gf = getgridfile(ctx,&ctx->reffiles[(demid==DEM_GT3) ? tile : griddescs[demid]->file],path,0,0);
+  if (gf==NULL||readgridfile(gf,0,&hdr,sizeof(hdr))==-1||memcmp(hdr.magic,REFGRIDMAGIC,8)||
+      hdr.version!=REFGRIDVERSION||hdr.nx!=nx||hdr.ny!=ny||hdr.demid!=demid)
+    return(NULL);
+  memcpy(geoidid,hdr.geoidid,3);
+  geoidid[3] = '\0';
+  return(gf);
+}
+
+
+static inline void readrefcorner(struct gridfile *gf,long long nx,long long r,long long c,int htrefflag,
+                                 float *qa,float *qb)
+{
+  // One pixel of a .ref file, qa in the reference asked for and qb in the other
+  struct refgridpixel px;
+
+  px.ell = px.orth = -9999.0;
+  readgridfile(gf,sizeof(struct refgridheader)+sizeof(px)*(r*nx+c),&px,sizeof(px));
+  *qa = (htrefflag==2) ? px.ell : px.orth;
+  *qb = (htrefflag==2) ? px.orth : px.ell;
+}
+
+
+template <const struct griddesc &g>
+int querygridref(struct topocontext *ctx,long n,const double *x,const double *y,int htrefflag,double *p,
+                 double *geoid,char *geoidid)
+{
+  // querygrid from the DEM's .ref file, with heights above the ellipsoid
+  // (htrefflag=2) or the geoid (htrefflag=1) and the geoid height at each
+  // point.  Returns -1, having done nothing, if there is no .ref file.
+  long long m1,m2,n1,n2,lastm1,lastm2,lastn1,lastn2;
+  long i,k,m,j;
+  char out[QBLOCK];
+  float qa[4*QBLOCK],qb[4*QBLOCK];
+  double mdbl,ndbl,u[QBLOCK],v[QBLOCK],pb[QBLOCK];
+  struct gridfile *gf;
+
+  if ((gf=getrefgrid(ctx,g.product,0,g.nx,g.ny,geoidid))==NULL) return(-1);
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+    lastm1 = lastm2 = lastn1 = lastn2 = -1;
+    for (i=0;i<m;i++)
+    {
+      mdbl = (x[k+i]-g.x0)*(1.0/g.res)-0.5;
+      ndbl = (g.y0-y[k+i])*(1.0/g.res)-0.5;
+      out[i] = (g.edge==EDGE_NODATA&&(mdbl<0.0||mdbl>(g.nx-1)||ndbl<0.0||ndbl>(g.ny-1)));
+      if (out[i])
+      {
+        u[i] = v[i] = 0.0;
+        for (j=0;j<4;j++) qa[4*i+j] = qb[4*i+j] = 0.0;
+        lastm1 = -1;
+        continue;
+      }
+      u[i] = gridaxis(mdbl,g.nx,&m1,&m2);
+      v[i] = gridaxis(ndbl,g.ny,&n1,&n2);
+
+      // Both references of the four corners in one read each, or the
+      // previous point's if it was in the same cell
+      if (m1==lastm1&&n1==lastn1&&m2==lastm2&&n2==lastn2)
+      {
+        memcpy(&qa[4*i],&qa[4*i-4],4*sizeof(float));
+        memcpy(&qb[4*i],&qb[4*i-4],4*sizeof(float));
+        continue;
+      }
+      lastm1 = m1;
+      lastm2 = m2;
+      lastn1 = n1;
+      lastn2 = n2;
+      readrefcorner(gf,g.nx,n1,m1,htrefflag,&qa[4*i],&qb[4*i]);
+      readrefcorner(gf,g.nx,n1,m2,htrefflag,&qa[4*i+1],&qb[4*i+1]);
+      readrefcorner(gf,g.nx,n2,m1,htrefflag,&qa[4*i+2],&qb[4*i+2]);
+      readrefcorner(gf,g.nx,n2,m2,htrefflag,&qa[4*i+3],&qb[4*i+3]);
+    }
+
+    // Interpolate both, the geoid being their difference
+    bilinear<float,g.nodata>(m,qa,u,v,p+k);
+    bilinear<float,g.nodata>(m,qb,u,v,pb);
+    for (i=0;i<m;i++)
+    {
+      geoid[k+i] = (htrefflag==2) ? p[k+i]-pb[i] : pb[i]-p[k+i];
+      if (out[i]) p[k+i] = -9999.0;
+    }
+  }
+  return(0);
+
+}
+
+
+int queryrefremp(struct topocontext *ctx,long n,const double *x,const double *y,int htrefflag,double *p,
+                 double *geoid,char *geoidid)
+{
+  return(querygridref<remp100grid>(ctx,n,x,y,htrefflag,p,geoid,geoidid));
+}
+
+
+int queryrefrema(struct topocontext *ctx,long n,const double *x,const double *y,int htrefflag,double *p,
+                 double *geoid,char *geoidid)
+{
+  return(querygridref<rema100grid>(ctx,n,x,y,htrefflag,p,geoid,geoidid));
+}
+
+
+int queryrefarcticdem100(struct topocontext *ctx,long n,const double *x,const double *y,int htrefflag,
+                         double *p,double *geoid,char *geoidid)
+{
+  return(querygridref<arcticdem100grid>(ctx,n,x,y,htrefflag,p,geoid,geoidid));
+}
+
+
+void querygtopo30ref(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+                     double *p,double *geoid,char *served,char *geoidid)
+{
+  // querygtopo30 from the tiles' .ref files, as querygridref.  Points in
+  // a tile with no .ref file, or at the bottom of the grid, are left to
+  // querygtopo30 with served 0.
+  float qa[4*QBLOCK],qb[4*QBLOCK];
+  int t,lastt;
+  long long nlon,nlat,n1,n2,m1,m2,lastm1,lastm2,lastn1,lastn2;
+  long i,k,m,j;
+  double u[QBLOCK],v[QBLOCK],pb[QBLOCK];
+  const struct gtopo30tile *tile;
+  struct gridfile *gf;
+
+  lastt = -1;
+  gf = NULL;
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+    lastm1 = lastm2 = lastn1 = lastn2 = -1;
+    for (i=0;i<m;i++)
+    {
+      served[k+i] = 0;
+      u[i] = v[i] = 0.0;
+      for (j=0;j<4;j++) qa[4*i+j] = qb[4*i+j] = 0.0;
+      if (lat[k+i]<=-89.9) continue;
+      t = gtopo30tileindex(lat[k+i],lon[k+i]);
+      tile = &gtopo30tiles[t];
+      if (t!=lastt)
+      {
+        gf = getrefgrid(ctx,DEM_GT3,t,tile->nlon,tile->nlat,geoidid);
+        lastt = t;
+        lastm1 = -1;
+      }
+      if (gf==NULL) continue;
+      served[k+i] = 1;
+
+      // The surrounding grid cells, clamped to the tile as in querygtopo30
+      nlon = tile->nlon;
+      nlat = tile->nlat;
+      u[i] = gridaxis(120.0*(lon[k+i]-tile->lon0)-0.5,nlon,&m1,&m2);
+      v[i] = gridaxis(120.0*(tile->lat0-lat[k+i])-0.5,nlat,&n1,&n2);
+      if (m1==m2) u[i] = 0.0;
+      if (n1==n2) v[i] = 0.0;
+      if (m1==lastm1&&n1==lastn1&&m2==lastm2&&n2==lastn2&&i>0&&served[k+i-1])
+      {
+        memcpy(&qa[4*i],&qa[4*i-4],4*sizeof(float));
+        memcpy(&qb[4*i],&qb[4*i-4],4*sizeof(float));
+        continue;
+      }
+      lastm1 = m1;
+      lastm2 = m2;
+      lastn1 = n1;
+      lastn2 = n2;
+      readrefcorner(gf,nlon,n1,m1,htrefflag,&qa[4*i],&qb[4*i]);
+      readrefcorner(gf,nlon,n1,m2,htrefflag,&qa[4*i+1],&qb[4*i+1]);
+      readrefcorner(gf,nlon,n2,m1,htrefflag,&qa[4*i+2],&qb[4*i+2]);
+      readrefcorner(gf,nlon,n2,m2,htrefflag,&qa[4*i+3],&qb[4*i+3]);
+    }
+
+    // Ocean is stored as heights, so no corner is no data
+    bilinear<float,NODATA_ZERO>(m,qa,u,v,p+k);
+    bilinear<float,NODATA_ZERO>(m,qb,u,v,pb);
+    for (i=0;i<m;i++) geoid[k+i] = (htrefflag==2) ? p[k+i]-pb[i] : pb[i]-p[k+i];
+  }
+
+}
+
+
+// Region bounds.  maxtopo finds the highest terrain in a polygon by a
+// best-first descent of each DEM's min/max pyramid (see pyramid.h):
+// blocks are opened highest bound first, and the search stops once no
+// bound left beats the highest pixel found, so full-resolution pixels
+// are only read where the answer could be.  Polygons are densified along
+// great circles and taken into each DEM's own pixel frame, polar
+// stereographic for the polar DEMs and lat/lon for GTOPO30.  A pixel
+// counts if its centre is inside and querytopo would answer from its DEM
+// there.  Without a pyramid every block is read.  Where the reference
+// asked for is not the DEM's own, pixels are compared with the geoid at
+// each applied, and a block's bound is raised by the most the geoid can
+// add over it.
+#define DENSIFYSPACING 1000.0  // m between polygon vertices along an edge
+#define REGIONNODE 32          // pixels between geoid evaluations along a row
+#define GEOIDBOUNDNODES 1024   // geoid grid nodes at most read to bound a block
+#define GEOIDBOUNDCELLS 1024   // 1 deg geoid cells at most used to bound a block
+#define CORRIDORDISC 72        // vertices of the disc around a waypoint
+#define GT3NX 43200            // the GTOPO30 tiles as one 30" grid
+#define GT3NY 21600
+
+struct demframe
+{
+  int demid;               // enum demproduct
+  long long nx,ny;         // columns and rows
+  double x0,y0,res;        // left and top edge and pixel size, m or deg
+  int south;               // hemisphere of a polar DEM, -1 for GTOPO30 in lat/lon
+};
+
+struct pyramidnode
+{
+  float bound;             // highest pixel the block may hold
+  int level;
+  long long r,c;
+};
+
+struct pyramidheap
+{
+  struct pyramidnode *nodes;  // max-heap on bound
+  long n,size;
+};
+
+
+int getdemframe(int demid,struct demframe *f)
+{
+  // Pixel frame of a DEM with float32 or GTOPO30 pixels, -1 for others
+  const struct griddesc *g;
+
+  f->demid = demid;
+  if (demid==DEM_GT3)
+  {
+    f->nx = GT3NX;
+    f->ny = GT3NY;
+    f->x0 = -180.0;
+    f->y0 = 90.0;
+    f->res = 1.0/120.0;
+    f->south = -1;
+    return(0);
+  }
+  if (demid<0||demid>=NDEMPRODUCTS||(g=griddescs[demid])==NULL||g->sample!=SAMPLE_FLOAT32) return(-1);
+  f->nx = g->nx;
+  f->ny = g->ny;
+  f->x0 = g->x0;
+  f->y0 = g->y0;
+  f->res = g->res;
+  f->south = (demid!=DEM_AD1);
+  return(0);
+}
+
+
+void pyramidpath(struct topocontext *ctx,int demid,char *path)
+{
+  // The pyramid sits beside its DEM, path must hold MAXPATHLEN+20
+  int len;
+
+  if (demid==DEM_GT3)
+  {
+    snprintf(path,MAXPATHLEN+20,"%s/gtopo30.pyr",ctx->datasets[DEM_GT3].path);
+    return;
+  }
+  len = strlen(ctx->datasets[demid].path);
+  if (len>4&&!strcmp(ctx->datasets[demid].path+len-4,".flt")) len -= 4;
+  snprintf(path,MAXPATHLEN+20,"%.*s.pyr",len,ctx->datasets[demid].path);
+}
+
+
+int readdemrow(struct topocontext *ctx,const struct demframe *f,long long row,long long col,long long n,
+               float *buf)
+{
+  // Reads n pixels along a row of a DEM frame as heights, -9999 for no
+  // data.  GTOPO30 rows run across the tiles, with ocean as 0.
+  char filename[MAXPATHLEN+20];
+  int t;
+  long long k,i,seg,tr,tc;
+  short s;
+  struct beint16 raw[1024];
+  const struct griddesc *g;
+  const struct gtopo30tile *tile;
+  struct gridfile *gf;
+
+  if (f->demid!=DEM_GT3)
+  {
+    g = griddescs[f->demid];
+    gf = getgridfile(ctx,&ctx->demfiles[g->file],ctx->datasets[g->product].path,g->nx,g->ny);
+    if (gf==NULL) return(-1);
+    return(readgridspan(gf,g->nx,row,col,n,buf));
+  }
+  for (k=0;k<n;k+=seg)
+  {
+    t = (row<18000) ? 9*(row/6000)+(col+k)/4800 : 27+(col+k)/7200;
+    tile = &gtopo30tiles[t];
+    tr = row-(long long)((90.0-tile->lat0)*120.0+0.5);
+    tc = col+k-(long long)((tile->lon0+180.0)*120.0+0.5);
+    seg = tile->nlon-tc;
+    if (seg>n-k) seg = n-k;
+    if (seg>1024) seg = 1024;
+    snprintf(filename,sizeof(filename),"%s/%s",ctx->datasets[DEM_GT3].path,tile->name);
+    if ((gf=getgridfile(ctx,&ctx->demfiles[t],filename,0,0))==NULL||
+        readgridfile(gf,2*(tr*tile->nlon+tc),raw,2*seg)==-1)
+    {
+      for (i=0;i<seg;i++) buf[k+i] = -9999.0;
+      continue;
+    }
+    for (i=0;i<seg;i++)
+    {
+      s = (short)__builtin_bswap16(raw[i].raw);
+      buf[k+i] = (s==-9999) ? 0.0 : s;
+    }
+  }
+  return(0);
+}
+
+
+int buildpyramid(struct topocontext *ctx,int demid,int base)
+{
+  char path[MAXPATHLEN+20];
+  int l,nlevels;
+  long long r,c,k,total,first[PYRAMIDMAXLEVELS];
+  float *row,h;
+  struct demframe f;
+  struct pyramidheader hdr;
+  struct pyramidentry *e,*pe,*ce;
+  FILE *fptr;
+
+  if (getdemframe(demid,&f)==-1||base<1) return(-1);
+  memset(&hdr,0,sizeof(hdr));
+  nlevels = pyramidlevels(f.nx,f.ny,base,hdr.levelnx,hdr.levelny);
+  for (total=0,l=0;l<nlevels;l++)
+  {
+    first[l] = total;
+    total += (long long)hdr.levelnx[l]*hdr.levelny[l];
+  }
+  e = (struct pyramidentry *)malloc(total*sizeof(struct pyramidentry));
+  row = (float *)malloc(f.nx*sizeof(float));
+  if (e==NULL||row==NULL)
+  {
+    free(e);
+    free(row);
+    return(-1);
+  }
+  for (k=0;k<total;k++)
+  {
+    e[k].min = FLT_MAX;
+    e[k].max = -FLT_MAX;
+  }
+
+  // Level 0 from the DEM a row at a time
+  for (r=0;r<f.ny;r++)
+  {
+    if (readdemrow(ctx,&f,r,0,f.nx,row)==-1)
+    {
+      free(e);
+      free(row);
+      return(-1);
+    }
+    pe = e+(r/base)*hdr.levelnx[0];
+    for (c=0;c<f.nx;c++)
+    {
+      if ((h=row[c])==-9999.0) continue;
+      if (h<pe[c/base].min) pe[c/base].min = h;
+      if (h>pe[c/base].max) pe[c/base].max = h;
+    }
+  }
+  free(row);
+
+  // Each level above from 2x2 entries of the one below
+  for (l=1;l<nlevels;l++)
+  {
+    for (r=0;r<hdr.levelny[l];r++)
+      for (c=0;c<hdr.levelnx[l];c++)
+      {
+        pe = e+first[l]+r*hdr.levelnx[l]+c;
+        for (k=0;k<4;k++)
+        {
+          if (2*r+k/2>=hdr.levelny[l-1]||2*c+k%2>=hdr.levelnx[l-1]) continue;
+          ce = e+first[l-1]+(2*r+k/2)*hdr.levelnx[l-1]+2*c+k%2;
+          if (ce->min<pe->min) pe->min = ce->min;
+          if (ce->max>pe->max) pe->max = ce->max;
+        }
+      }
+  }
+
+  // Write it beside the DEM
+  memcpy(hdr.magic,PYRAMIDMAGIC,8);
+  hdr.version = PYRAMIDVERSION;
+  hdr.nx = f.nx;
+  hdr.ny = f.ny;
+  hdr.base = base;
+  hdr.nlevels = nlevels;
+  for (l=0;l<nlevels;l++) hdr.offset[l] = sizeof(hdr)+first[l]*sizeof(struct pyramidentry);
+  pyramidpath(ctx,demid,path);
+  if ((fptr=fopen(path,"w"))==NULL)
+  {
+    free(e);
+    return(-1);
+  }
+  k = (fwrite(&hdr,sizeof(hdr),1,fptr)==1&&fwrite(e,sizeof(struct pyramidentry),total,fptr)==(size_t)total);
+  if (fclose(fptr)!=0) k = 0;
+  free(e);
+  return(k ? 0 : -1);
+}
+
+
+int writerefgrid(struct topocontext *ctx,int demid,int tile,long long nx,long long ny)
+{
+  // Writes the .ref file of a polar DEM or GTOPO30 tile a row at a time,
+  // with the geoid at each pixel centre.  The header goes in last, so a
+  // file left part written is never read.
+  char path[MAXPATHLEN+20],filename[MAXPATHLEN+20],geoidid[10];
+  int status;
+  long long r,c;
+  float *h;
+  double *lat,*lon,*geoid,g0,lat0,lon0;
+  struct refgridheader hdr;
+  struct refgridpixel *px;
+  struct beint16 *raw;
+  struct demframe f;
+  struct gridfile *gf;
+  const struct gtopo30tile *t;
+  FILE *fptr;
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+
+  // The DEM or tile, and the geoid to reference it with
+  gf = NULL;
+  t = &gtopo30tiles[tile];
+  if (demid==DEM_GT3)
+  {
+    snprintf(filename,sizeof(filename),"%s/%s",ctx->datasets[DEM_GT3].path,t->name);
+    if ((gf=getgridfile(ctx,&ctx->demfiles[tile],filename,0,0))==NULL) return(-1);
+  }
+  else
+    getdemframe(demid,&f);
+  memset(&hdr,0,sizeof(hdr));
+  memcpy(hdr.magic,REFGRIDMAGIC,8);
+  hdr.version = REFGRIDVERSION;
+  hdr.nx = nx;
+  hdr.ny = ny;
+  hdr.demid = demid;
+  lat0 = lon0 = 0.0;
+  querygeoidbatch(ctx,1,&lat0,&lon0,&g0,geoidid);
+  memcpy(hdr.geoidid,geoidid,3);
+
+  h = (float *)malloc(nx*sizeof(float));
+  lat = (double *)malloc(nx*sizeof(double));
+  lon = (double *)malloc(nx*sizeof(double));
+  geoid = (double *)malloc(nx*sizeof(double));
+  px = (struct refgridpixel *)malloc(nx*sizeof(struct refgridpixel));
+  raw = (struct beint16 *)malloc(nx*sizeof(struct beint16));
+  refgridpath(ctx,demid,tile,path);
+  fptr = NULL;
+  status = (h==NULL||lat==NULL||lon==NULL||geoid==NULL||px==NULL||raw==NULL||
+            (fptr=fopen(path,"w"))==NULL||fseek(fptr,sizeof(hdr),SEEK_SET)!=0) ? -1 : 0;
+
+  // Each row with the positions of its pixel centres, GTOPO30 ocean as 0
+  for (r=0;r<ny&&status==0;r++)
+  {
+    if (demid==DEM_GT3)
+    {
+      if (readgridfile(gf,2*r*nx,raw,2*nx)==-1) status = -1;
+      for (c=0;c<nx;c++)
+      {
+        h[c] = (short)__builtin_bswap16(raw[c].raw);
+        if (h[c]==-9999.0) h[c] = 0.0;
+        lat[c] = t->lat0-(r+0.5)/120.0;
+        lon[c] = t->lon0+(c+0.5)/120.0;
+      }
+    }
+    else
+    {
+      if (readdemrow(ctx,&f,r,0,nx,h)==-1) status = -1;
+      for (c=0;c<nx;c++)
+        unprojectps(&ctx->polar[f.south],f.x0+(c+0.5)*f.res,f.y0-(r+0.5)*f.res,&lat[c],&lon[c]);
+    }
+    querygeoidbatch(ctx,nx,lat,lon,geoid,geoidid);
+    for (c=0;c<nx;c++)
+    {
+      px[c].ell = px[c].orth = h[c];
+      if (h[c]==-9999.0) continue;
+      if (ctx->datasets[demid].geoidref) px[c].ell = h[c]+geoid[c];
+      else px[c].orth = h[c]-geoid[c];
+    }
+    if (status==0&&fwrite(px,sizeof(struct refgridpixel),nx,fptr)!=(size_t)nx) status = -1;
+  }
+  if (status==0&&(fseek(fptr,0,SEEK_SET)!=0||fwrite(&hdr,sizeof(hdr),1,fptr)!=1)) status = -1;
+  if (fptr!=NULL&&fclose(fptr)!=0) status = -1;
+  free(h);
+  free(lat);
+  free(lon);
+  free(geoid);
+  free(px);
+  free(raw);
+  return(status);
+}
+
+
+int buildrefgrid(struct topocontext *ctx,int demid)
+{
+  char filename[MAXPATHLEN+20];
+  int t,n;
+  struct demframe f;
+
+  if (demid==DEM_AD1||demid==DEM_REP||demid==DEM_REM)
+  {
+    getdemframe(demid,&f);
+    return(writerefgrid(ctx,demid,0,f.nx,f.ny));
+  }
+  if (demid!=DEM_GT3) return(-1);
+
+  // Every GTOPO30 tile there is
+  for (n=0,t=0;t<33;t++)
+  {
+    snprintf(filename,sizeof(filename),"%s/%s",ctx->datasets[DEM_GT3].path,gtopo30tiles[t].name);
+    if (getgridfile(ctx,&ctx->demfiles[t],filename,0,0)==NULL) continue;
+    if (writerefgrid(ctx,DEM_GT3,t,gtopo30tiles[t].nlon,gtopo30tiles[t].nlat)==-1) return(-1);
+    n++;
+  }
+  return((n>0) ? 0 : -1);
+}
+
+
+int pushnode(struct pyramidheap *h,float bound,int level,long long r,long long c)
+{
+  long i;
+  struct pyramidnode *nodes;
+
+  if (h->n==h->size)
+  {
+    if ((nodes=(struct pyramidnode *)realloc(h->nodes,(2*h->size+64)*sizeof(struct pyramidnode)))==NULL)
+      return(-1);
+    h->nodes = nodes;
+    h->size = 2*h->size+64;
+  }
+  for (i=h->n++;i>0&&h->nodes[(i-1)/2].bound<bound;i=(i-1)/2) h->nodes[i] = h->nodes[(i-1)/2];
+  h->nodes[i].bound = bound;
+  h->nodes[i].level = level;
+  h->nodes[i].r = r;
+  h->nodes[i].c = c;
+  return(0);
+}
+
+
+void popnode(struct pyramidheap *h,struct pyramidnode *node)
+{
+  long i,j;
+  struct pyramidnode last;
+
+  *node = h->nodes[0];
+  last = h->nodes[--h->n];
+  for (i=0;(j=2*i+1)<h->n;i=j)
+  {
+    if (j+1<h->n&&h->nodes[j+1].bound>h->nodes[j].bound) j++;
+    if (h->nodes[j].bound<=last.bound) break;
+    h->nodes[i] = h->nodes[j];
+  }
+  h->nodes[i] = last;
+}
+
+
+static inline bool segmentinbox(double x0,double y0,double x1,double y1,double c0,double c1,double r0,double r1)
+{
+  // Liang-Barsky: does any of the segment lie within the box
+  int k;
+  double t,t0,t1,p[4],q[4];
+
+  p[0] = x0-x1;  q[0] = x0-c0;
+  p[1] = x1-x0;  q[1] = c1-x0;
+  p[2] = y0-y1;  q[2] = y0-r0;
+  p[3] = y1-y0;  q[3] = r1-y0;
+  t0 = 0.0;
+  t1 = 1.0;
+  for (k=0;k<4;k++)
+  {
+    if (p[k]==0.0)
+    {
+      if (q[k]<0.0) return(false);
+      continue;
+    }
+    t = q[k]/p[k];
+    if (p[k]<0.0&&t>t0) t0 = t;
+    if (p[k]>0.0&&t<t1) t1 = t;
+    if (t0>t1) return(false);
+  }
+  return(true);
+}
+
+
+bool boxinpolygon(double c0,double c1,double r0,double r1,double *pu,double *pv,long np)
+{
+  // True if the box [c0,c1]x[r0,r1] and the closed polygon pu,pv overlap,
+  // either by a corner of the box inside or an edge crossing the box
+  long i;
+  bool pointinpolygon(double,double,double *,double *,int);
+
+  if (pointinpolygon(c0,r0,pu,pv,np)) return(true);
+  for (i=0;i<np-1;i++)
+    if (segmentinbox(pu[i],pv[i],pu[i+1],pv[i+1],c0,c1,r0,r1)) return(true);
+  return(false);
+}
+
+
+double polarreach(struct topocontext *ctx,int south)
+{
+  // Lowest latitude (deg, positive) that any polar DEM queried in the
+  // hemisphere reaches, at the corner of its grid furthest from the pole
+  int d,k;
+  double lat,lon,reach;
+  struct demframe f;
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+
+  reach = 90.0;
+  for (d=DEM_AD1;d<=DEM_REM;d++)
+  {
+    if ((d==DEM_AD1)==south||getdemframe(d,&f)==-1) continue;
+    for (k=0;k<4;k++)
+    {
+      unprojectps(&ctx->polar[south],f.x0+((k&1) ? f.nx*f.res : 0.0),f.y0-((k&2) ? f.ny*f.res : 0.0),&lat,&lon);
+      if (fabs(lat)<reach) reach = fabs(lat);
+    }
+  }
+  return(reach);
+}
+
+
+void spancounts(struct topocontext *ctx,const struct demframe *f,long long r,long long c,long len,char *counts)
+{
+  // Of pixels c to c+len-1 of row r with counts[j] set, clears those at
+  // whose centre querytopo would not answer from the frame's DEM.  GTOPO30
+  // answers where no polar DEM covers the point, or the polar DEM that
+  // does has no data there, so a GTOPO30 span poleward of a polar DEM's
+  // reach is projected and its polar heights read a block at a time.
+  int p,d;
+  long j,i,m,nd,idx[QBLOCK],didx[QBLOCK];
+  double y,lat[QBLOCK],lon[QBLOCK],x[QBLOCK],py[QBLOCK],dx[QBLOCK],dy[QBLOCK],h[QBLOCK];
+  int demof[QBLOCK];
+  int polardem(struct topocontext *,int,double,double);
+  double polarreach(struct topocontext *,int);
+  void projectps(const struct psprojection *,long,const double *,const double *,double *,double *);
+  void queryarcticdem100(struct topocontext *,long,const double *,const double *,double *);
+  void queryremp(struct topocontext *,long,const double *,const double *,double *);
+  void queryrema(struct topocontext *,long,const double *,const double *,double *);
+
+  y = f->y0-(r+0.5)*f->res;
+  if (f->south>=0)
+  {
+    for (j=0;j<len;j++)
+      if (counts[j]) counts[j] = (polardem(ctx,f->south,f->x0+(c+j+0.5)*f->res,y)==f->demid);
+    return;
+  }
+  if (fabs(y)<polarreach(ctx,y<0.0)) return;
+
+  for (j=0;j<len;)
+  {
+    // The next block of pixels still counting, projected together
+    for (m=0;j<len&&m<QBLOCK;j++)
+      if (counts[j])
+      {
+        idx[m] = j;
+        lat[m] = y;
+        lon[m++] = f->x0+(c+j+0.5)*f->res;
+      }
+    projectps(ctx->polar,m,lat,lon,x,py);
+    for (i=0;i<m;i++) demof[i] = polardem(ctx,y<0.0,x[i],py[i]);
+
+    // Each polar DEM's share of them read in one call
+    for (d=DEM_AD1;d<=DEM_REM;d++)
+    {
+      for (nd=0,i=0;i<m;i++)
+        if (demof[i]==d)
+        {
+          didx[nd] = idx[i];
+          dx[nd] = x[i];
+          dy[nd++] = py[i];
+        }
+      if (nd==0) continue;
+      if (d==DEM_AD1) queryarcticdem100(ctx,nd,dx,dy,h);
+      if (d==DEM_REP) queryremp(ctx,nd,dx,dy,h);
+      if (d==DEM_REM) queryrema(ctx,nd,dx,dy,h);
+      for (i=0;i<nd;i++) counts[didx[i]] = (h[i]==-9999.0);
+    }
+  }
+}
+
+
+long rowcrossings(long long r,const double *pu,const double *pv,long np,double *xs)
+{
+  // Columns at which row r crosses the edges of the closed polygon pu,pv,
+  // in increasing order, with the half-open rule of pointinpolygon so the
+  // pixels inside lie between pairs of crossings.  Returns their number.
+  long i,j,nx;
+  double t;
+
+  for (nx=0,i=0;i<np-1;i++)
+    if ((pv[i]<r&&pv[i+1]>=r)||(pv[i+1]<r&&pv[i]>=r))
+    {
+      t = pu[i]+(r-pv[i])/(pv[i+1]-pv[i])*(pu[i+1]-pu[i]);
+      for (j=nx++;j>0&&xs[j-1]>t;j--) xs[j] = xs[j-1];
+      xs[j] = t;
+    }
+  return(nx);
+}
+
+
+int geoidcellrange(struct topocontext *ctx,long long i,long long j,double *gmin,double *gmax)
+{
+  // Lowest and highest EGM2008 node of the 1 deg cell i rows down from
+  // the north pole and j columns east of 0, filled on first use by
+  // reading its nodes straight from the grid, laid out as in
+  // queryegm2008.  Threads may fill a cell at once, the first to finish
+  // keeping its values.  Returns -1 if out of memory or the grid can't be
+  // read.
+  long k,m,q;
+  long long r,off;
+  float g[61];
+  double lo,hi;
+  struct geoidcell *cells,*cell;
+  struct gridfile *gf;
+
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->geoidcells==NULL) ctx->geoidcells = (struct geoidcell *)calloc(180*360,sizeof(struct geoidcell));
+  cells = ctx->geoidcells;
+  pthread_mutex_unlock(&ctx->lock);
+  if (cells==NULL) return(-1);
+  cell = &cells[i*360+j];
+  if (!__atomic_load_n(&cell->done,__ATOMIC_ACQUIRE))
+  {
+    gf = NULL;
+    if (ctx->egm08==NULL&&ctx->egm08cm==NULL&&
+        (gf=getgridfile(ctx,&ctx->geoidfiles[0],ctx->datasets[DS_E08].path,0,0))==NULL) return(-1);
+    lo = HUGE_VAL;
+    hi = -HUGE_VAL;
+    for (r=60*i;r<=60*i+60&&r<EGM08NY;r++)
+    {
+      // Columns 60j to 60j+60 past the padding column, the last cell's
+      // eastern edge wrapping around to the first column
+      for (k=0;k<=60;k+=m)
+      {
+        m = (k>0) ? 1 : (j<359) ? 61 : 60;
+        off = r*EGM08NX+(60*j+k)%(EGM08NX-2)+1;
+        if (ctx->egm08!=NULL) for (q=0;q<m;q++) g[k+q] = ctx->egm08[off+q];
+        else if (ctx->egm08cm!=NULL) for (q=0;q<m;q++) g[k+q] = samplevalue(ctx->egm08cm[off+q]);
+        else if (readgridfile(gf,4*off,&g[k],4*m)==-1) return(-1);
+      }
+      for (k=0;k<=60;k++)
+      {
+        if (g[k]<lo) lo = g[k];
+        if (g[k]>hi) hi = g[k];
+      }
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (!cell->done)
+    {
+      cell->min = lo;
+      cell->max = hi;
+      __atomic_store_n(&cell->done,1,__ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  *gmin = cell->min;
+  *gmax = cell->max;
+  return(0);
+}
+
+
+double blockgeoidbound(struct topocontext *ctx,const struct demframe *f,long long r0,long long r1,
+                       long long c0,long long c1,double gsign)
+{
+  // Most that gsign times the geoid reaches at the centre of any pixel of
+  // rows r0 to r1-1 and columns c0 to c1-1, from the EGM2008 nodes around
+  // the block's lat/lon extent.  The geoid between nodes is bilinear, so
+  // it never passes the nodes around it.  A block spanning more than
+  // GEOIDBOUNDNODES nodes is bounded by the 1 deg cells around it
+  // instead, and one spanning more than GEOIDBOUNDCELLS of those by
+  // HUGE_VAL, so it is always opened.
+  char geoidid[10];
+  int k;
+  long i,m;
+  long long ra,rb,ca,cb,r,c;
+  double xa,xb,ya,yb,x,y,latmin,latmax,lonmin,lonmax,lat,lon,d,bound,gmin,gmax;
+  double glat[GEOIDBOUNDNODES],glon[GEOIDBOUNDNODES],g[GEOIDBOUNDNODES];
+  const struct psprojection *ps;
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  int geoidcellrange(struct topocontext *,long long,long long,double *,double *);
+
+  // Extent of the pixel centres in the frame
+  xa = f->x0+(c0+0.5)*f->res;
+  xb = f->x0+(c1-0.5)*f->res;
+  ya = f->y0-(r1-0.5)*f->res;
+  yb = f->y0-(r0+0.5)*f->res;
+  if (f->south<0)
+  {
+    latmin = ya;
+    latmax = yb;
+    lonmin = xa;
+    lonmax = xb;
+  }
+
+  // In polar stereographic latitude follows the distance from the pole,
+  // so it is bounded by the nearest and furthest points of the block.
+  // Longitude is bounded by the corners, unless the pole is inside.
+  else
+  {
+    ps = &ctx->polar[f->south];
+    x = (xa>0.0) ? xa : (xb<0.0) ? xb : 0.0;
+    y = (ya>0.0) ? ya : (yb<0.0) ? yb : 0.0;
+    unprojectps(ps,x,y,&latmin,&lon);
+    x = (fabs(xa)>fabs(xb)) ? xa : xb;
+    y = (fabs(ya)>fabs(yb)) ? ya : yb;
+    unprojectps(ps,x,y,&latmax,&lon);
+    if (latmin>latmax)
+    {
+      d = latmin;
+      latmin = latmax;
+      latmax = d;
+    }
+    if (xa<=0.0&&xb>=0.0&&ya<=0.0&&yb>=0.0)
+    {
+      if (f->south) latmin = -90.0;
+      else latmax = 90.0;
+      lonmin = -180.0;
+      lonmax = 180.0;
+    }
+    else
+    {
+      unprojectps(ps,xa,ya,&lat,&lon);
+      lonmin = lonmax = lon;
+      for (k=1;k<4;k++)
+      {
+        unprojectps(ps,(k&1) ? xb : xa,(k&2) ? yb : ya,&lat,&d);
+        d -= lon;
+        if (d<=-180.0) d += 360.0;
+        if (d>180.0) d -= 360.0;
+        if (lon+d<lonmin) lonmin = lon+d;
+        if (lon+d>lonmax) lonmax = lon+d;
+      }
+    }
+  }
+
+  // The 1' geoid grid nodes around that extent
+  ra = (long long)floor((90.0-latmax)*60.0-1.0e-6);
+  rb = (long long)ceil((90.0-latmin)*60.0+1.0e-6);
+  ca = (long long)floor(lonmin*60.0-1.0e-6);
+  cb = (long long)ceil(lonmax*60.0+1.0e-6);
+  if (ra<0) ra = 0;
+  if (rb>EGM08NY-1) rb = EGM08NY-1;
+  bound = -HUGE_VAL;
+  if ((rb-ra+1)*(cb-ca+1)>GEOIDBOUNDNODES)
+  {
+    // The cells holding those nodes, cell i spanning rows 60i to 60i+60
+    ra = ra/60;
+    rb = (rb>60*ra) ? (rb+59)/60-1 : ra;
+    ca = (long long)floor(ca/60.0);
+    cb = (long long)ceil(cb/60.0)-1;
+    if (cb<ca) cb = ca;
+    if ((rb-ra+1)*(cb-ca+1)>GEOIDBOUNDCELLS) return(HUGE_VAL);
+    for (r=ra;r<=rb;r++)
+      for (c=ca;c<=cb;c++)
+      {
+        if (geoidcellrange(ctx,r,((c%360)+360)%360,&gmin,&gmax)==-1) return(HUGE_VAL);
+        if (gsign*gmin>bound) bound = gsign*gmin;
+        if (gsign*gmax>bound) bound = gsign*gmax;
+      }
+    return(bound+1.0e-3);
+  }
+  for (m=0,r=ra;r<=rb;r++)
+    for (c=ca;c<=cb;c++)
+    {
+      glat[m] = 90.0-r/60.0;
+      glon[m++] = c/60.0;
+    }
+  querygeoidbatch(ctx,m,glat,glon,g,geoidid);
+  for (i=0;i<m;i++)
+    if (gsign*g[i]>bound) bound = gsign*g[i];
+  return(bound+1.0e-3);  // the nodes as read may round by a little
+}
+
+
+long rowgeoid(struct topocontext *ctx,const struct demframe *f,long long r,long long c,long len,
+              double *nlat,double *nlon,double *ng,long *pos)
+{
+  // Geoid at the first and last pixel of c to c+len-1 along row r and
+  // every REGIONNODE between, as zonalspan finds it, with the pixel of
+  // each node in pos.  Returns the number of nodes.
+  char geoidid[10];
+  long k,nn;
+  double y;
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+
+  nn = (len-1+REGIONNODE-1)/REGIONNODE+1;
+  y = f->y0-(r+0.5)*f->res;
+  for (k=0;k<nn;k++)
+  {
+    pos[k] = (k*REGIONNODE<len) ? k*REGIONNODE : len-1;
+    if (f->south>=0)
+      unprojectps(&ctx->polar[f->south],f->x0+(c+pos[k]+0.5)*f->res,y,&nlat[k],&nlon[k]);
+    else
+    {
+      nlat[k] = y;
+      nlon[k] = f->x0+(c+pos[k]+0.5)*f->res;
+    }
+  }
+  querygeoidbatch(ctx,nn,nlat,nlon,ng,geoidid);
+  return(nn);
+}
+
+
+int searchpyramid(struct topocontext *ctx,const struct demframe *f,double *pu,double *pv,long np,
+                  double gsign,double *best,long long *bestr,long long *bestc)
+{
+  // Highest counting pixel of a DEM inside the closed polygon pu,pv (np
+  // points, in pixel coordinates of the frame) that is above *best, its
+  // height plus gsign times the geoid.  Returns -1 if out of memory.
+  char path[MAXPATHLEN+20];
+  int l,nlevels,base,status,levelnx[PYRAMIDMAXLEVELS],levelny[PYRAMIDMAXLEVELS];
+  long i,j,k,nx,nn,*pos;
+  long long r,c,r0,r1,c0,c1,a,b,span;
+  double umin,umax,vmin,vmax,h,t,*xs,*nlat,*nlon,*ng,*hs;
+  char *counts;
+  float *row;
+  struct pyramidheader hdr;
+  struct pyramidentry e;
+  struct pyramidnode node;
+  struct pyramidheap heap;
+  struct gridfile *pgf;
+
+  // The DEM's pyramid, if one was built for it
+  pyramidpath(ctx,f->demid,path);
+  pgf = getgridfile(ctx,&ctx->pyramidfiles[f->demid],path,0,0);
+  base = PYRAMIDDEFAULTBASE;
+  if (pgf!=NULL)
+  {
+    if (readgridfile(pgf,0,&hdr,sizeof(hdr))==-1||memcmp(hdr.magic,PYRAMIDMAGIC,8)||
+        hdr.version!=PYRAMIDVERSION||hdr.nx!=f->nx||hdr.ny!=f->ny||hdr.base<1)
+      pgf = NULL;
+    else
+      base = hdr.base;
+  }
+  nlevels = pyramidlevels(f->nx,f->ny,base,levelnx,levelny);
+  if (pgf!=NULL&&hdr.nlevels!=nlevels) pgf = NULL;
+
+  // Extent of the polygon
+  umin = vmin = DBL_MAX;
+  umax = vmax = -DBL_MAX;
+  for (i=0;i<np;i++)
+  {
+    if (pu[i]<umin) umin = pu[i];
+    if (pu[i]>umax) umax = pu[i];
+    if (pv[i]<vmin) vmin = pv[i];
+    if (pv[i]>vmax) vmax = pv[i];
+  }
+  if (umax<0.0||vmax<0.0||umin>f->nx-1||vmin>f->ny-1) return(0);
+  xs = (double *)malloc(np*sizeof(double));
+  row = (float *)malloc(base*sizeof(float));
+  nlat = (double *)malloc((base/REGIONNODE+2)*sizeof(double));
+  nlon = (double *)malloc((base/REGIONNODE+2)*sizeof(double));
+  ng = (double *)malloc((base/REGIONNODE+2)*sizeof(double));
+  pos = (long *)malloc((base/REGIONNODE+2)*sizeof(long));
+  hs = (double *)malloc(base*sizeof(double));
+  counts = (char *)malloc(base);
+  heap.nodes = NULL;
+  heap.n = heap.size = 0;
+  if (xs==NULL||row==NULL||nlat==NULL||nlon==NULL||ng==NULL||pos==NULL||hs==NULL||counts==NULL)
+  {
+    free(xs);
+    free(row);
+    free(nlat);
+    free(nlon);
+    free(ng);
+    free(pos);
+    free(hs);
+    free(counts);
+    return(-1);
+  }
+
+  // Start from the single block of the top level, then open the block
+  // with the highest bound until none can beat the best pixel
+  status = pushnode(&heap,FLT_MAX,nlevels-1,0,0);
+  while (status==0&&heap.n>0)
+  {
+    popnode(&heap,&node);
+    if (node.bound<=*best) break;
+
+    // The quarters of a block are checked against the polygon and their
+    // bounds read as they are reached
+    if (node.level>0)
+    {
+      l = node.level-1;
+      for (j=0;j<4;j++)
+      {
+        r = 2*node.r+j/2;
+        c = 2*node.c+j%2;
+        if (r>=levelny[l]||c>=levelnx[l]) continue;
+        r0 = (r*base)<<l;
+        c0 = (c*base)<<l;
+        r1 = ((r+1)*base)<<l;
+        c1 = ((c+1)*base)<<l;
+        if (r1>f->ny) r1 = f->ny;
+        if (c1>f->nx) c1 = f->nx;
+        if (c1-1<umin||c0>umax||r1-1<vmin||r0>vmax) continue;
+        if (!boxinpolygon(c0,c1-1,r0,r1-1,pu,pv,np)) continue;
+        e.max = FLT_MAX;
+        if (pgf!=NULL&&
+            (readgridfile(pgf,hdr.offset[l]+sizeof(e)*(r*levelnx[l]+c),&e,sizeof(e))==-1||e.min>e.max))
+          continue;
+        h = e.max;
+        if (pgf!=NULL&&gsign!=0.0) h += blockgeoidbound(ctx,f,r0,r1,c0,c1,gsign);
+        if (h>*best&&pushnode(&heap,(h<FLT_MAX) ? h : FLT_MAX,l,r,c)==-1) status = -1;
+      }
+      continue;
+    }
+
+    // A level 0 block: the pixels of each row inside the polygon are the
+    // spans between pairs of edge crossings, as in pointinpolygon
+    r0 = node.r*base;
+    c0 = node.c*base;
+    r1 = (r0+base<f->ny) ? r0+base : f->ny;
+    c1 = (c0+base<f->nx) ? c0+base : f->nx;
+    for (r=r0;r<r1;r++)
+    {
+      nx = rowcrossings(r,pu,pv,np,xs);
+      for (i=0;i+1<nx;i+=2)
+      {
+        a = (long long)floor(xs[i])+1;
+        b = (long long)floor(xs[i+1]);
+        if (a<c0) a = c0;
+        if (b>c1-1) b = c1-1;
+        if ((span=b-a+1)<=0) continue;
+        if (readdemrow(ctx,f,r,a,span,row)==-1) continue;
+        nn = (gsign!=0.0) ? rowgeoid(ctx,f,r,a,span,nlat,nlon,ng,pos) : 0;
+
+        // Pixels above the best so far, then those of them that count
+        for (j=0;j<span;j++)
+        {
+          counts[j] = 0;
+          if (row[j]==-9999.0) continue;
+          h = row[j];
+          if (gsign!=0.0)
+          {
+            k = j/REGIONNODE;
+            t = (k+1<nn) ? (double)(j-pos[k])/(pos[k+1]-pos[k]) : 0.0;
+            h += gsign*((k+1<nn) ? ng[k]+t*(ng[k+1]-ng[k]) : ng[k]);
+          }
+          hs[j] = h;
+          counts[j] = (h>*best);
+        }
+        spancounts(ctx,f,r,a,span,counts);
+        for (j=0;j<span;j++)
+          if (counts[j]&&hs[j]>*best)
+          {
+            *best = hs[j];
+            *bestr = r;
+            *bestc = a+j;
+          }
+      }
+    }
+  }
+  free(heap.nodes);
+  free(xs);
+  free(row);
+  free(nlat);
+  free(nlon);
+  free(ng);
+  free(pos);
+  free(hs);
+  free(counts);
+  return(status);
+}
+
+
+long densifypolygon(long n,const double *lat,const double *lon,double **plat,double **plon,int *hemi)
+{
+  // Vertices every DENSIFYSPACING along the great-circle edges of a
+  // polygon, closed by repeating the first, in arrays allocated here.
+  // hemi[0] and hemi[1] are set if any vertex is north or south.
+  // Returns the number of vertices, or -1 if out of memory.
+  long i,np,ns;
+  double *dist;
+
+  for (np=1,i=0;i<n;i++)
+  {
+    ns = greatcircle(lat[i],lon[i],lat[(i+1)%n],lon[(i+1)%n],DENSIFYSPACING,0,0,NULL,NULL,NULL);
+    np += (ns>0) ? ns : 1;
+  }
+  *plat = (double *)malloc(np*sizeof(double));
+  *plon = (double *)malloc(np*sizeof(double));
+  dist = (double *)malloc(np*sizeof(double));
+  if (*plat==NULL||*plon==NULL||dist==NULL)
+  {
+    free(*plat);
+    free(*plon);
+    free(dist);
+    *plat = *plon = NULL;
+    return(-1);
+  }
+  hemi[0] = hemi[1] = 0;
+  for (np=0,i=0;i<n;i++)
+  {
+    ns = greatcircle(lat[i],lon[i],lat[(i+1)%n],lon[(i+1)%n],DENSIFYSPACING,0,0,NULL,NULL,NULL);
+    if (ns>0) greatcircle(lat[i],lon[i],lat[(i+1)%n],lon[(i+1)%n],DENSIFYSPACING,0,ns,*plat+np,*plon+np,dist);
+    else
+    {
+      (*plat)[np] = lat[i];
+      (*plon)[np] = lon[i];
+      while ((*plon)[np]<=-180.0) (*plon)[np] += 360.0;
+      while ((*plon)[np]>180.0) (*plon)[np] -= 360.0;
+      ns = 1;
+    }
+    np += ns;
+    hemi[lat[i]<0.0] = 1;
+  }
+  (*plat)[np] = (*plat)[0];
+  (*plon)[np] = (*plon)[0];
+  free(dist);
+  return(np+1);
+}
+
+
+int maxtopo(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+            double *topo,double *toplat,double *toplon,int *demid)
+{
+  char geoidid[10];
+  int k,status,hemi[2];
+  long i,np;
+  double *plat,*plon,*pu,*pv,*vl,*vt,*vg,h,hlat,hlon;
+  int *vd;
+  static const int products[4] = {DEM_AD1,DEM_REP,DEM_REM,DEM_GT3};
+  long densifypolygon(long,const double *,const double *,double **,double **,int *);
+  int maxtopoframe(struct topocontext *,int,long,const double *,const double *,double *,double *,
+                   const int *,int,double *,double *,double *);
+
+  *topo = -9999.0;
+  *toplat = *toplon = 0.0;
+  *demid = DEM_NONE;
+  if (n<=0) return(0);
+
+  // Allocate work space, with room to close a polygon round a pole
+  np = densifypolygon(n,lat,lon,&plat,&plon,hemi);
+  pu = (double *)malloc((np+3)*sizeof(double));
+  pv = (double *)malloc((np+3)*sizeof(double));
+  vl = (double *)malloc(n*sizeof(double));
+  vt = (double *)malloc(n*sizeof(double));
+  vg = (double *)malloc(n*sizeof(double));
+  vd = (int *)malloc(n*sizeof(int));
+  status = (np==-1||pu==NULL||pv==NULL||vl==NULL||vt==NULL||vg==NULL||vd==NULL) ? -1 : 0;
+
+  // The vertices themselves, so a polygon smaller than a pixel still has
+  // an answer
+  for (i=0;i<n&&status==0;i++)
+  {
+    vl[i] = lon[i];
+    while (vl[i]<=-180.0) vl[i] += 360.0;
+    while (vl[i]>180.0) vl[i] -= 360.0;
+  }
+  if (status==0) status = querytopobatch(ctx,n,lat,vl,htrefflag,vt,vg,vd,geoidid);
+  for (i=0;i<n&&status==0;i++)
+    if (vd[i]!=DEM_NONE&&vt[i]!=-9999.0&&(*demid==DEM_NONE||vt[i]>*topo))
+    {
+      *topo = vt[i];
+      *toplat = lat[i];
+      *toplon = vl[i];
+      *demid = vd[i];
+    }
+
+  // Each DEM that could answer somewhere in the polygon
+  for (k=0;k<4&&status==0;k++)
+  {
+    status = maxtopoframe(ctx,products[k],np,plat,plon,pu,pv,hemi,htrefflag,&h,&hlat,&hlon);
+    if (status==0&&h!=-9999.0&&(*demid==DEM_NONE||h>*topo))
+    {
+      *topo = h;
+      *toplat = hlat;
+      *toplon = hlon;
+      *demid = products[k];
+    }
+  }
+
+  free(plat);
+  free(plon);
+  free(pu);
+  free(pv);
+  free(vl);
+  free(vt);
+  free(vg);
+  free(vd);
+  return(status);
+}
+
+
+long framepolygon(struct topocontext *ctx,const struct demframe *f,long np,const double *plat,
+                  const double *plon,const int *hemi,double *pu,double *pv)
+{
+  // The densified closed polygon plat,plon as pixel coordinates pu,pv of
+  // the grid of f (pixel centres on integers), returning the number of
+  // points.  pu and pv are of np+3 points.
+  long i,m;
+  struct psprojection ps[2];
+  void projectps(const struct psprojection *,long,const double *,const double *,double *,double *);
+
+  // Polar DEMs in their own stereographic projection
+  m = np;
+  if (f->demid!=DEM_GT3)
+  {
+    ps[0] = ps[1] = ctx->polar[f->south];
+    projectps(ps,np,plat,plon,pu,pv);
+  }
+
+  // GTOPO30 in lat/lon, with the longitudes unwrapped along the boundary.
+  // One that goes round a pole is closed along the pole's row.
+  else
+  {
+    pu[0] = plon[0];
+    for (i=1;i<m;i++)
+    {
+      pu[i] = plon[i];
+      while (pu[i]-pu[i-1]>180.0) pu[i] -= 360.0;
+      while (pu[i]-pu[i-1]<-180.0) pu[i] += 360.0;
+    }
+    for (i=0;i<m;i++) pv[i] = plat[i];
+    if (fabs(pu[m-1]-pu[0])>180.0)
+    {
+      pu[m] = pu[m-1];
+      pv[m] = (hemi[0]) ? 90.0 : -90.0;
+      pu[m+1] = pu[0];
+      pv[m+1] = pv[m];
+      pu[m+2] = pu[0];
+      pv[m+2] = pv[0];
+      m += 3;
+    }
+  }
+  for (i=0;i<m;i++)
+  {
+    pu[i] = (pu[i]-f->x0)/f->res-0.5;
+    pv[i] = (f->y0-pv[i])/f->res-0.5;
+  }
+  return(m);
+}
+
+
+int maxtopoframe(struct topocontext *ctx,int demid,long np,const double *plat,const double *plon,
+                 double *pu,double *pv,const int *hemi,int htrefflag,double *topo,double *toplat,double *toplon)
+{
+  // Highest pixel of one DEM in the densified closed polygon plat,plon,
+  // referenced as asked with the geoid at the pixel, or -9999 if none.
+  // pu and pv are work space of np+3 points.
+  char geoidid[10];
+  int s;
+  long i,m;
+  long long r,c;
+  double best,g,gsign;
+  float h;
+  struct demframe f;
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  long framepolygon(struct topocontext *,const struct demframe *,long,const double *,const double *,
+                    const int *,double *,double *);
+
+  *topo = -9999.0;
+  getdemframe(demid,&f);
+  if (demid!=DEM_GT3&&(ctx->datasets[demid].priority<=0||!hemi[f.south])) return(0);
+  best = -9999.0;
+  r = c = 0;
+
+  // Pixels are compared in the reference asked for
+  gsign = 0.0;
+  if (ctx->datasets[demid].geoidref&&htrefflag==2) gsign = 1.0;
+  if (!ctx->datasets[demid].geoidref&&htrefflag==1) gsign = -1.0;
+
+  // Each copy of the polygon 360 deg apart that meets GTOPO30 is searched
+  m = framepolygon(ctx,&f,np,plat,plon,hemi,pu,pv);
+  if (demid!=DEM_GT3)
+  {
+    if (searchpyramid(ctx,&f,pu,pv,m,gsign,&best,&r,&c)==-1) return(-1);
+  }
+  else
+  {
+    for (s=-2;s<=2;s++)
+    {
+      for (i=0;i<m;i++) pu[i] += s*(double)GT3NX;
+      if (searchpyramid(ctx,&f,pu,pv,m,gsign,&best,&r,&c)==-1) return(-1);
+      for (i=0;i<m;i++) pu[i] -= s*(double)GT3NX;
+    }
+  }
+  if (best==-9999.0) return(0);
+
+  // Position of the pixel and its height in the reference asked for, with
+  // the geoid at the pixel itself rather than interpolated along its row
+  if (demid!=DEM_GT3)
+    unprojectps(&ctx->polar[f.south],f.x0+(c+0.5)*f.res,f.y0-(r+0.5)*f.res,toplat,toplon);
+  else
+  {
+    *toplat = f.y0-(r+0.5)*f.res;
+    *toplon = f.x0+(c+0.5)*f.res;
+  }
+  if (gsign!=0.0)
+  {
+    querygeoidbatch(ctx,1,toplat,toplon,&g,geoidid);
+    if (readdemrow(ctx,&f,r,c,1,&h)==-1) return(0);
+    best = h+gsign*g;
+  }
+  if (!isnan(best)) *topo = best;
+  return(0);
+}
+
+
+int maxtopocorridor(struct topocontext *ctx,long n,const double *lat,const double *lon,double halfwidth,
+                    int htrefflag,double *topo,double *toplat,double *toplon,int *demid)
+{
+  // The corridor is a band around each leg, its sides the small circles
+  // halfwidth either side of the great circle, and a disc round each
+  // waypoint to fill the turns.  The highest terrain of the corridor is
+  // the highest of theirs.
+  int d;
+  long i,j,ns;
+  double a[3],b[3],nrm[3],e[3],nv[3],v[3],w,cw,sw,ca,sa,len,h,hlat,hlon;
+  double *plat,*plon,*dist;
+  void unitvector(double,double,double *);
+  void vectorlatlon(const double *,double *,double *);
+
+  *topo = -9999.0;
+  *toplat = *toplon = 0.0;
+  *demid = DEM_NONE;
+  w = halfwidth/(RAD2KM*1000.0);
+  cw = cos(w);
+  sw = sin(w);
+  for (i=0;i<n;i++)
+  {
+
+    // Disc round the waypoint, from its east and north directions
+    if ((plat=(double *)malloc(CORRIDORDISC*sizeof(double)))==NULL||
+        (plon=(double *)malloc(CORRIDORDISC*sizeof(double)))==NULL)
+    {
+      free(plat);
+      return(-1);
+    }
+    unitvector(lat[i],lon[i],a);
+    e[0] = -sin(lon[i]*PI/180.0);
+    e[1] = cos(lon[i]*PI/180.0);
+    e[2] = 0.0;
+    nv[0] = a[1]*e[2]-a[2]*e[1];
+    nv[1] = a[2]*e[0]-a[0]*e[2];
+    nv[2] = a[0]*e[1]-a[1]*e[0];
+    for (j=0;j<CORRIDORDISC;j++)
+    {
+      sincos(2.0*PI*j/CORRIDORDISC,&sa,&ca);
+      for (d=0;d<3;d++) v[d] = a[d]*cw+(nv[d]*ca+e[d]*sa)*sw;
+      vectorlatlon(v,&plat[j],&plon[j]);
+    }
+    j = maxtopo(ctx,CORRIDORDISC,plat,plon,htrefflag,&h,&hlat,&hlon,&d);
+    free(plat);
+    free(plon);
+    if (j==-1) return(-1);
+    if (d!=DEM_NONE&&(*demid==DEM_NONE||h>*topo))
+    {
+      *topo = h;
+      *toplat = hlat;
+      *toplon = hlon;
+      *demid = d;
+    }
+    if (i==n-1) break;
+
+    // Band along the leg to the next waypoint, its left side out and its
+    // right side back
+    if ((ns=greatcircle(lat[i],lon[i],lat[i+1],lon[i+1],DENSIFYSPACING,0,0,NULL,NULL,NULL))==-1) return(-1);
+    if (ns==0) continue;
+    plat = (double *)malloc(2*(ns+1)*sizeof(double));
+    plon = (double *)malloc(2*(ns+1)*sizeof(double));
+    dist = (double *)malloc((ns+1)*sizeof(double));
+    if (plat==NULL||plon==NULL||dist==NULL)
+    {
+      free(plat);
+      free(plon);
+      free(dist);
+      return(-1);
+    }
+    greatcircle(lat[i],lon[i],lat[i+1],lon[i+1],DENSIFYSPACING,0,ns,plat,plon,dist);
+    plat[ns] = lat[i+1];
+    plon[ns] = lon[i+1];
+    unitvector(lat[i],lon[i],a);
+    unitvector(lat[i+1],lon[i+1],b);
+    nrm[0] = a[1]*b[2]-a[2]*b[1];
+    nrm[1] = a[2]*b[0]-a[0]*b[2];
+    nrm[2] = a[0]*b[1]-a[1]*b[0];
+    len = sqrt(nrm[0]*nrm[0]+nrm[1]*nrm[1]+nrm[2]*nrm[2]);
+    for (j=ns;j>=0;j--)
+    {
+      unitvector(plat[j],plon[j],a);
+      for (d=0;d<3;d++) v[d] = a[d]*cw-nrm[d]/len*sw;
+      vectorlatlon(v,&plat[2*ns+1-j],&plon[2*ns+1-j]);
+      for (d=0;d<3;d++) v[d] = a[d]*cw+nrm[d]/len*sw;
+      vectorlatlon(v,&plat[j],&plon[j]);
+    }
+    j = maxtopo(ctx,2*(ns+1),plat,plon,htrefflag,&h,&hlat,&hlon,&d);
+    free(plat);
+    free(plon);
+    free(dist);
+    if (j==-1) return(-1);
+    if (d!=DEM_NONE&&(*demid==DEM_NONE||h>*topo))
+    {
+      *topo = h;
+      *toplat = hlat;
+      *toplon = hlon;
+      *demid = d;
+    }
+  }
+  return(0);
+}
+
+
+// Zonal statistics.  zonalstats visits every counting pixel of each DEM
+// inside a polygon, reading each row between pairs of edge crossings in
+// the DEM's pixel frame as maxtopo does, with bands of rows shared out to
+// threads.  The geoid and pixel area change slowly along a row, so they
+// are evaluated every ZONALNODE pixels and interpolated between.
+#define ZONALBAND 64           // rows a thread takes at a time
+#define ZONALCHUNK 4096        // pixels read at a time
+#define ZONALNODE 32           // pixels between geoid and area evaluations
+#define ZONALMAXTHREADS 256
+
+struct zonalband
+{
+  struct topocontext *ctx;
+  const struct demframe *f;
+  const double *pu,*pv;    // closed polygon in pixel coordinates
+  long np;
+  long long r1;            // one past the last row to scan
+  long long *nextrow;      // first row of the next band, shared by the threads
+  double gsign;            // times the geoid added to each height
+  double binmin,binwidth;
+  int nbins;
+  int status;              // -1 if out of memory
+  long long count;         // this thread's totals
+  double area,sum,min,max; // area in km2, sum of height times area
+  double *hist;            // area in km2 per height bin
+};
+
+
+void zonalspan(struct zonalband *zb,long long r,long long c,long len,float *row)
+{
+  // Adds the counting pixels c to c+len-1 of row r to the band's totals
+  char geoidid[10],counts[ZONALCHUNK];
+  long j,k,nn,pos[ZONALCHUNK/ZONALNODE+2];
+  double x,y,rho,s,cphi,e2,mn,t,h,w,g;
+  double nlat[ZONALCHUNK/ZONALNODE+2],nlon[ZONALCHUNK/ZONALNODE+2];
+  double ng[ZONALCHUNK/ZONALNODE+2],nw[ZONALCHUNK/ZONALNODE+2];
+  const struct demframe *f = zb->f;
+  const struct psprojection *ps;
+  void unprojectps(const struct psprojection *,double,double,double *,double *);
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+  void spancounts(struct topocontext *,const struct demframe *,long long,long long,long,char *);
+
+  if (readdemrow(zb->ctx,f,r,c,len,row)==-1) return;
+  for (j=0;j<len;j++) counts[j] = !(row[j]==-9999.0||isnan(row[j]));
+  spancounts(zb->ctx,f,r,c,len,counts);
+
+  // Position, area (km2) and geoid at the nodes, the first and last pixel
+  // and every ZONALNODE between.  A polar stereographic pixel covers
+  // (res/k)^2 of the ellipsoid, k the scale at its centre.
+  nn = (len-1+ZONALNODE-1)/ZONALNODE+1;
+  y = f->y0-(r+0.5)*f->res;
+  for (k=0;k<nn;k++)
+  {
+    pos[k] = (k*ZONALNODE<len) ? k*ZONALNODE : len-1;
+    x = f->x0+(c+pos[k]+0.5)*f->res;
+    if (f->south>=0)
+    {
+      ps = &zb->ctx->polar[f->south];
+      unprojectps(ps,x,y,&nlat[k],&nlon[k]);
+      e2 = ps->e*ps->e;
+      s = sin(nlat[k]*PI/180.0);
+      cphi = cos(nlat[k]*PI/180.0);
+      rho = sqrt(x*x+y*y);
+      t = (cphi>1.0e-12) ? rho*sqrt(1.0-e2*s*s)/(AE*cphi) : 1.0;
+      nw[k] = (t>0.0) ? f->res*f->res/(t*t)/1.0e6 : 0.0;
+    }
+    else
+    {
+      nlat[k] = y;
+      nlon[k] = x;
+      e2 = zb->ctx->polar[0].e*zb->ctx->polar[0].e;
+      s = sin(y*PI/180.0);
+      mn = AE*AE*(1.0-e2)/((1.0-e2*s*s)*(1.0-e2*s*s));
+      nw[k] = mn*cos(y*PI/180.0)*(f->res*PI/180.0)*(f->res*PI/180.0)/1.0e6;
+    }
+    ng[k] = 0.0;
+  }
+  if (zb->gsign!=0.0) querygeoidbatch(zb->ctx,nn,nlat,nlon,ng,geoidid);
+
+  // Each pixel with data that querytopo would answer from this DEM
+  for (j=0;j<len;j++)
+  {
+    if (!counts[j]) continue;
+    k = j/ZONALNODE;
+    if (k+1<nn)
+    {
+      t = (double)(j-pos[k])/(pos[k+1]-pos[k]);
+      g = ng[k]+t*(ng[k+1]-ng[k]);
+      w = nw[k]+t*(nw[k+1]-nw[k]);
+    }
+    else
+    {
+      g = ng[k];
+      w = nw[k];
+    }
+    h = row[j]+zb->gsign*g;
+    if (zb->count==0||h<zb->min) zb->min = h;
+    if (zb->count==0||h>zb->max) zb->max = h;
+    zb->count++;
+    zb->area += w;
+    zb->sum += h*w;
+    k = (long)floor((h-zb->binmin)/zb->binwidth);
+    if (k<0) k = 0;
+    if (k>zb->nbins-1) k = zb->nbins-1;
+    if (zb->nbins>0) zb->hist[k] += w;
+  }
+
+}
+
+
+void *zonalworker(void *arg)
+{
+  // Scans bands of rows of the polygon until none is left
+  long i,nx,len;
+  long long r,r0,a,b,c,cc;
+  double *xs;
+  float *row;
+  struct zonalband *zb = (struct zonalband *)arg;
+  long rowcrossings(long long,const double *,const double *,long,double *);
+
+  xs = (double *)malloc(zb->np*sizeof(double));
+  row = (float *)malloc(ZONALCHUNK*sizeof(float));
+  if (xs==NULL||row==NULL) zb->status = -1;
+  while (zb->status==0&&(r0=__atomic_fetch_add(zb->nextrow,ZONALBAND,__ATOMIC_RELAXED))<zb->r1)
+    for (r=r0;r<r0+ZONALBAND&&r<zb->r1;r++)
+    {
+      nx = rowcrossings(r,zb->pu,zb->pv,zb->np,xs);
+      for (i=0;i+1<nx;i+=2)
+      {
+        a = (long long)floor(xs[i])+1;
+        b = (long long)floor(xs[i+1]);
+
+        // GTOPO30 columns wrap round, a polar grid's are clipped to it
+        if (zb->f->south<0)
+        {
+          if (b-a+1>GT3NX) b = a+GT3NX-1;
+        }
+        else
+        {
+          if (a<0) a = 0;
+          if (b>zb->f->nx-1) b = zb->f->nx-1;
+        }
+        for (c=a;c<=b;c+=len)
+        {
+          len = (b-c+1<ZONALCHUNK) ? b-c+1 : ZONALCHUNK;
+          cc = c;
+          if (zb->f->south<0)
+          {
+            cc = ((c%GT3NX)+GT3NX)%GT3NX;
+            if (len>GT3NX-cc) len = GT3NX-cc;
+          }
+          zonalspan(zb,r,cc,len,row);
+        }
+      }
+    }
+  free(xs);
+  free(row);
+  return(NULL);
+
+}
+
+
+int zonalstats(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+               int nthreads,double binmin,double binwidth,int nbins,double *hist,struct zonalresult *zs)
+{
+  int k,j,status,hemi[2],started[ZONALMAXTHREADS];
+  long i,np,m;
+  long long r0,r1,nextrow,count;
+  double *plat,*plon,*pu,*pv,vmin,vmax,sum;
+  struct demframe f;
+  struct zonalband *zb;
+  pthread_t threads[ZONALMAXTHREADS];
+  static const int products[4] = {DEM_AD1,DEM_REP,DEM_REM,DEM_GT3};
+  long densifypolygon(long,const double *,const double *,double **,double **,int *);
+  long framepolygon(struct topocontext *,const struct demframe *,long,const double *,const double *,
+                    const int *,double *,double *);
+
+  memset(zs,0,sizeof(*zs));
+  zs->min = zs->max = zs->mean = -9999.0;
+  for (j=0;j<nbins;j++) hist[j] = 0.0;
+  if (nthreads<1) nthreads = 1;
+  if (nthreads>ZONALMAXTHREADS) nthreads = ZONALMAXTHREADS;
+  if (n<=0) return(0);
+  sum = 0.0;
+
+  // Work space, with room to close a polygon round a pole
+  np = densifypolygon(n,lat,lon,&plat,&plon,hemi);
+  pu = (double *)malloc((np+3)*sizeof(double));
+  pv = (double *)malloc((np+3)*sizeof(double));
+  zb = (struct zonalband *)calloc(nthreads,sizeof(struct zonalband));
+  status = (np==-1||pu==NULL||pv==NULL||zb==NULL) ? -1 : 0;
+  for (j=0;j<nthreads&&status==0;j++)
+    if ((zb[j].hist=(double *)malloc((nbins>0?nbins:1)*sizeof(double)))==NULL) status = -1;
+
+  // Each DEM that could answer somewhere in the polygon, over the rows it
+  // spans
+  for (k=0;k<4&&status==0;k++)
+  {
+    getdemframe(products[k],&f);
+    if (products[k]!=DEM_GT3&&(ctx->datasets[products[k]].priority<=0||!hemi[f.south])) continue;
+    m = framepolygon(ctx,&f,np,plat,plon,hemi,pu,pv);
+    vmin = DBL_MAX;
+    vmax = -DBL_MAX;
+    for (i=0;i<m;i++)
+    {
+      if (pv[i]<vmin) vmin = pv[i];
+      if (pv[i]>vmax) vmax = pv[i];
+    }
+    r0 = (vmin<0.0) ? 0 : (long long)ceil(vmin);
+    r1 = (vmax>f.ny-1) ? f.ny : (long long)floor(vmax)+1;
+    if (r1<=r0) continue;
+    nextrow = r0;
+    for (j=0;j<nthreads;j++)
+    {
+      zb[j].ctx = ctx;
+      zb[j].f = &f;
+      zb[j].pu = pu;
+      zb[j].pv = pv;
+      zb[j].np = m;
+      zb[j].r1 = r1;
+      zb[j].nextrow = &nextrow;
+      zb[j].gsign = 0.0;
+      if (ctx->datasets[products[k]].geoidref&&htrefflag==2) zb[j].gsign = 1.0;
+      if (!ctx->datasets[products[k]].geoidref&&htrefflag==1) zb[j].gsign = -1.0;
+      zb[j].binmin = binmin;
+      zb[j].binwidth = binwidth;
+      zb[j].nbins = nbins;
+      zb[j].count = 0;
+      zb[j].area = zb[j].sum = 0.0;
+      for (i=0;i<nbins;i++) zb[j].hist[i] = 0.0;
+    }
+    if (nthreads==1)
+      zonalworker(&zb[0]);
+    else
+    {
+      for (j=0;j<nthreads;j++)
+      {
+        started[j] = (pthread_create(&threads[j],NULL,zonalworker,&zb[j])==0);
+        if (!started[j]) zonalworker(&zb[j]);  // no thread available, do it here
+      }
+      for (j=0;j<nthreads;j++)
+        if (started[j]) pthread_join(threads[j],NULL);
+    }
+
+    // Merge the threads' totals
+    for (count=0,j=0;j<nthreads;j++)
+    {
+      if (zb[j].status==-1) status = -1;
+      if (zb[j].count==0) continue;
+      if (zs->count==0||zb[j].min<zs->min) zs->min = zb[j].min;
+      if (zs->count==0||zb[j].max>zs->max) zs->max = zb[j].max;
+      zs->count += zb[j].count;
+      zs->area += zb[j].area;
+      sum += zb[j].sum;
+      count += zb[j].count;
+      for (i=0;i<nbins;i++) hist[i] += zb[j].hist[i];
+    }
+    zs->demcount[products[k]] += count;
+  }
+  zs->mean = (zs->count>0&&zs->area>0.0) ? sum/zs->area : -9999.0;
+
+  free(plat);
+  free(plon);
+  free(pu);
+  free(pv);
+  for (j=0;j<nthreads&&zb!=NULL;j++) free(zb[j].hist);
+  free(zb);
+  return(status);
+}
+
+
+int setgeoidmemory(struct topocontext *ctx,long long bytes,int packed)
+{
+  long long i,n;
+  int r,c,status;
+  short stemp;
+  float *rowbuf;
+  struct gridfile *gf;
+  void byteswap(char *,char *,int);
+  void freegeoidmemory(struct topocontext *);
+
+  // Start over with nothing resident
+  freegeoidmemory(ctx);
+
+  // EGM96 is only 2 MB, so it is always kept, byteswapped once here
+  if ((gf=getgridfile(ctx,&ctx->geoidfiles[1],ctx->datasets[DS_E96].path,0,0))!=NULL)
+  {
+    n = (long long)EGM96NX*EGM96NY;
+    if ((ctx->egm96=(short *)malloc(n*sizeof(short)))==NULL) return(-1);
+    if (readgridfile(gf,0,ctx->egm96,n*sizeof(short))==-1)
+    {
+      free(ctx->egm96);
+      ctx->egm96 = NULL;
+    }
+    for (i=0;i<n&&ctx->egm96!=NULL;i++)
+    {
+      stemp = ctx->egm96[i];
+      byteswap((char *)&stemp,(char *)&ctx->egm96[i],2);
+    }
+  }
+
+  // EGM2008 is kept only if it fits the budget, in cm if packed
+  n = (long long)EGM08NX*EGM08NY;
+  if (bytes<n*(packed ? sizeof(short) : sizeof(float))) return(0);
+  if ((gf=getgridfile(ctx,&ctx->geoidfiles[0],ctx->datasets[DS_E08].path,0,0))==NULL) return(0);
+  if (packed)
+  {
+    rowbuf = (float *)malloc(EGM08NX*sizeof(float));
+    ctx->egm08cm = (short *)malloc(n*sizeof(short));
+    if (rowbuf==NULL||ctx->egm08cm==NULL)
+    {
+      free(rowbuf);
+      freegeoidmemory(ctx);
+      return(-1);
+    }
+  }
+  else if ((ctx->egm08=(float *)malloc(n*sizeof(float)))==NULL)
+  {
+    freegeoidmemory(ctx);
+    return(-1);
+  }
+
+  // Read the grid a row at a time, packing heights to the nearest cm.  The
+  // geoid is within +/-110 m everywhere, so a value that does not fit an
+  // int16 means this is not the grid we expect and it stays on file.
+  status = 0;
+  for (r=0;r<EGM08NY&&status==0;r++)
+  {
+    if (!packed)
+    {
+      status = readgridfile(gf,4LL*r*EGM08NX,ctx->egm08+(long long)r*EGM08NX,EGM08NX*sizeof(float));
+      continue;
+    }
+    status = readgridfile(gf,4LL*r*EGM08NX,rowbuf,EGM08NX*sizeof(float));
+    for (c=0;c<EGM08NX&&status==0;c++)
+    {
+      if (rowbuf[c]==-9999.0)
+        ctx->egm08cm[(long long)r*EGM08NX+c] = GEOIDCMNODATA;
+      else if (fabs(rowbuf[c])<327.0)
+        ctx->egm08cm[(long long)r*EGM08NX+c] = (short)lrint(rowbuf[c]*100.0);
+      else
+        status = -1;
+    }
+  }
+  if (packed) free(rowbuf);
+  if (status==-1)
+  {
+    free(ctx->egm08);
+    free(ctx->egm08cm);
+    ctx->egm08 = NULL;
+    ctx->egm08cm = NULL;
+  }
+  return(0);
+}
+
+
+void freegeoidmemory(struct topocontext *ctx)
+{
+  free(ctx->egm08);
+  free(ctx->egm08cm);
+  free(ctx->egm96);
+  ctx->egm08 = NULL;
+  ctx->egm08cm = NULL;
+  ctx->egm96 = NULL;
+}
+
+
+double querygeoid(struct topocontext *ctx,double lat, double lon, char *geoidid)
+{
+  double geoid;
+  void querygeoidbatch(struct topocontext *,long,const double *,const double *,double *,char *);
+
+  querygeoidbatch(ctx,1,&lat,&lon,&geoid,geoidid);
+  return(geoid);
+
+}
+
+
+void querygeoidbatch(struct topocontext *ctx,long n,const double *lat,const double *lon,double *geoid,
+                     char *geoidid)
+{
+  void queryegm96(struct topocontext *,long,const double *,const double *,double *);
+  void queryegm2008(struct topocontext *,long,const double *,const double *,double *);
+  
+  // EGM96 is our only available geoid currently
+  //if (1)
+  //{
+  //  strcpy(geoidid,"E96\0");
+  //  queryegm96(ctx,n,lat,lon,geoid);
+  //}
+
+  // Query the EGM2008 1'x1' geoid grid
+  if (1)
+  {
+    strcpy(geoidid,"E08\0");
+    queryegm2008(ctx,n,lat,lon,geoid);
+  }
+
+}
+
+
+
+void queryegm2008(struct topocontext *ctx,long n,const double *lat,const double *lon,double *p)
+{
+  long long nx,nxtg,ny,m1,m2,n1,n2,off[4*QBLOCK];
+  long i,k,m;
+  float q[4*QBLOCK];
+  struct geoidcm qcm[4*QBLOCK];
+  double x,x0,y0,rres,mdbl,u[QBLOCK],v[QBLOCK];
+  struct gridfile *gf;
+
+  // The EGM2008 geoid grid files are odd, and poorly documented.  After lots of trial
+  // and error I determined that the grid dimensions are 10801 rows by 21602 columns.
+  // The first and last columns are filled with 0s, padding I suppose.
+
+  // Define size of grid
+  x0 = 0.0;
+  y0 = 90.0;
+  nx = EGM08NX;
+  ny = EGM08NY;
+  rres = 60.0;
+
+  // Open EGM2008 geoid file if not already open, unless the grid is resident
+  gf = NULL;
+  if (ctx->egm08==NULL&&ctx->egm08cm==NULL&&
+      (gf=getgridfile(ctx,&ctx->geoidfiles[0],ctx->datasets[DS_E08].path,0,0))==NULL)
+  {
+    for (i=0;i<n;i++) p[i] = -9999.9;
+    return;
+  }
+
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+
+    // Determine row and column of surrounding grid cells.  For now, we
+    // ignore the padding columns at left and right, so the last column
+    // wraps around to the first.
+    nxtg = nx-2;
+    for (i=0;i<m;i++)
+    {
+      // Offset longitude to between 0 and 360
+      x = lon[k+i];
+      while (x<0.0) x+=360.0;
+      mdbl = (x-x0)*rres;
+      if (mdbl<0.0)
+      {
+        m1 = 0;
+        m2 = 0;
+        u[i] = NAN;
+      }
+      else if (mdbl>(nxtg-1))
+      {
+        m1 = nxtg-1;
+        m2 = 0;
+        u[i] = mdbl-m1;
+      }
+      else
+      {
+        m1 = (long long)mdbl;
+        m2 = m1+1;
+        u[i] = mdbl-m1;
+      }
+      v[i] = gridaxis((y0-lat[k+i])*rres,ny,&n1,&n2);
+      m1 += 1; // add the padding column
+      m2 += 1; // add the padding column
+      off[4*i] = n1*nx+m1;
+      off[4*i+1] = n1*nx+m2;
+      off[4*i+2] = n2*nx+m1;
+      off[4*i+3] = n2*nx+m2;
+    }
+
+    // Take the four surrounding pixels from the resident grid if loaded,
+    // otherwise the geoid file, and compute the geoid at the requested
+    // points by bilinear interpolation
+    if (ctx->egm08!=NULL)
+    {
+      for (i=0;i<4*m;i++) q[i] = ctx->egm08[off[i]];
+      bilinear<float,NODATA_FLAG>(m,q,u,v,p+k);
+    }
+    else if (ctx->egm08cm!=NULL)
+    {
+      for (i=0;i<4*m;i++) qcm[i].cm = ctx->egm08cm[off[i]];
+      bilinear<struct geoidcm,NODATA_FLAG>(m,qcm,u,v,p+k);
+    }
+    else
+    {
+      // From the file a point in the same cell as the one before takes
+      // its corners rather than reading them again
+      for (i=0;i<4*m;i++)
+      {
+        if (i>=4&&off[i]==off[i-4]) q[i] = q[i-4];
+        else if (readgridfile(gf,4*off[i],&q[i],4)==-1) q[i] = -9999.0;
+      }
+      bilinear<float,NODATA_FLAG>(m,q,u,v,p+k);
+    }
+  }
+
+}
+
+
+
+void queryegm96(struct topocontext *ctx,long n,const double *lat,const double *lon,double *p)
+{
+  short q[4*QBLOCK];
+  struct beint16 qbe[4*QBLOCK];
+  long long nx,ny,m1,m2,n1,n2,off[4*QBLOCK];
+  long i,k,m;
+  double x,x0,y0,rres,mdbl,u[QBLOCK],v[QBLOCK];
+  struct gridfile *gf;
+
+  // Define size of grid
+  x0 = 0.0;
+  y0 = 90.0;
+  nx = EGM96NX;
+  ny = EGM96NY;
+  rres = 4.0;
+
+  // Open EGM96 geoid file if not already open, unless the grid is resident
+  gf = NULL;
+  if (ctx->egm96==NULL&&(gf=getgridfile(ctx,&ctx->geoidfiles[1],ctx->datasets[DS_E96].path,0,0))==NULL)
+  {
+    for (i=0;i<n;i++) p[i] = -9999.9;
+    return;
+  }
+
+  for (k=0;k<n;k+=QBLOCK)
+  {
+    m = (n-k<QBLOCK) ? n-k : QBLOCK;
+
+    // Determine row and column of surrounding grid cells, the last column
+    // wrapping around to the first
+    for (i=0;i<m;i++)
+    {
+      // Offset longitude to between 0 and 360
+      x = lon[k+i];
+      while (x<0.0) x+=360.0;
+      mdbl = (x-x0)*rres;
+      if (mdbl<0.0)
+      {
+        m1 = 0;
+        m2 = 0;
+        u[i] = NAN;
+      }
+      else if (mdbl>(nx-1))
+      {
+        m1 = nx-1;
+        m2 = 0;
+        u[i] = mdbl-m1;
+      }
+      else
+      {
+        m1 = (long long)mdbl;
+        m2 = m1+1;
+        u[i] = mdbl-m1;
+      }
+      v[i] = gridaxis((y0-lat[k+i])*rres,ny,&n1,&n2);
+      off[4*i] = n1*nx+m1;
+      off[4*i+1] = n1*nx+m2;
+      off[4*i+2] = n2*nx+m1;
+      off[4*i+3] = n2*nx+m2;
+    }
+
+    // Take the four surrounding pixels from the resident grid if loaded,
+    // otherwise the geoid file, and compute the geoid at the requested
+    // points by bilinear interpolation
+    if (ctx->egm96!=NULL)
+    {
+      for (i=0;i<4*m;i++) q[i] = ctx->egm96[off[i]];
+      bilinear<short,NODATA_ZERO>(m,q,u,v,p+k);
+    }
+    else
+    {
+      for (i=0;i<4*m;i++)
+      {
+        if (i>=4&&off[i]==off[i-4]) qbe[i] = qbe[i-4];
+        else if (readgridfile(gf,2*off[i],&qbe[i],2)==-1) qbe[i].raw = BEINT16NODATA;
+      }
+      bilinear<struct beint16,NODATA_ZERO>(m,qbe,u,v,p+k);
+    }
+    for (i=0;i<m;i++) p[k+i] *= 0.01; // heights in database are in cm
+  }
+
+}
+
+
+void initpsprojection(struct psprojection *ps,double latts,double lonv,double k0,double a,double f)
+{
+  // Sets up a polar stereographic projection true to scale k0 at latitude
+  // latts (deg, negative for the south pole) about central meridian lonv
+  double e2,phic,tc,mc;
+
+  ps->sign = (latts<0.0) ? -1.0 : 1.0;
+  ps->lonv = ps->sign*lonv;
+  e2 = f*(2.0-f);
+  ps->e = sqrt(e2);
+  phic = ps->sign*latts*PI/180.0;
+  tc = tan(PI/4.0-phic/2.0)/pow((1.0-ps->e*sin(phic))/(1.0+ps->e*sin(phic)),ps->e/2.0);
+  mc = cos(phic)/sqrt(1.0-e2*sin(phic)*sin(phic));
+  ps->scale = a*k0*mc/tc;
+
+}
+
+
+void projectps(const struct psprojection *ps,long n,const double *lat,const double *lon,double *x,double *y)
+{
+  // Projects n points (deg) to polar stereographic x,y (m).  ps points to
+  // a north and a south projection, and each point uses the one for its
+  // own hemisphere.  Done a block at a time, first the sines and cosines,
+  // then the rest in a branch-free loop the compiler can vectorize.
+  long k,j,m;
+  int h;
+  double phi,lam;
+  double sphi[PSBLOCK],cphi[PSBLOCK],slam[PSBLOCK],clam[PSBLOCK],sign[PSBLOCK],scale[PSBLOCK];
+  void projectpsblock(long,double,const double *,const double *,const double *,const double *,
+                      const double *,const double *,double *,double *);
+
+  for (k=0;k<n;k+=PSBLOCK)
+  {
+    m = (n-k<PSBLOCK) ? n-k : PSBLOCK;
+    for (j=0;j<m;j++)
+    {
+      h = (lat[k+j]<0.0);
+      phi = ps[h].sign*lat[k+j]*(PI/180.0);
+      lam = (ps[h].sign*lon[k+j]-ps[h].lonv)*(PI/180.0);
+      sincos(phi,&sphi[j],&cphi[j]);
+      sincos(lam,&slam[j],&clam[j]);
+      sign[j] = ps[h].sign;
+      scale[j] = ps[h].scale;
+    }
+    projectpsblock(m,ps[0].e,sphi,cphi,slam,clam,sign,scale,x+k,y+k);
+  }
+
+}
+
+
+int projectpolar(struct topocontext *ctx,long n,const double *lat,const double *lon,double *x,double *y)
+{
+  projectps(ctx->polar,n,lat,lon,x,y);
+  return(0);
+}
+
+
+__attribute__((target_clones("avx512f","avx2","default")))
+void projectpsblock(long m,double e,const double *__restrict sphi,const double *__restrict cphi,
+                    const double *__restrict slam,const double *__restrict clam,const double *__restrict sign,
+                    const double *__restrict scale,double *__restrict x,double *__restrict y)
+{
+  // Snyder's t = tan(pi/4-phi/2)/((1-e sin phi)/(1+e sin phi))^(e/2), as
+  // cos phi/(1+sin phi)*exp(e atanh(e sin phi)).  e sin phi < 0.082 so
+  // short series give atanh and exp to full double precision, and cos
+  // phi/(1+sin phi) stays accurate right up to the pole.
+  long j;
+  double z,z2,w,t,rho;
+
+  for (j=0;j<m;j++)
+  {
+    z = e*sphi[j];
+    z2 = z*z;
+    w = e*z*(1.0+z2*(1.0/3.0+z2*(1.0/5.0+z2*(1.0/7.0+z2*(1.0/9.0+z2*(1.0/11.0+z2*(1.0/13.0+z2/15.0)))))));
+    t = cphi[j]/(1.0+sphi[j])*
+        (1.0+w*(1.0+w*(1.0/2.0+w*(1.0/6.0+w*(1.0/24.0+w*(1.0/120.0+w*(1.0/720.0+w/5040.0)))))));
+    rho = scale[j]*t;
+    x[j] = sign[j]*rho*slam[j];
+    y[j] = -sign[j]*rho*clam[j];
+  }
+
+}
+
+
+double greatcircledistance(double lat1,double lon1,double lat2,double lon2)
+{
+  double a[3],b[3],c[3];
+  void unitvector(double,double,double *);
+
+  // Angle between the two unit vectors, from the cross and dot products
+  // so it stays accurate for short and near antipodal legs alike
+  unitvector(lat1,lon1,a);
+  unitvector(lat2,lon2,b);
+  c[0] = a[1]*b[2]-a[2]*b[1];
+  c[1] = a[2]*b[0]-a[0]*b[2];
+  c[2] = a[0]*b[1]-a[1]*b[0];
+  return(atan2(sqrt(c[0]*c[0]+c[1]*c[1]+c[2]*c[2]),a[0]*b[0]+a[1]*b[1]+a[2]*b[2])*RAD2KM*1000.0);
+
+}
+
+
+long greatcircle(double lat1,double lon1,double lat2,double lon2,double spacing,
+                 long first,long max,double *lat,double *lon,double *dist)
+{
+  long i,j,nsamples;
+  double a[3],b[3],t[3],p[3],pt[3],d,ab,tn,delta,cd,sd,ca,sa;
+  void unitvector(double,double,double *);
+  void vectorlatlon(const double *,double *,double *);
+
+  // Number of samples, the end point belongs to the next leg
+  d = greatcircledistance(lat1,lon1,lat2,lon2);
+  nsamples = (long)ceil(d/spacing);
+  if (nsamples<=0) return(0);
+
+  // Unit vector along the leg at its start, perpendicular to the start
+  unitvector(lat1,lon1,a);
+  unitvector(lat2,lon2,b);
+  ab = a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+  for (i=0;i<3;i++) t[i] = b[i]-ab*a[i];
+  tn = sqrt(t[0]*t[0]+t[1]*t[1]+t[2]*t[2]);
+  if (tn<1e-12)
+  {
+    // No direction between the ends.  Antipodal ends are joined by any
+    // great circle, while ends a few um apart are one sample at the start.
+    if (ab<0.0) return(-1);
+    nsamples = 1;
+    tn = 1.0;
+  }
+  for (i=0;i<3;i++) t[i] /= tn;
+
+  // Rotate to the first sample wanted, then walk along the leg one
+  // spacing at a time, turning the point and its direction together by
+  // a fixed angle so each sample costs a few multiplies and no sines
+  if (max>nsamples-first) max = nsamples-first;
+  delta = spacing/(RAD2KM*1000.0);
+  sincos(first*delta,&sa,&ca);
+  sincos(delta,&sd,&cd);
+  for (i=0;i<3;i++)
+  {
+    p[i] = a[i]*ca+t[i]*sa;
+    pt[i] = t[i]*ca-a[i]*sa;
+  }
+  for (i=0;i<max;i++)
+  {
+    vectorlatlon(p,&lat[i],&lon[i]);
+    dist[i] = (first+i)*spacing;
+    for (j=0;j<3;j++)
+    {
+      a[j] = p[j]*cd+pt[j]*sd;
+      pt[j] = pt[j]*cd-p[j]*sd;
+      p[j] = a[j];
+    }
+  }
+  return(nsamples);
+
+}
+
+
+void unitvector(double lat,double lon,double *v)
+{
+  // Earth-centred unit vector of a point on a sphere
+  double slat,clat,slon,clon;
+
+  sincos(lat*PI/180.0,&slat,&clat);
+  sincos(lon*PI/180.0,&slon,&clon);
+  v[0] = clat*clon;
+  v[1] = clat*slon;
+  v[2] = slat;
+
+}
+
+
+void vectorlatlon(const double *v,double *lat,double *lon)
+{
+  // Latitude and longitude (deg) of an earth-centred vector
+  *lat = atan2(v[2],sqrt(v[0]*v[0]+v[1]*v[1]))*180.0/PI;
+  *lon = atan2(v[1],v[0])*180.0/PI;
+  if (*lon<=-180.0) *lon += 360.0;
+
+}
+
+
+void unprojectps(const struct psprojection *ps,double x,double y,double *lat,double *lon)
+{
+  // Inverse of projectps for one point of the projection ps.  The
+  // latitude is found from the conformal latitude chi by the series of
+  // Snyder's eq 3-5, good to well under a mm, rather than by iterating
+  // eq 7-9, which costs a pow per step.
+  double rho,chi,phi,e2,e4,e6,e8,s2,c2;
+
+  rho = sqrt(x*x+y*y);
+  chi = PI/2.0-2.0*atan(rho/ps->scale);
+  e2 = ps->e*ps->e;
+  e4 = e2*e2;
+  e6 = e4*e2;
+  e8 = e4*e4;
+  sincos(2.0*chi,&s2,&c2);
+  phi = chi+s2*((e2/2.0+5.0*e4/24.0+e6/12.0+13.0*e8/360.0)+
+                2.0*c2*(7.0*e4/48.0+29.0*e6/240.0+811.0*e8/11520.0)+
+                (4.0*c2*c2-1.0)*(7.0*e6/120.0+81.0*e8/1120.0)+
+                4.0*c2*(2.0*c2*c2-1.0)*(4279.0*e8/161280.0));
+  *lat = ps->sign*phi*180.0/PI;
+  *lon = ps->sign*(atan2(ps->sign*x,-ps->sign*y)*180.0/PI+ps->lonv);
+  while (*lon<=-180.0) *lon += 360.0;
+  while (*lon>180.0) *lon -= 360.0;
+
+}
+
+
+bool pointinpolygon(double x, double y,double xpoly[],double ypoly[],int npoly)
+{
+  int i,j=npoly-2;
+  bool oddnodes=false;
+
+  for (i=0; i<(npoly-1); i++) 
+  {
+    if (ypoly[i]<y && ypoly[j]>=y || ypoly[j]<y && ypoly[i]>=y) 
+    {
+      if (xpoly[i]+(y-ypoly[i])/(ypoly[j]-ypoly[i])*(xpoly[j]-xpoly[i])<x) 
+      {
+        oddnodes=!oddnodes; 
+      }
+    }
+    j=i; 
+  }
+
+  return(oddnodes);
+
+}
+
+
+void byteswap(char *in,char *out,int len)
+{
+  int i,len2;
+
+  len2 = len-1;
+  for (i=0;i<len;i++)
+  {
+    out[i]=in[len2-i];
+    //out[i] = in[i];
+  }
+
+}
+
@@ -0,0 +1,71 @@
+/*------------------------------------------------------------------------*
+ NAME:     pyramid.h
+
+ PURPOSE:  Layout of the min/max pyramid (.pyr) files written by
+           buildpyramid and read by libquerytopo.  A pyramid holds the
+           lowest and highest valid pixel of every base x base block of a
+           DEM grid at level 0, of every 2x2 group of level 0 entries at
+           level 1, and so on up to a single entry for the whole grid.  A
+           region query can then bound the terrain of a large area from a
+           few entries, and read full-resolution pixels only in the blocks
+           whose bound beats the best pixel found so far.
+
+           File layout, all values in native byte order:
+             struct pyramidheader               at offset 0
+             struct pyramidentry[levelnx*levelny] for each level in turn,
+                                                row-major, at offset[level]
+
+           Pixels are heights in the native reference of the DEM, with no
+           data (-9999) left out; GTOPO30 ocean counts as 0, as it does in
+           the point queries.  A block with no valid pixel has min > max.
+           A pyramid describes the DEM it was built from, so rebuild it
+           whenever the DEM is replaced.
+
+ DATE:     17 October 2026
+ *------------------------------------------------------------------------*/
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#define PYRAMIDMAGIC "QTPYRMD"  // 7 characters plus the terminating 0
+#define PYRAMIDVERSION 1
+#define PYRAMIDMAXLEVELS 32
+#define PYRAMIDDEFAULTBASE 32   // 32x32 pixel blocks at level 0
+
+struct pyramidheader
+{
+  char magic[8];           // PYRAMIDMAGIC
+  int version;             // PYRAMIDVERSION
+  int nx,ny;               // columns and rows of the DEM grid
+  int base;                // pixels on a side of a level 0 block
+  int nlevels;             // levels, the last a single entry
+  int spare;
+  long long offset[PYRAMIDMAXLEVELS];  // byte offset of each level
+  int levelnx[PYRAMIDMAXLEVELS];       // entries across each level
+  int levelny[PYRAMIDMAXLEVELS];       // entries down each level
+};
+
+struct pyramidentry
+{
+  float min;               // lowest valid pixel of the block
+  float max;               // highest valid pixel of the block
+};
+
+
+// Entries across and down each level of a pyramid of an nx by ny grid,
+// returning the number of levels
+static inline int pyramidlevels(int nx,int ny,int base,int *levelnx,int *levelny)
+{
+  int l;
+
+  levelnx[0] = (nx+base-1)/base;
+  levelny[0] = (ny+base-1)/base;
+  for (l=1;l<PYRAMIDMAXLEVELS&&(levelnx[l-1]>1||levelny[l-1]>1);l++)
+  {
+    levelnx[l] = (levelnx[l-1]+1)/2;
+    levelny[l] = (levelny[l-1]+1)/2;
+  }
+  return(l);
+}
+
+#endif
@@ -0,0 +1,203 @@
+/*------------------------------------------------------------------------*
+ NAME:     querytopo.h
+
+ PURPOSE:  Interface to libquerytopo, the topography and geoid queries
+           behind querytopo2.  A topocontext owns the open DEM and geoid
+           files and the settings used to read them.  Contexts are
+           independent of each other, and one context may be shared by
+           any number of threads once its settings are made.
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#ifndef QUERYTOPO_H
+#define QUERYTOPO_H
+
+// DEM products a topography height can come from
+enum demproduct
+{
+  DEM_NONE,  // no height, latitude out of bounds
+  DEM_GT3,   // GTOPO30, referenced to the geoid
+  DEM_BM2,   // Bedmap-2, referenced to the geoid
+  DEM_G90,   // GIMP90, referenced to the WGS-84 ellipsoid
+  DEM_AD1,   // ArcticDEM-100m, referenced to the WGS-84 ellipsoid
+  DEM_REP,   // REMA Peninsula-100m filled, referenced to the WGS-84 ellipsoid
+  DEM_REM,   // REMA-100m, referenced to the WGS-84 ellipsoid
+  NDEMPRODUCTS
+};
+
+struct topocontext;
+
+// Create a context with no files open, or NULL if out of memory.  Close it
+// with closetopocontext once no thread is using it.
+struct topocontext *inittopocontext();
+int closetopocontext(struct topocontext *ctx);
+
+// Read where the DEM and geoid files are and how they are used from a
+// dataset file, instead of the built-in settings.  With filename NULL
+// the file named by $QUERYTOPO_DATASETS is read, or if that is not set
+// /usr/local/share/dem/datasets.conf if it exists.  One dataset a line:
+//   <id> <priority> <datum> <path> [<x0> <y0> <res> <nx> <ny>]
+// where id is a DEM id (GT3, AD1, REP, ...) or geoid id (E08, E96), and -
+// keeps a built-in setting.  priority orders the polar DEMs covering a
+// point, lowest first, or is off to skip one; GTOPO30 is always the last
+// resort.  datum is geoid or ellipsoid, the reference of the heights.
+// path is the grid file, or the directory of the GTOPO30 tiles.  The grid
+// geometry, if given, must match the built-in one.  # starts a comment.
+// Must be called before the first query.  Returns -1 if the file cannot
+// be read, or the number of the first bad line, leaving the settings as
+// they were.
+int loaddatasets(struct topocontext *ctx,const char *filename);
+
+// Select how grid files are read, "mmap" (default) or "stdio".  Must be
+// called before the first query.  Returns -1 for an unknown backend.
+int setiobackend(struct topocontext *ctx,const char *name);
+
+// Keep up to bytes of the 100m polar DEMs (REMA, REMA Peninsula,
+// ArcticDEM) in memory as 256x256 pixel blocks, evicting the least
+// recently used block when full.  Pays off for along-track lines, where
+// thousands of consecutive points share blocks, less so for scattered
+// points.  0 (the default) turns the cache off.  Must be called before the
+// first query.  Returns -1 if out of memory.
+int setcachesize(struct topocontext *ctx,long long bytes);
+
+// Load the geoid grids into memory now, so geoid heights cost a few loads
+// rather than four reads each.  EGM96 (2 MB) is always loaded.  EGM2008
+// is loaded if it fits in bytes: 933 MB as float32, or 467 MB with
+// packed=1, which rounds heights to the nearest cm.  A grid that is not
+// loaded is read from file as before.  Must be called before the first
+// query.  Returns -1 if out of memory.
+int setgeoidmemory(struct topocontext *ctx,long long bytes,int packed);
+
+// Query the points of each batch grouped by DEM and ordered along a
+// Morton curve through the DEM's grid, so points close on the ground are
+// read together and the page and block caches get far more reuse on
+// scattered input.  Results are still returned in input order.  Off by
+// default.
+int setspatialsort(struct topocontext *ctx,int on);
+
+// Read the pre-referenced copies of the DEMs made by buildrefgrid in
+// place of the DEMs, where there are any, when heights are asked for
+// relative to the geoid or ellipsoid.  Each point then takes its height
+// and geoid height from the same reads, and the geoid grid is only read
+// for points no copy covers.  Geoid heights are those at the DEM's pixel
+// centres interpolated to the point, within a mm or so of the geoid
+// grid's own.  Off by default.
+int setprereferenced(struct topocontext *ctx,int on);
+
+// Block cache hits and misses so far
+int getcachestats(struct topocontext *ctx,long long *hits,long long *misses);
+
+// Topography at one point in the native reference of the DEM it came
+// from, with the 3-character DEM id in demid
+double querytopo(struct topocontext *ctx,double lat,double lon,char *demid);
+
+// Geoid height at one point, with the 3-character geoid id in geoidid
+double querygeoid(struct topocontext *ctx,double lat,double lon,char *geoidid);
+
+// Topography and geoid heights for n points.  Heights are relative to the
+// geoid (htrefflag=1), the WGS-84 ellipsoid (htrefflag=2) or the native
+// reference of each DEM (htrefflag=0).  demid gets an enum demproduct per
+// point.  Longitudes must be within (-180,180].  Returns -1 if out of memory.
+int querytopobatch(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+                   double *topo,double *geoid,int *demid,char *geoidid);
+
+// Polar stereographic x,y (m) of n points, each in the projection of the
+// polar DEMs of its hemisphere, as querytopobatch finds them.  For
+// checking the built-in projection against geod2ps (querytopobench -p).
+int projectpolar(struct topocontext *ctx,long n,const double *lat,const double *lon,double *x,double *y);
+
+// Regular output grids of resamplegrid, in lat/lon (deg) or in the polar
+// stereographic projection of ArcticDEM (north) or REMA (south) (m)
+enum gridprojection
+{
+  GRID_LATLON,
+  GRID_NORTH,
+  GRID_SOUTH
+};
+
+struct gridspec
+{
+  int proj;                // enum gridprojection
+  double x0,y0;            // x (lon) of the first column and y (lat) of the first row
+  double spacing;          // between nodes, rows going down (south) from y0
+  long nx,ny;              // columns and rows
+};
+
+// Topography at the nodes of rows row0 to row0+nrows-1 of a grid, nx
+// floats a row into topo, referenced as in querytopobatch, -9999 where
+// there is none.  Polar stereographic rows are read from the polar DEMs a
+// span at a time, with the geoid found only where the reference needs it.
+// Rows may be asked for in any order and from any number of threads.
+// Returns -1 if out of memory.
+int resamplegrid(struct topocontext *ctx,const struct gridspec *g,int htrefflag,long row0,long nrows,
+                 float *topo);
+
+// Great-circle distance in m between two points (deg), on a sphere of
+// one nautical mile per arc minute
+double greatcircledistance(double lat1,double lon1,double lat2,double lon2);
+
+// Samples every spacing m along the great circle from lat1,lon1 towards
+// lat2,lon2, for a terrain profile of a flight leg.  A leg has
+// ceil(distance/spacing) samples, the first at its start, and stops short
+// of its end, which starts the next leg.  Samples first to first+max-1
+// are written to lat, lon (within (-180,180]) and dist (m from the start),
+// so a long leg can be taken a block at a time.  Returns the number of
+// samples of the whole leg, or -1 if the ends are antipodal and the leg
+// is not defined.  Ends too close to give a direction are one sample.
+long greatcircle(double lat1,double lon1,double lat2,double lon2,double spacing,
+                 long first,long max,double *lat,double *lon,double *dist);
+
+// Highest terrain inside a polygon of n lat/lon vertices (deg), its edges
+// great circles, or within halfwidth m of a route of n waypoints.  Over
+// each DEM the pixels whose centres are inside count where querytopo
+// would answer from that DEM, as do the vertices themselves.  Pixels are
+// compared referenced as in querytopobatch, each with the geoid at its
+// centre, and the highest is returned with its position in toplat,toplon
+// and its DEM in demid
+// (DEM_NONE if there is no terrain).  A DEM with a pyramid made by
+// buildpyramid is bounded a block at a time and read at full resolution
+// only near the answer; one without is read wherever the polygon covers
+// it.  Returns -1 if out of memory or a leg has antipodal ends.
+int maxtopo(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+            double *topo,double *toplat,double *toplon,int *demid);
+int maxtopocorridor(struct topocontext *ctx,long n,const double *lat,const double *lon,double halfwidth,
+                    int htrefflag,double *topo,double *toplat,double *toplon,int *demid);
+
+// Terrain statistics over the pixels inside a polygon of n lat/lon
+// vertices (deg), its edges great circles.  A pixel counts where
+// maxtopo's would, its height referenced as in querytopobatch with the
+// geoid at the pixel.  The mean and the histogram weight each pixel by
+// its area on the ellipsoid, as the DEMs' pixels differ in size.  hist
+// gets the area in km2 of heights in each of nbins bins binwidth m wide
+// from binmin, heights beyond the ends going in the end bins.  The rows
+// are scanned by nthreads threads.  Returns -1 if out of memory.
+struct zonalresult
+{
+  long long count;                     // pixels inside
+  double area;                         // km2 they cover
+  double mean,min,max;                 // heights in m, -9999 if no pixels
+  long long demcount[NDEMPRODUCTS];    // pixels from each DEM
+};
+int zonalstats(struct topocontext *ctx,long n,const double *lat,const double *lon,int htrefflag,
+               int nthreads,double binmin,double binwidth,int nbins,double *hist,struct zonalresult *zs);
+
+// Write the min/max pyramid (see pyramid.h) of a DEM (DEM_GT3, DEM_AD1,
+// DEM_REP or DEM_REM) beside it, as the dataset settings place it:
+// <name>.pyr for a <name>.flt raster, gtopo30.pyr in the GTOPO30
+// directory.  base is the pixels on a side of the finest blocks.
+// Returns -1 if the DEM cannot be read or the pyramid written.
+int buildpyramid(struct topocontext *ctx,int demid,int base);
+
+// Write the pre-referenced copy (see refgrid.h) of a DEM (DEM_GT3,
+// DEM_AD1, DEM_REP or DEM_REM) beside it, as the dataset settings place
+// it: <name>.ref for a <name>.flt raster, <tile>.ref for each GTOPO30
+// tile there is.  The geoid is read as set up in the context, so load it
+// with setgeoidmemory first for speed.  Returns -1 if the DEM cannot be
+// read or the copy written.
+int buildrefgrid(struct topocontext *ctx,int demid);
+
+// 3-character id of a DEM product, as printed by querytopo2
+const char *demproductname(int demid);
+
+#endif
@@ -6,1399 +6,1082 @@
            User specifies whether topography should be returned relative
            to geoid or WGS-84 ellipsoid.  This is an evolution of the
            original querytopo.cpp, replacing Bedmap-2 and GIMP90 DEMS
-           with more modern REMA and ArcticDEM databases.
+           with more modern REMA and ArcticDEM databases.  The queries
+           themselves are in libquerytopo (see querytopo.h).
+
+           Besides the default text format, input and output can be
+           binary for bulk jobs, in native byte order:
+             -i bin    input is n float64 latitudes followed by n float64
+                       longitudes, read in place from a mapping of the file
+             -i binid  as bin, followed by n int64 point ids
+             -o bin    one 32-byte struct binresult per point, in input
+                       order, with the point id (the input id, or the
+                       0-based point number) and topo, geoid and product
+           A binary input file with a NaN or infinite coordinate is refused
+           before any point is queried.
+
+           Text input may be streamed, e.g. from a GPS decoder, by giving
+           - as the filename to read stdin.  Results are written as blocks
+           are done, so -n limits the points held back per block, and -t
+           writes whatever has arrived at most that many ms after the
+           first point of it.  -t 0 answers each line as soon as input
+           pauses, the default when stdin is a terminal.  Files stay open
+           and caches warm for the whole stream.
+
+           -s queries each block in space-filling-curve order through
+           each DEM's grid, for scattered input such as shuffled survey
+           grids.  Output is still in input order.
+
+           -v has the point and profile queries read the pre-referenced
+           DEM copies made by buildrefgrid, where there are any, so each
+           point's height and geoid height come from the same reads and
+           the geoid grid is left alone.
+
+           -p spacing makes a terrain profile of a route instead: each
+           input line is a waypoint (lat lon name), and every leg between
+           consecutive waypoints is sampled along its great circle every
+           spacing m, ending with the last waypoint.  Each output line
+           adds the distance in km from the first waypoint and the name of
+           the waypoint starting the leg.  Samples are queried in route
+           order, so consecutive ones share grid cells and blocks; with
+           the stdio backend -c keeps those blocks in memory.
+
+           -m poly finds the highest terrain inside the polygon whose
+           vertices are the input lines instead, and -m width the highest
+           within width m of the route, for each leg and then the whole
+           route.  Each answer is a line as above for the highest point,
+           route answers followed by the waypoint names of the leg or
+           "route".  DEMs with a pyramid made by buildpyramid are searched
+           a block at a time.
+
+           -z binwidth gives the statistics of the terrain inside the
+           polygon instead: pixels, area in km2 and the area-weighted mean,
+           lowest and highest height, then the pixels from each DEM, then
+           the area in km2 of each binwidth m height band from -500 to
+           9000 m that has any.  -j threads share out the rows.
+
+           -r latlon|north|south writes a regular grid of heights instead,
+           in lat/lon or the ArcticDEM (north) or REMA (south) polar
+           stereographic projection.  The input is one line
+             <min x> <min y> <max x> <max y> <spacing>
+           in deg (lon before lat) or m, and nodes run from min to max x
+           along each row and from max y down to min y.  The output is
+           the rows in turn as native float32 heights, -9999 for none,
+           written as each block of rows is done by the -j threads.
+
+           -d names a dataset file giving the DEM and geoid paths, datums
+           and priorities (see loaddatasets in querytopo.h), by default
+           $QUERYTOPO_DATASETS or /usr/local/share/dem/datasets.conf if
+           present, otherwise the built-in locations are used.
 
  AUTHOR:   John Gary Sonntag
 
  DATE:     24 March 2020
  *------------------------------------------------------------------------*/
 
-#include "/home/sonntag/Include/mission.h"
+#include "querytopo.h"
 #include <stdio.h>
-#include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <charconv>
+
+
+#define BATCHSIZE 4096  // input lines queried together by one worker
+#define READSIZE 1048576  // initial size of the text input buffer, grown for longer lines
+#define MAXLINELEN 2048  // room kept in an output buffer for one formatted line
+#define MAXTHREADS 256
+#define ZONALMIN -500.0   // height range of the -z histogram, m
+#define ZONALMAX 9000.0
+#define GRIDBLOCK 1048576  // nodes of -r output computed by one worker at a time
+
+#define FMT_TEXT 0
+#define FMT_BIN 1      // float64 lat and lon columns
+#define FMT_BINID 2    // float64 lat and lon columns, then an int64 id column
+
+// One block of input lines and its results, handled by one worker thread
+struct batchjob
+{
+  struct topocontext *ctx; // shared by all workers
+  long n;                  // number of points in the block
+  int htrefflag;           // 1=geoid 2=ellipsoid
+  int outfmt;              // FMT_TEXT or FMT_BIN
+  long long first;         // number of the first point of the block in the input
+  const double *latp;      // latitudes of the block, lat or the mapped input
+  const double *lonp;      // longitudes of the block, lon or the mapped input
+  const long long *idp;    // point ids from the mapped input, NULL if none
+  int profile;             // 1 for profile samples, with dist and wpname
+  double lat[BATCHSIZE];
+  double lon[BATCHSIZE];
+  double topo[BATCHSIZE];
+  double geoid[BATCHSIZE];
+  int demid[BATCHSIZE];
+  double dist[BATCHSIZE];  // profile distance from the first waypoint, km
+  char wpname[BATCHSIZE][10];  // profile waypoint starting the leg
+  char geoidid[10];
+  char *out;               // formatted output lines for the block
+  long outlen,outsize;
+  int status;              // 0 ok, -1 out of memory
+};
+
+// Text input, read in large chunks and split into lines in place
+struct linereader
+{
+  int fd;
+  char *buf;
+  long size;               // allocated bytes of buf
+  long len;                // bytes of input held in buf
+  long pos;                // start of the next line in buf
+  int eof;
+};
+
+// Route being sampled by -p, read a waypoint at a time
+struct profile
+{
+  double spacing;          // m between samples, 0 for no profile
+  int nwp;                 // waypoints read so far
+  double lat[2],lon[2];    // start and end of the current leg
+  char name[2][10];
+  double legstart;         // distance of the leg start from the first waypoint, m
+  double leglen;           // length of the leg, m
+  long nsamples,next;      // samples of the leg and the next one to query
+};
+
+// Block of rows of -r output, handled by one worker thread
+struct gridjob
+{
+  struct topocontext *ctx; // shared by all workers
+  const struct gridspec *g;
+  int htrefflag;           // 1=geoid 2=ellipsoid
+  long row0,nrows;         // rows of the block
+  float *out;              // their heights
+  int status;              // 0 ok, -1 out of memory
+};
+
+// Output record of -o bin
+struct binresult
+{
+  long long id;            // input id, or 0-based number of the point
+  double topo;             // topography, -9999 if out of bounds
+  double geoid;            // geoid height
+  int demid;               // enum demproduct, DEM_NONE if out of bounds
+  int spare;
+};
 
 
 main(int argc, char *argv[])
 {
-  char line[85],demid[10],wpname[10],geoidid[10];
-  int htrefflag;
-  double lat,lon,topo,geoid;
-  double querytopo(double,double,char *);
-  double querygeoid(double,double,char *);
-  int initquerytopo(),closequerytopo();
-  int initquerygeoid(),closequerygeoid();
+  char *line;
+  int htrefflag,opt,nthreads,njobs,done,flush,j,geoidpacked,infmt,outfmt,fd;
+  int blocksize,flushms,status;
+  int started[MAXTHREADS];
+  long i,len;
+  long long npts,next,deadline;
+  double lat,lon,geoidmb,halfwidth,binwidth;
+  int gridproj;
+  const char *dsfile;
+  const double *latcol,*loncol;
+  const long long *idcol;
+  void *map;
+  struct stat sb;
+  struct batchjob *jobs,*job;
+  struct linereader rd;
+  struct profile pf;
+  pthread_t threads[MAXTHREADS];
+  struct topocontext *ctx;
+  void *runbatchjob(void *);
+  long readline(struct linereader *,char **,long long);
+  long long nowms();
+  void parselatlon(const char *,const char *,double *,double *,char *);
+  double wraplon(double);
+  long readprofile(struct profile *,struct linereader *,struct batchjob *,long,long long *,int);
+  void runmaxtopo(struct topocontext *,struct linereader *,int,double);
+  void runzonalstats(struct topocontext *,struct linereader *,int,double,int);
+  void runresample(struct topocontext *,struct linereader *,int,int,int);
   FILE *fptr;
 
   // Check input
-  if (argc != 3)
-  {
-    printf("Usage: querytopo2 <latlon filename> <height ref (1=geoid 2=ellipsoid)>\n");
+  nthreads = 1;
+  blocksize = BATCHSIZE;
+  flushms = -1;
+  infmt = FMT_TEXT;
+  outfmt = FMT_TEXT;
+  if ((ctx=inittopocontext())==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+  geoidmb = -1.0;
+  geoidpacked = 0;
+  dsfile = NULL;
+  memset(&pf,0,sizeof(pf));
+  halfwidth = -2.0;  // no region query
+  binwidth = 0.0;    // no zonal statistics
+  gridproj = -1;     // no gridded output
+  while ((opt=getopt(argc,argv,"b:c:d:g:G:i:j:m:n:o:p:r:st:vz:"))!=-1)
+  {
+    if (opt=='b'&&setiobackend(ctx,optarg)==0) continue;
+    if (opt=='c'&&atof(optarg)>=0.0&&setcachesize(ctx,(long long)(atof(optarg)*1048576.0))==0) continue;
+    if (opt=='d') { dsfile = optarg; continue; }
+    if ((opt=='g'||opt=='G')&&(geoidmb=atof(optarg))>=0.0) { geoidpacked = (opt=='G'); continue; }
+    if (opt=='i'&&!strcmp(optarg,"text")) { infmt = FMT_TEXT; continue; }
+    if (opt=='i'&&!strcmp(optarg,"bin")) { infmt = FMT_BIN; continue; }
+    if (opt=='i'&&!strcmp(optarg,"binid")) { infmt = FMT_BINID; continue; }
+    if (opt=='j'&&(nthreads=atoi(optarg))>=1&&nthreads<=MAXTHREADS) continue;
+    if (opt=='m'&&!strcmp(optarg,"poly")) { halfwidth = -1.0; continue; }
+    if (opt=='m'&&(halfwidth=atof(optarg))>0.0) continue;
+    if (opt=='n'&&(blocksize=atoi(optarg))>=1&&blocksize<=BATCHSIZE) continue;
+    if (opt=='t'&&(flushms=atoi(optarg))>=0) continue;
+    if (opt=='o'&&!strcmp(optarg,"text")) { outfmt = FMT_TEXT; continue; }
+    if (opt=='o'&&!strcmp(optarg,"bin")) { outfmt = FMT_BIN; continue; }
+    if (opt=='p'&&(pf.spacing=atof(optarg))>0.0) continue;
+    if (opt=='r'&&!strcmp(optarg,"latlon")) { gridproj = GRID_LATLON; continue; }
+    if (opt=='r'&&!strcmp(optarg,"north")) { gridproj = GRID_NORTH; continue; }
+    if (opt=='r'&&!strcmp(optarg,"south")) { gridproj = GRID_SOUTH; continue; }
+    if (opt=='s'&&setspatialsort(ctx,1)==0) continue;
+    if (opt=='v'&&setprereferenced(ctx,1)==0) continue;
+    if (opt=='z'&&(binwidth=atof(optarg))>0.0) continue;
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind != 2||((pf.spacing>0.0||halfwidth>=-1.0||binwidth>0.0||gridproj>=0)&&infmt!=FMT_TEXT)||
+      (pf.spacing>0.0)+(halfwidth>=-1.0)+(binwidth>0.0)+(gridproj>=0)>1)
+  {
+    printf("Usage: querytopo2 [-b mmap|stdio] [-c cache MB] [-d dataset file] [-g|-G geoid MB] [-i text|bin|binid] [-j threads] [-m poly|width m] [-n points] [-o text|bin] [-p spacing m] [-r latlon|north|south] [-s] [-t ms] [-v] [-z bin width m] <latlon filename or -> <height ref (1=geoid 2=ellipsoid)>\n");
     exit(0);
   }
 
-  // Open the input file
-  if ((fptr=fopen(argv[1],"r"))==NULL)
+  // Open the input file, binary input is mapped and its columns used in place
+  fptr = NULL;
+  latcol = loncol = NULL;
+  idcol = NULL;
+  npts = 0;
+  if (!strcmp(argv[optind],"-"))
+  {
+    if (infmt!=FMT_TEXT)
+    {
+      printf("Binary input must be a file - exiting\n");
+      exit(-1);
+    }
+    fptr = stdin;
+    if (flushms<0&&isatty(fileno(stdin))) flushms = 0;  // someone is typing, answer each line
+  }
+  else if (infmt==FMT_TEXT&&(fptr=fopen(argv[optind],"r"))==NULL)
+  {
+    printf("Input file %s not found - exiting\n",argv[optind]);
+    exit(-1);
+  }
+  rd.fd = (fptr!=NULL) ? fileno(fptr) : -1;
+  rd.size = READSIZE;
+  rd.len = rd.pos = 0;
+  rd.eof = 0;
+  if (infmt==FMT_TEXT&&(rd.buf=(char *)malloc(rd.size))==NULL)
   {
-    printf("Input file %s not found - exiting\n",argv[1]);
+    printf("Out of memory - exiting\n");
     exit(-1);
   }
-  htrefflag = atoi(argv[2]);
+  if (infmt!=FMT_TEXT)
+  {
+    if ((fd=open(argv[optind],O_RDONLY))==-1||fstat(fd,&sb)==-1)
+    {
+      printf("Input file %s not found - exiting\n",argv[optind]);
+      exit(-1);
+    }
+    npts = sb.st_size/(infmt==FMT_BINID ? 24 : 16);
+    if (sb.st_size%(infmt==FMT_BINID ? 24 : 16))
+    {
+      printf("Input file %s is not whole binary columns - exiting\n",argv[optind]);
+      exit(-1);
+    }
+    if (npts>0)
+    {
+      if ((map=mmap(NULL,sb.st_size,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED)
+      {
+        printf("Cannot map input file %s - exiting\n",argv[optind]);
+        exit(-1);
+      }
+      madvise(map,sb.st_size,MADV_SEQUENTIAL);
+      latcol = (const double *)map;
+      loncol = latcol+npts;
+      if (infmt==FMT_BINID) idcol = (const long long *)(loncol+npts);
+
+      // Bulk files are checked up front, as a NaN or infinite value
+      // cannot be wrapped or queried
+      for (next=0;next<npts&&isfinite(latcol[next])&&isfinite(loncol[next]);next++);
+      if (next<npts)
+      {
+        printf("Point %lld of input file %s is not a finite lat/lon - exiting\n",next,argv[optind]);
+        exit(-1);
+      }
+    }
+    close(fd);
+  }
+  htrefflag = atoi(argv[optind+1]);
   if (htrefflag<1||htrefflag>2)
   {
     printf("Unrecognized height reference - exiting\n");
     exit(-1);
   }
 
-  // Loop over the input file entries
-  initquerygeoid();
-  initquerytopo();
-  while(fgets(line,85,fptr)!=NULL)
+  // Dataset locations, before any file is opened
+  if ((status=loaddatasets(ctx,dsfile))!=0)
   {
+    if (status==-1) printf("Cannot read dataset file - exiting\n");
+    else printf("Line %d of dataset file not understood - exiting\n",status);
+    exit(-1);
+  }
 
-    // Parse the input and ensure longitude is within bounds
-    sscanf(line,"%lf %lf %s",&lat,&lon,wpname);
-    while (lon<=-180.0) lon+=360.0;
-    while (lon>180.0) lon-=360.0;
+  // Load the geoid grids once up front if asked, -G packs EGM2008 in cm
+  if (geoidmb>=0.0&&setgeoidmemory(ctx,(long long)(geoidmb*1048576.0),geoidpacked)==-1)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
 
-    // Process the request if latitude is within bounds
-    if (lat>=-90.0&&lat<=90.0)
-    {
+  // One block of work per thread
+  if ((jobs=(struct batchjob *)calloc(nthreads,sizeof(struct batchjob)))==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
 
-      // Query the topo and geoid databases
-      topo = querytopo(lat,lon,demid);
-      geoid = querygeoid(lat,lon,geoidid);
+  // A region query answers for the whole input at once
+  if (halfwidth>=-1.0) runmaxtopo(ctx,&rd,htrefflag,halfwidth);
+  if (binwidth>0.0) runzonalstats(ctx,&rd,htrefflag,binwidth,nthreads);
+  if (gridproj>=0) runresample(ctx,&rd,htrefflag,gridproj,nthreads);
 
-      // Reference the topo heights according to request and native reference of database
-      if (!strncmp(demid,"GT3\0",3))  // GTOPO30 referenced to mean sea level (geoid)
-      {
-        if (htrefflag==2) topo = topo+geoid;
-        if (isnan(topo)) topo = -9999.0;
-      }
-      else if (!strncmp(demid,"BM2\0",3))  // BEDMAP2 referenced to geoid
+  // Loop over the input file, a block of entries per thread at a time
+  done = (halfwidth>=-1.0||binwidth>0.0||gridproj>=0);
+  next = 0;
+  while (!done)
+  {
+
+    // Parse the next blocks of input and ensure longitude is within bounds.
+    // When streaming, stop early once the first point has waited flushms.
+    njobs = 0;
+    flush = 0;
+    deadline = -1;
+    while (njobs<nthreads&&!done&&!flush)
+    {
+      job = &jobs[njobs++];
+      job->ctx = ctx;
+      job->n = 0;
+      job->htrefflag = htrefflag;
+      job->outfmt = outfmt;
+      job->first = next;
+      job->latp = job->lat;
+      job->lonp = job->lon;
+      job->idp = NULL;
+      job->profile = (pf.spacing>0.0);
+      if (job->profile)
       {
-        if (htrefflag==2) topo = topo+geoid;
-        if (isnan(topo)) topo = -9999.0;
+        len = readprofile(&pf,&rd,job,blocksize,&deadline,flushms);
+        if (len==-1) done = 1;
+        if (len==-2) flush = 1;
       }
-      else if (!strncmp(demid,"G90\0",3))  // GIMP90 referenced to WGS84 ellipsoid
+      else if (infmt==FMT_TEXT)
       {
-        if (htrefflag==1) topo = topo-geoid;
-        if (isnan(topo)) topo = -9999.0;
+        while (job->n<blocksize&&(len=readline(&rd,&line,deadline))>=0)
+        {
+          if (flushms>=0&&deadline<0) deadline = nowms()+flushms;
+          parselatlon(line,line+len,&lat,&lon,NULL);
+          lon = wraplon(lon);
+          job->lat[job->n] = lat;
+          job->lon[job->n] = lon;
+          job->n++;
+        }
+        if (len==-1) done = 1;
+        if (len==-2) flush = 1;
       }
-      else if (!strncmp(demid,"AD1\0",3))  // ArcticDEM referenced to WGS84 ellipsoid
+      else
       {
-        if (htrefflag==1) topo = topo-geoid;
-        if (isnan(topo)) topo = -9999.0;
+
+        // Binary columns are used where they lie unless a longitude
+        // needs wrapping, then the block's longitudes are copied
+        job->n = (npts-next<blocksize) ? npts-next : blocksize;
+        job->latp = latcol+next;
+        job->lonp = loncol+next;
+        if (idcol!=NULL) job->idp = idcol+next;
+        for (i=0;i<job->n&&job->lonp[i]>-180.0&&job->lonp[i]<=180.0;i++);
+        if (i<job->n)
+        {
+          for (i=0;i<job->n;i++) job->lon[i] = wraplon(job->lonp[i]);
+          job->lonp = job->lon;
+        }
+        if (next+job->n>=npts) done = 1;
       }
-      else if (!strncmp(demid,"REP\0",3))  // REMA Peninsula referenced to WGS84 ellipsoid
+      next += job->n;
+    }
+
+    // Query the topo and geoid databases, one block per worker thread
+    if (njobs==1)
+      runbatchjob(&jobs[0]);
+    else
+    {
+      for (j=0;j<njobs;j++)
       {
-        if (htrefflag==1) topo = topo-geoid;
-        if (isnan(topo)) topo = -9999.0;
+        started[j] = (pthread_create(&threads[j],NULL,runbatchjob,&jobs[j])==0);
+        if (!started[j]) runbatchjob(&jobs[j]);  // no thread available, do it here
       }
-      else if (!strncmp(demid,"REM\0",3))  // REMA referenced to WGS84 ellipsoid
+      for (j=0;j<njobs;j++)
+        if (started[j]) pthread_join(threads[j],NULL);
+    }
+
+    // Output the results in input order
+    for (j=0;j<njobs;j++)
+    {
+      if (jobs[j].status==-1)
       {
-        if (htrefflag==1) topo = topo-geoid;
-        if (isnan(topo)) topo = -9999.0;
+        printf("Out of memory - exiting\n");
+        exit(-1);
       }
-
-      // Output the result
-      printf("%8.4lf %9.4lf %8.2lf %3s %7.2lf %3s\n",lat,lon,topo,demid,geoid,geoidid);
-
+      fwrite(jobs[j].out,1,jobs[j].outlen,stdout);
     }
-
-    else
-      printf("latitude of %lf is out of bounds\n",lat);
+    fflush(stdout);
 
   }
 
   // Close the input file
-  closequerygeoid();
-  closequerytopo();
-  fclose(fptr);
-
-}
-
-
-#define EGM96PATH "/usr/local/share/geoid/egm96/WW15MGH.DAC\0"
-#define EGM08PATH "/usr/local/share/geoid/egm2008/Und_min1x1_egm2008_isw=82_WGS84_TideFree_SE\0"
-#define GTOPO30PATH "/usr/local/share/dem/gtopo30/\0"
-#define BEDMAP2PATH "/usr/local/share/dem/bedmap2/bedmap2_surface.flt\0"
-#define ARCTICDEM100PATH "/usr/local/share/dem/arcticdem100/arcticdem_mosaic_100m_v3.0.flt\0"
-#define REMP100PATH "/usr/local/share/dem/rema100/REMA_100m_peninsula_dem_filled.flt\0"
-#define REMA100PATH "/usr/local/share/dem/rema100/REMA_100m_dem.flt\0"
-#define GIMP90PATH "/usr/local/share/dem/gimp90/gimp90m.dem\0"
-#define C 299792458.0
-#define WE 7.292115147e-5
-#define MU 3.986005005e14
-#define PI (4.0*atan((double)(1.0)))
-#define AE 6378137.0
-#define FLAT (1.0/298.257223563)
-#define RAD2NM (180.0*60.0/PI)
-#define RAD2KM (RAD2NM*6076.1*12.0*2.54/100.0/1000.0)
-
-FILE *fptrdem;
-FILE *fptrgeoid;
-int opendem; // -1 nothing open
-             // 0-32 corresponding GTOPO30 tile file open
-             // 33 GIMP90 file open
-             // 34 Bedmap-2 file open
-             // 35 ArcticDEM-100m file open
-             // 36 REMA Peninsula-100m filled file open
-             // 37 REMA-100m file open
-int opengeoid; // -1 nothing open
-             // 0 EGM2008 open
-
-
-int initquerytopo()
-{
-  opendem = -1; // No DEM files are open at start
-}
-
-
-int closequerytopo()
-{
-  //printf("closing previously open DEM\n");
-  if (opendem!=-1) fclose(fptrdem);
-  opendem=-1;
-}
-
+  closetopocontext(ctx);
+  if (fptr!=NULL)
+  {
+    if (fptr!=stdin) fclose(fptr);
+    free(rd.buf);
+  }
+  if (latcol!=NULL) munmap(map,sb.st_size);
+  for (j=0;j<nthreads;j++) free(jobs[j].out);
+  free(jobs);
 
-int initquerygeoid()
-{
-  opengeoid = -1; // No geoid files are open at start
 }
 
 
-int closequerygeoid()
-{
-  //printf("closing previously open geoid\n");
-  if (opengeoid!=-1) fclose(fptrgeoid);
-  opengeoid=-1;
-}
 
 
-double querytopo(double lat, double lon, char *demid)
+void *runbatchjob(void *arg)
 {
-  int repflag,remflag;
-  double x,y,topo;
-  //int bm2flag,g90flag,ad1flag;
-  double rempx[5],rempy[5],remax[5],remay[5];
-  double querygtopo30(double, double);
-  double queryarcticdem100(double, double);
-  double queryremp(double, double);
-  double queryrema(double, double);
-  bool pointinpolygon(double,double,double *,double *,int);
-
-  // Define the REMA Peninsula (filled) boundary
-  rempx[0] = -2700000.0;  rempy[0] =  1800000.0;
-  rempx[1] = -1900000.0;  rempy[1] =  1800000.0;
-  rempx[2] = -1900000.0;  rempy[2] =   800000.0;
-  rempx[3] = -2700000.0;  rempy[3] =   800000.0;
-  rempx[4] = -2700000.0;  rempy[4] =  1800000.0;
-
-  // Define the REMA boundary
-  remax[0] = -2700000.0;  remay[0] =  2300000.0;
-  remax[1] =  2800000.0;  remay[1] =  2300000.0;
-  remax[2] =  2800000.0;  remay[2] = -2204200.0;
-  remax[3] = -2700000.0;  remay[3] = -2204200.0;
-  remax[4] = -2700000.0;  remay[4] =  2300000.0;
-
-  // Northern hemisphere
-  if (lat>=0.0)
-  {
-
-    // Try ArcticDEM-100m
-    geod2ps(lat,lon,70.0,-45.0,1.0,AE,FLAT,&x,&y);
-    strcpy(demid,"AD1\0");
-    topo = queryarcticdem100(x,y);  // answer is relative to the WGS-84 ellipsoid
-
-    // Go to GTOPO30 if ArcticDEM returns unknown
-    if (topo==-9999.0)
+  long i;
+  char *out;
+  struct binresult *res;
+  struct batchjob *job = (struct batchjob *)arg;
+  long putfixed(char *,double,int,int);
+  long putstring(char *,const char *,int);
+
+  // Query the topo and geoid databases, referencing the topo heights
+  // according to request and native reference of each database
+  job->outlen = 0;
+  job->status = querytopobatch(job->ctx,job->n,job->latp,job->lonp,job->htrefflag,
+                               job->topo,job->geoid,job->demid,job->geoidid);
+  if (job->status==-1) return(NULL);
+
+  // Binary output is one fixed-size record per point
+  if (job->outfmt==FMT_BIN)
+  {
+    if (job->outsize<(long)(BATCHSIZE*sizeof(struct binresult)))
     {
-      strcpy(demid,"GT3\0");
-      topo = querygtopo30(lat,lon);  // answer is relative to mean sea level
+      if ((out=(char *)realloc(job->out,BATCHSIZE*sizeof(struct binresult)))==NULL)
+      {
+        job->status = -1;
+        return(NULL);
+      }
+      job->out = out;
+      job->outsize = BATCHSIZE*sizeof(struct binresult);
     }
-
+    res = (struct binresult *)job->out;
+    for (i=0;i<job->n;i++)
+    {
+      res[i].id = (job->idp!=NULL) ? job->idp[i] : job->first+i;
+      res[i].topo = (job->demid[i]!=DEM_NONE) ? job->topo[i] : -9999.0;
+      res[i].geoid = job->geoid[i];
+      res[i].demid = job->demid[i];
+      res[i].spare = 0;
+    }
+    job->outlen = job->n*sizeof(struct binresult);
+    return(NULL);
   }
 
-  // Southern hemisphere
-  else
+  // Format the results, or note points whose latitude is out of bounds
+  // or whose position is not finite
+  for (i=0;i<job->n;i++)
   {
-
-    // Determine if input coords are within REMA-Peninsula or REMA limits
-    geod2ps(lat,lon,-71.0,0.0,1.0,AE,FLAT,&x,&y);
-    repflag = pointinpolygon(x,y,rempx,rempy,5);
-    remflag = pointinpolygon(x,y,remax,remay,5);
-    if (repflag)
+    if (job->outsize-job->outlen<MAXLINELEN)  // room for the longest line %lf can produce
     {
-      topo = queryremp(x,y);
-      strcpy(demid,"REP\0");      
+      if ((out=(char *)realloc(job->out,job->outsize+65536))==NULL)
+      {
+        job->status = -1;
+        return(NULL);
+      }
+      job->out = out;
+      job->outsize += 65536;
     }
-    else if (remflag)
+    out = job->out+job->outlen;
+    if (job->demid[i]!=DEM_NONE)
     {
-      topo = queryrema(x,y);
-      strcpy(demid,"REM\0");      
+      // Same bytes as "%8.4lf %9.4lf %8.2lf %3s %7.2lf %3s\n"
+      out += putfixed(out,job->latp[i],8,4);
+      *out++ = ' ';
+      out += putfixed(out,job->lonp[i],9,4);
+      *out++ = ' ';
+      out += putfixed(out,job->topo[i],8,2);
+      *out++ = ' ';
+      out += putstring(out,demproductname(job->demid[i]),3);
+      *out++ = ' ';
+      out += putfixed(out,job->geoid[i],7,2);
+      *out++ = ' ';
+      out += putstring(out,job->geoidid,3);
+      if (job->profile)
+      {
+        // Profile lines go on with " %9.3lf %s"
+        *out++ = ' ';
+        out += putfixed(out,job->dist[i],9,3);
+        *out++ = ' ';
+        out += putstring(out,job->wpname[i],0);
+      }
+      *out++ = '\n';
     }
-    else
+    else if (!isfinite(job->latp[i])||!isfinite(job->lonp[i]))
     {
-      topo = querygtopo30(lat,lon);
-      strcpy(demid,"GT3\0");      
+      // Same bytes as "position %lf %lf is not finite\n"
+      out += putstring(out,"position ",0);
+      out += putfixed(out,job->latp[i],0,6);
+      *out++ = ' ';
+      out += putfixed(out,job->lonp[i],0,6);
+      out += putstring(out," is not finite\n",0);
     }
-
-    // Query GTOPO30 if one of the REMAs returned a no data flag
-    if (topo==-9999.0&&(repflag||remflag))
+    else
     {
-      topo = querygtopo30(lat,lon);
-      strcpy(demid,"GT3\0");      
+      // Same bytes as "latitude of %lf is out of bounds\n"
+      out += putstring(out,"latitude of ",0);
+      out += putfixed(out,job->latp[i],0,6);
+      out += putstring(out," is out of bounds\n",0);
     }
-
+    job->outlen = out-job->out;
   }
-
-  // Return the result
-  return(topo);
+  return(NULL);
 
 }
 
 
-double queryremp(double x,double y)
+long readline(struct linereader *rd,char **line,long long deadline)
 {
-  long long int nx,ny,n1,n2,m1,m2;
-  long long int offsetq11,offsetq21,offsetq12,offsetq22;
-  float q11,q21,q12,q22;
-  double x0,y0,mdbl,ndbl,p,f1,f2,f3,f4,denom,x1,x2,y1,y2;
-
-  // Define size of grid
-  x0 =-2700000.0;
-  y0 = 1800000.0;
-  nx =  8000;
-  ny = 10000;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = (x-x0)/100.0-0.5;
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nx-1)) 
-  {
-    m1 = nx-1;
-    m2 = nx-1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/100.0-0.5;
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
-  {
-    n1 = ny-1;
-    n2 = ny-1;
-  }
-  else
-  {
-    n1 = int(ndbl);
-    n2 = n1+1;
-  }
-  offsetq11 = (long long)4*(n1*nx+m1);
-  offsetq21 = (long long)4*(n1*nx+m2);
-  offsetq12 = (long long)4*(n2*nx+m1);
-  offsetq22 = (long long)4*(n2*nx+m2);
-
-  // Open REMA Peninsula 100m Filled DEM file if not already open
-  if (opendem==-1)
-  {
-    if ((fptrdem=fopen(REMP100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 36;
-  }
-  else if (opendem!=36)
-  {
-    fclose(fptrdem);
-    if ((fptrdem=fopen(REMP100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 36;    
-  }
+  // Returns the length of the next input line and points line at it, NUL
+  // terminated in place of its newline, or returns -1 at end of input.
+  // With a deadline (nowms time, -1 for none), returns -2 if no whole line
+  // has arrived by then.
+  char *nl,*buf;
+  long len,n;
+  long long wait;
+  struct pollfd pfd;
+  long long nowms();
+
+  while (1)
+  {
+    if ((nl=(char *)memchr(rd->buf+rd->pos,'\n',rd->len-rd->pos))!=NULL||rd->eof)
+    {
+      if (nl==NULL)
+      {
+        if (rd->pos==rd->len) return(-1);
+        nl = rd->buf+rd->len;  // last line has no newline, there is always room after it
+      }
+      *nl = '\0';
+      *line = rd->buf+rd->pos;
+      len = nl-*line;
+      rd->pos = (nl-rd->buf<rd->len) ? nl-rd->buf+1 : rd->len;
+      return(len);
+    }
 
-  // Read the four surrounding pixels from the DEM file
-  fseek(fptrdem,offsetq11,SEEK_SET);
-  fread(&q11,4,1,fptrdem);
-  fseek(fptrdem,offsetq21,SEEK_SET);
-  fread(&q21,4,1,fptrdem);
-  fseek(fptrdem,offsetq12,SEEK_SET);
-  fread(&q12,4,1,fptrdem);
-  fseek(fptrdem,offsetq22,SEEK_SET);
-  fread(&q22,4,1,fptrdem);
-
-  // Compute terrain at requested lat/lon by bilinear interpolation
-  if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-    p = -9999.0;
-  else
-  {
-    x1 = x0+(m1+0.5)*100.0;
-    x2 = x0+(m2+0.5)*100.0;
-    y1 = y0-(n1+0.5)*100.0;
-    y2 = y0-(n2+0.5)*100.0;
-    denom = (x2-x1)*(y2-y1);
-    f1 = ((x2-x)*(y2-y))/denom;
-    f2 = ((x-x1)*(y2-y))/denom;
-    f3 = ((x2-x)*(y-y1))/denom;
-    f4 = ((x-x1)*(y-y1))/denom;
-    p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
+    // No whole line left, move the partial line to the front and read more,
+    // growing the buffer if one line fills it
+    memmove(rd->buf,rd->buf+rd->pos,rd->len-rd->pos);
+    rd->len -= rd->pos;
+    rd->pos = 0;
+    if (rd->len==rd->size-1)
+    {
+      if ((buf=(char *)realloc(rd->buf,2*rd->size))==NULL)
+      {
+        printf("Out of memory - exiting\n");
+        exit(-1);
+      }
+      rd->buf = buf;
+      rd->size *= 2;
+    }
+    if (deadline>=0)
+    {
+      wait = deadline-nowms();
+      pfd.fd = rd->fd;
+      pfd.events = POLLIN;
+      if (wait<0||poll(&pfd,1,wait)==0) return(-2);
+    }
+    n = read(rd->fd,rd->buf+rd->len,rd->size-1-rd->len);
+    if (n<=0) rd->eof = 1;
+    if (n>0) rd->len += n;
   }
-  return(p);
 
 }
 
 
-double queryrema(double x,double y)
+long readprofile(struct profile *pf,struct linereader *rd,struct batchjob *job,long blocksize,
+                 long long *deadline,int flushms)
 {
-  long long int nx,ny,n1,n2,m1,m2;
-  long long int offsetq11,offsetq21,offsetq12,offsetq22;
-  float q11,q21,q12,q22;
-  double x0,y0,mdbl,ndbl,p,f1,f2,f3,f4,denom,x1,x2,y1,y2;
-
-  // Define size of grid
-  x0 =-2700000.0;
-  y0 = 2300000.0;
-  nx = 55000;
-  ny = 45042;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = (x-x0)/100.0-0.5;
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nx-1)) 
-  {
-    m1 = nx-1;
-    m2 = nx-1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/100.0-0.5;
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
-  {
-    n1 = ny-1;
-    n2 = ny-1;
-  }
-  else
-  {
-    n1 = int(ndbl);
-    n2 = n1+1;
-  }
-  offsetq11 = (long long)4*(n1*nx+m1);
-  offsetq21 = (long long)4*(n1*nx+m2);
-  offsetq12 = (long long)4*(n2*nx+m1);
-  offsetq22 = (long long)4*(n2*nx+m2);
+  // Fills a block with the next samples of the route, reading waypoints
+  // as legs run out.  Returns 0 with the block full, -1 at the end of the
+  // route, its last waypoint included, or -2 if no waypoint arrived by the
+  // deadline (as readline).
+  char *line,name[10];
+  long i,m,len;
+  double lat,lon;
+  long long nowms();
+  long readline(struct linereader *,char **,long long);
+  void parselatlon(const char *,const char *,double *,double *,char *);
+  double wraplon(double);
+
+  while (job->n<blocksize)
+  {
+
+    // Samples of the current leg, generated straight into the block
+    if (pf->next<pf->nsamples)
+    {
+      m = (pf->nsamples-pf->next<blocksize-job->n) ? pf->nsamples-pf->next : blocksize-job->n;
+      greatcircle(pf->lat[0],pf->lon[0],pf->lat[1],pf->lon[1],pf->spacing,pf->next,m,
+                  job->lat+job->n,job->lon+job->n,job->dist+job->n);
+      for (i=job->n;i<job->n+m;i++)
+      {
+        job->dist[i] = (pf->legstart+job->dist[i])/1000.0;
+        strcpy(job->wpname[i],pf->name[0]);
+      }
+      job->n += m;
+      pf->next += m;
+      continue;
+    }
 
-  // Open REMA 100m DEM file if not already open
-  if (opendem==-1)
-  {
-    if ((fptrdem=fopen(REMA100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 37;
-  }
-  else if (opendem!=37)
-  {
-    fclose(fptrdem);
-    if ((fptrdem=fopen(REMA100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 37;    
+    // The next waypoint ends a new leg, or the route ends at the last one
+    if ((len=readline(rd,&line,*deadline))==-2) return(-2);
+    if (len==-1)
+    {
+      if (pf->nwp>0)
+      {
+        job->lat[job->n] = pf->lat[1];
+        job->lon[job->n] = pf->lon[1];
+        job->dist[job->n] = (pf->legstart+pf->leglen)/1000.0;
+        strcpy(job->wpname[job->n],pf->name[1]);
+        job->n++;
+      }
+      return(-1);
+    }
+    if (flushms>=0&&*deadline<0) *deadline = nowms()+flushms;
+    lat = lon = 0.0;
+    parselatlon(line,line+len,&lat,&lon,name);
+    if (!(lat>=-90.0&&lat<=90.0))
+    {
+      printf("Waypoint latitude of %lf is out of bounds - exiting\n",lat);
+      exit(-1);
+    }
+    if (!isfinite(lon))
+    {
+      printf("Waypoint longitude of %lf is not finite - exiting\n",lon);
+      exit(-1);
+    }
+    lon = wraplon(lon);
+    pf->lat[0] = pf->lat[1];
+    pf->lon[0] = pf->lon[1];
+    strcpy(pf->name[0],pf->name[1]);
+    pf->lat[1] = lat;
+    pf->lon[1] = lon;
+    strcpy(pf->name[1],name);
+    if (pf->nwp++==0) continue;
+    pf->legstart += pf->leglen;
+    pf->leglen = greatcircledistance(pf->lat[0],pf->lon[0],lat,lon);
+    pf->next = 0;
+    if ((pf->nsamples=greatcircle(pf->lat[0],pf->lon[0],lat,lon,pf->spacing,0,0,NULL,NULL,NULL))==-1)
+    {
+      printf("Leg from %lf %lf to %lf %lf has antipodal ends - exiting\n",pf->lat[0],pf->lon[0],lat,lon);
+      exit(-1);
+    }
   }
+  return(0);
 
-  // Read the four surrounding pixels from the DEM file
-  fseek(fptrdem,offsetq11,SEEK_SET);
-  fread(&q11,4,1,fptrdem);
-  fseek(fptrdem,offsetq21,SEEK_SET);
-  fread(&q21,4,1,fptrdem);
-  fseek(fptrdem,offsetq12,SEEK_SET);
-  fread(&q12,4,1,fptrdem);
-  fseek(fptrdem,offsetq22,SEEK_SET);
-  fread(&q22,4,1,fptrdem);
-
-  // Compute terrain at requested lat/lon by bilinear interpolation
-  if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-    p = -9999.0;
-  else
-  {
-    x1 = x0+(m1+0.5)*100.0;
-    x2 = x0+(m2+0.5)*100.0;
-    y1 = y0-(n1+0.5)*100.0;
-    y2 = y0-(n2+0.5)*100.0;
-    denom = (x2-x1)*(y2-y1);
-    f1 = ((x2-x)*(y2-y))/denom;
-    f2 = ((x-x1)*(y2-y))/denom;
-    f3 = ((x2-x)*(y-y1))/denom;
-    f4 = ((x-x1)*(y-y1))/denom;
-    p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
+}
+
+
+long readvertices(struct linereader *rd,double **plat,double **plon,char (**pnames)[10])
+{
+  // Reads every input line as a polygon vertex or route waypoint
+  // (lat lon name) into arrays allocated here, returning their number
+  char *line,(*names)[10];
+  long n,size,len;
+  double *lat,*lon;
+  long readline(struct linereader *,char **,long long);
+  void parselatlon(const char *,const char *,double *,double *,char *);
+
+  n = size = 0;
+  lat = lon = NULL;
+  names = NULL;
+  while ((len=readline(rd,&line,-1))>=0)
+  {
+    if (n==size)
+    {
+      size = 2*size+256;
+      lat = (double *)realloc(lat,size*sizeof(double));
+      lon = (double *)realloc(lon,size*sizeof(double));
+      names = (char (*)[10])realloc(names,size*sizeof(*names));
+      if (lat==NULL||lon==NULL||names==NULL)
+      {
+        printf("Out of memory - exiting\n");
+        exit(-1);
+      }
+    }
+    lat[n] = lon[n] = 0.0;
+    parselatlon(line,line+len,&lat[n],&lon[n],names[n]);
+    if (!(lat[n]>=-90.0&&lat[n]<=90.0))
+    {
+      printf("Vertex latitude of %lf is out of bounds - exiting\n",lat[n]);
+      exit(-1);
+    }
+    if (!isfinite(lon[n]))
+    {
+      printf("Vertex longitude of %lf is not finite - exiting\n",lon[n]);
+      exit(-1);
+    }
+    n++;
   }
-  return(p);
+  *plat = lat;
+  *plon = lon;
+  *pnames = names;
+  return(n);
 
 }
 
 
-double querygimp90(double x,double y)
+void runmaxtopo(struct topocontext *ctx,struct linereader *rd,int htrefflag,double halfwidth)
 {
-  short sdtemp,q11,q21,q12,q22;
-  int nx,ny,m1,m2,n1,n2;
-  long int offsetq11,offsetq21,offsetq12,offsetq22;
-  double x0,y0,mdbl,ndbl;
-  double x1,x2,y1,y2,denom,f1,f2,f3,f4,p;
-  void byteswap(char *,char *,int);
-
-  // Define size of grid
-  x0 =-639955.0;
-  y0 =-655595.0;
-  nx = 16620;
-  ny = 30000;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = (x-x0)/90.0-0.5;
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nx-1)) 
-  {
-    m1 = nx-1;
-    m2 = nx-1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/90.0-0.5;
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
+  // Reads every input line as a polygon vertex (halfwidth -1) or route
+  // waypoint and prints the highest terrain of the polygon, or of the
+  // corridor round each leg and then the whole route
+  char (*names)[10];
+  long n,i;
+  int demid,status;
+  double *lat,*lon,topo,toplat,toplon,rtopo,rlat,rlon;
+  int rdemid;
+  long readvertices(struct linereader *,double **,double **,char (**)[10]);
+  void printmaxtopo(struct topocontext *,double,double,double,int,const char *,const char *);
+
+  n = readvertices(rd,&lat,&lon,&names);
+
+  // The polygon, or each leg then the route
+  if (halfwidth<0.0)
   {
-    n1 = ny-1;
-    n2 = ny-1;
+    status = maxtopo(ctx,n,lat,lon,htrefflag,&topo,&toplat,&toplon,&demid);
+    if (status==0) printmaxtopo(ctx,topo,toplat,toplon,demid,NULL,NULL);
   }
   else
   {
-    n1 = int(ndbl);
-    n2 = n1+1;
-  }
-  offsetq11 = 2*(n1*nx+m1);
-  offsetq21 = 2*(n1*nx+m2);
-  offsetq12 = 2*(n2*nx+m1);
-  offsetq22 = 2*(n2*nx+m2);
-  //printf("x: %lf  y: %lf\n",x,y);
-  //printf("ncols: %d  nrows: %d\n",nx,ny);
-  //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-  //printf("m1: %d  m2:%d\n",m1,m2);
-  //printf("n1: %d  n2: %d\n",n1,n2);
-  //printf("offsetq11=%ld  offsetq21=%ld\n",offsetq11,offsetq21);
-  //printf("offsetq12=%ld  offsetq22=%ld\n",offsetq12,offsetq22);
-
-  // Open GIMP90m DEM file if not already open
-  if (opendem==-1)
-  {
-    //printf("no DEM open, opening GIMP90 DEM file\n");
-    if ((fptrdem=fopen(GIMP90PATH,"r"))==NULL) return(-9999.9);
-    opendem = 33;
+    rdemid = DEM_NONE;
+    rtopo = rlat = rlon = 0.0;
+    status = 0;
+    for (i=0;i+1<n&&status==0;i++)
+    {
+      status = maxtopocorridor(ctx,2,lat+i,lon+i,halfwidth,htrefflag,&topo,&toplat,&toplon,&demid);
+      if (status!=0) break;
+      printmaxtopo(ctx,topo,toplat,toplon,demid,names[i],names[i+1]);
+      if (demid!=DEM_NONE&&(rdemid==DEM_NONE||topo>rtopo))
+      {
+        rtopo = topo;
+        rlat = toplat;
+        rlon = toplon;
+        rdemid = demid;
+      }
+    }
+    if (n==1) status = maxtopocorridor(ctx,1,lat,lon,halfwidth,htrefflag,&rtopo,&rlat,&rlon,&rdemid);
+    if (status==0) printmaxtopo(ctx,rtopo,rlat,rlon,rdemid,"route",NULL);
   }
-  else if (opendem!=33)
+  if (status!=0)
   {
-    //printf("closing previously open DEM, opening GIMP90 DEM file\n");
-    fclose(fptrdem);
-    if ((fptrdem=fopen(GIMP90PATH,"r"))==NULL) return(-9999.9);
-    opendem = 33;    
+    printf("Out of memory or antipodal leg - exiting\n");
+    exit(-1);
   }
-
-  // Read the four surrounding pixels from the DEM file
-  fseek(fptrdem,offsetq11,SEEK_SET);
-  fread(&q11,2,1,fptrdem);
-  if (q11==-9999.0) q11 = 0.0;
-  fseek(fptrdem,offsetq21,SEEK_SET);
-  fread(&q21,2,1,fptrdem);
-  if (q21==-9999.0) q21 = 0.0;
-  fseek(fptrdem,offsetq12,SEEK_SET);
-  fread(&q12,2,1,fptrdem);
-  if (q12==-9999.0) q12 = 0.0;
-  fseek(fptrdem,offsetq22,SEEK_SET);
-  fread(&q22,2,1,fptrdem);
-  if (q22==-9999.0) q22 = 0.0;
-  //printf("q11 = %d  q21 = %d\n",q11,q21);
-  //printf("q12 = %d  q22 = %d\n",q12,q22);
-
-  // Compute terrain at requested lat/lon by bilinear interpolation
-  x1 = x0+(m1+0.5)*90.0;
-  x2 = x0+(m2+0.5)*90.0;
-  y1 = y0-(n1+0.5)*90.0;
-  y2 = y0-(n2+0.5)*90.0;
-  //printf("x1 = %lf  x2 = %lf\n",x1,x2);
-  //printf("y1 = %lf  y2 = %lf\n",y1,y2);
-  denom = (x2-x1)*(y2-y1);
-  f1 = ((x2-x)*(y2-y))/denom;
-  f2 = ((x-x1)*(y2-y))/denom;
-  f3 = ((x2-x)*(y-y1))/denom;
-  f4 = ((x-x1)*(y-y1))/denom;
-  p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
-  return(p);
+  free(lat);
+  free(lon);
+  free(names);
 
 }
 
 
-double querybedmap2(double x,double y)
+void runzonalstats(struct topocontext *ctx,struct linereader *rd,int htrefflag,double binwidth,
+                   int nthreads)
 {
-  int nx,ny,m1,m2,n1,n2;
-  long int offsetq11,offsetq21,offsetq12,offsetq22;
-  float q11,q21,q12,q22;
-  double x0,y0,mdbl,ndbl,x1,x2,y1,y2,denom,f1,f2,f3,f4,p;
-  void byteswap(char *,char *,int);
-
-  // Define size of grid
-  x0 =-3333500.0;
-  y0 = 3333500.0;
-  nx = 6667;
-  ny = 6667;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = (x-x0)/1000.0-0.5;
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nx-1)) 
-  {
-    m1 = nx-1;
-    m2 = nx-1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/1000.0-0.5;
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
-  {
-    n1 = ny-1;
-    n2 = ny-1;
-  }
-  else
-  {
-    n1 = int(ndbl);
-    n2 = n1+1;
-  }
-  offsetq11 = 4*(n1*nx+m1);
-  offsetq21 = 4*(n1*nx+m2);
-  offsetq12 = 4*(n2*nx+m1);
-  offsetq22 = 4*(n2*nx+m2);
-  //printf("ncols: %d  nrows: %d\n",nx,ny);
-  //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-  //printf("m1: %d  m2:%d\n",m1,m2);
-  //printf("n1: %d  n2: %d\n",n1,n2);
-  //printf("offsetq11=%ld  offsetq21=%ld\n",offsetq11,offsetq21);
-  //printf("offsetq12=%ld  offsetq22=%ld\n",offsetq12,offsetq22);
-
-  // Open BEDMAP-2 DEM file if not already open
-  if (opendem==-1)
-  {
-    //printf("no DEM open, opening Bedmap-2 DEM file\n");
-    if ((fptrdem=fopen(BEDMAP2PATH,"r"))==NULL) return(-9999.9);
-    opendem = 34;
-  }
-  else if (opendem!=34)
-  {
-    //printf("closing previously open DEM, opening Bedmap-2 DEM file\n");
-    fclose(fptrdem);
-    if ((fptrdem=fopen(BEDMAP2PATH,"r"))==NULL) return(-9999.9);
-    opendem = 34;    
+  // Reads every input line as a polygon vertex and prints the statistics
+  // of the terrain inside
+  char (*names)[10];
+  int k;
+  long n,nbins;
+  double *lat,*lon,*hist;
+  struct zonalresult zs;
+  long readvertices(struct linereader *,double **,double **,char (**)[10]);
+
+  n = readvertices(rd,&lat,&lon,&names);
+  nbins = (long)ceil((ZONALMAX-ZONALMIN)/binwidth);
+  if ((hist=(double *)malloc(nbins*sizeof(double)))==NULL||
+      zonalstats(ctx,n,lat,lon,htrefflag,nthreads,ZONALMIN,binwidth,nbins,hist,&zs)!=0)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
   }
-
-  // Read the four surrounding pixels from the DEM file
-  fseek(fptrdem,offsetq11,SEEK_SET);
-  fread(&q11,4,1,fptrdem);
-  //if (q11==-9999.0) q11 = 0.0;
-  fseek(fptrdem,offsetq21,SEEK_SET);
-  fread(&q21,4,1,fptrdem);
-  //if (q21==-9999.0) q21 = 0.0;
-  fseek(fptrdem,offsetq12,SEEK_SET);
-  fread(&q12,4,1,fptrdem);
-  //if (q12==-9999.0) q12 = 0.0;
-  fseek(fptrdem,offsetq22,SEEK_SET);
-  fread(&q22,4,1,fptrdem);
-  //if (q22==-9999.0) q22 = 0.0;
-  //printf("q11 = %f  q21 = %f\n",q11,q21);
-  //printf("q12 = %f  q22 = %f\n",q12,q22);
-
-  // Compute terrain at requested lat/lon by bilinear interpolation
-  if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-    p = -9999.0;
+  if (zs.count==0)
+    printf("no terrain\n");
   else
   {
-    x1 = x0+(m1+0.5)*1000.0;
-    x2 = x0+(m2+0.5)*1000.0;
-    y1 = y0-(n1+0.5)*1000.0;
-    y2 = y0-(n2+0.5)*1000.0;
-    //printf("x1 = %lf  x2 = %lf\n",x1,x2);
-    //printf("y1 = %lf  y2 = %lf\n",y1,y2);
-    denom = (x2-x1)*(y2-y1);
-    f1 = ((x2-x)*(y2-y))/denom;
-    f2 = ((x-x1)*(y2-y))/denom;
-    f3 = ((x2-x)*(y-y1))/denom;
-    f4 = ((x-x1)*(y-y1))/denom;
-    p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
+    printf("%lld %.3lf %8.2lf %8.2lf %8.2lf\n",zs.count,zs.area,zs.mean,zs.min,zs.max);
+    for (k=DEM_GT3;k<NDEMPRODUCTS;k++)
+      if (zs.demcount[k]>0) printf("%3s %lld\n",demproductname(k),zs.demcount[k]);
+    for (k=0;k<nbins;k++)
+      if (hist[k]>0.0) printf("%8.2lf %8.2lf %.3lf\n",ZONALMIN+k*binwidth,ZONALMIN+(k+1)*binwidth,hist[k]);
   }
-
-  // Return the result
-  return(p);
+  free(lat);
+  free(lon);
+  free(names);
+  free(hist);
 
 }
 
 
-double queryarcticdem100(double x,double y)
+void runresample(struct topocontext *ctx,struct linereader *rd,int htrefflag,int gridproj,int nthreads)
 {
-  long long int nx,ny,m1,m2,n1,n2;
-  long long int offsetq11,offsetq21,offsetq12,offsetq22;
-  float q11,q21,q12,q22;
-  double x0,y0,mdbl,ndbl,x1,x2,y1,y2,denom,f1,f2,f3,f4,p;
-  void byteswap(char *,char *,int);
-
-  // Define size of grid
-  //printf("x=%lf y=%lf\n",x,y);
-  x0 =-4000000.0;
-  y0 = 4100000.0;
-  nx = 74000;
-  ny = 75000;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = (x-x0)/100.0-0.5;
-  if (mdbl<0.0||mdbl>(nx-1))  // Requested coordinates are outside x bounds of DEM
-  {
-    return(-9999.0);
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/100.0-0.5;
-  if (ndbl<0.0||ndbl>(ny-1))  // Requested coordinates are outside y bounds of DEM
-  {
-    return(-9999.0);
-  }
-  else
-  {
-    n1 = int(ndbl);
-    n2 = n1+1;
+  // Reads the bounds and spacing of a grid from the first input line and
+  // writes its heights to stdout a block of rows at a time, each worker
+  // thread doing a share of the rows of the block
+  char *line,buf[256];
+  int j,njobs;
+  int started[MAXTHREADS];
+  long len,row,rows;
+  double xmin,ymin,xmax,ymax,spacing;
+  struct gridspec g;
+  struct gridjob *jobs;
+  pthread_t threads[MAXTHREADS];
+  void *rungridjob(void *);
+  long readline(struct linereader *,char **,long long);
+
+  // The grid, nodes on its bounds where the spacing allows
+  if ((len=readline(rd,&line,-1))<0)
+  {
+    line = buf;
+    len = 0;
+  }
+  snprintf(buf,sizeof(buf),"%.*s",(int)len,line);
+  if (sscanf(buf,"%lf %lf %lf %lf %lf",&xmin,&ymin,&xmax,&ymax,&spacing)!=5||
+      spacing<=0.0||xmax<xmin||ymax<ymin)
+  {
+    printf("Grid bounds and spacing not understood - exiting\n");
+    exit(-1);
   }
-  offsetq11 = (long long)4*(n1*nx+m1);
-  offsetq21 = (long long)4*(n1*nx+m2);
-  offsetq12 = (long long)4*(n2*nx+m1);
-  offsetq22 = (long long)4*(n2*nx+m2);
-  //printf("nx: %lld  ny: %lld\n",nx,ny);
-  //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-  //printf("m1: %lld  m2:%lld\n",m1,m2);
-  //printf("n1: %lld  n2: %lld\n",n1,n2);
-  //printf("offsetq11=%lld  offsetq21=%lld\n",offsetq11,offsetq21);
-  //printf("offsetq12=%lld  offsetq22=%lld\n",offsetq12,offsetq22);
-
-  // Open ArcticDEM-100m DEM file if not already open
-  if (opendem==-1)
+  g.proj = gridproj;
+  g.x0 = xmin;
+  g.y0 = ymax;
+  g.spacing = spacing;
+  g.nx = (long)floor((xmax-xmin)/spacing+1.0e-9)+1;
+  g.ny = (long)floor((ymax-ymin)/spacing+1.0e-9)+1;
+  rows = GRIDBLOCK/g.nx;
+  if (rows<1) rows = 1;
+
+  // One block of rows per thread
+  if ((jobs=(struct gridjob *)calloc(nthreads,sizeof(struct gridjob)))==NULL)
   {
-    if ((fptrdem=fopen(ARCTICDEM100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 35;
+    printf("Out of memory - exiting\n");
+    exit(-1);
   }
-  else if (opendem!=35)
+  for (j=0;j<nthreads;j++)
   {
-    fclose(fptrdem);
-    if ((fptrdem=fopen(ARCTICDEM100PATH,"r"))==NULL) return(-9999.9);
-    opendem = 35;    
-  }
-
-  // Read the four surrounding pixels from the DEM file
-  fseek(fptrdem,offsetq11,SEEK_SET);
-  fread(&q11,4,1,fptrdem);
-  fseek(fptrdem,offsetq21,SEEK_SET);
-  fread(&q21,4,1,fptrdem);
-  fseek(fptrdem,offsetq12,SEEK_SET);
-  fread(&q12,4,1,fptrdem);
-  fseek(fptrdem,offsetq22,SEEK_SET);
-  fread(&q22,4,1,fptrdem);
-  //printf("q11=%f q21=%f\n",q11,q21);
-  //printf("q12=%f q22=%f\n",q12,q22);
-
-  // Compute terrain at requested lat/lon by bilinear interpolation
-  if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-    p = -9999.0;
-  else
-  {
-    x1 = x0+(m1+0.5)*100.0;
-    x2 = x0+(m2+0.5)*100.0;
-    y1 = y0-(n1+0.5)*100.0;
-    y2 = y0-(n2+0.5)*100.0;
-    denom = (x2-x1)*(y2-y1);
-    f1 = ((x2-x)*(y2-y))/denom;
-    f2 = ((x-x1)*(y2-y))/denom;
-    f3 = ((x2-x)*(y-y1))/denom;
-    f4 = ((x-x1)*(y-y1))/denom;
-    p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
+    jobs[j].ctx = ctx;
+    jobs[j].g = &g;
+    jobs[j].htrefflag = htrefflag;
+    if ((jobs[j].out=(float *)malloc(rows*g.nx*sizeof(float)))==NULL)
+    {
+      printf("Out of memory - exiting\n");
+      exit(-1);
+    }
   }
 
-  // Return the result
-  return(p);
-
-}
-
-
-
-double querygtopo30(double lat,double lon)
-{
-  bool flag;
-  char tilename[35][15],filename[120];
-  short sdtemp,q11,q21,q12,q22;
-  int ntiles,i,nlon,nlat,n1,n2,m1,m2;
-  long int offsetq11,offsetq21,offsetq12,offsetq22;
-  double mdbl,ndbl,lon1,lon2,lat1,lat2;
-  double denom,f1,f2,f3,f4,p;
-  double tilelat[35][5],tilelon[40][5];
-  bool pointinpolygon(double,double,double *,double *,int);
-  void byteswap(char *,char *,int);
-
-  // Define the GTOPO30 tile boundaries
-  ntiles = 33;
-  strcpy(tilename[ 0],"W180N90.DEM\0");
-  tilelat[ 0][0] = 90.0;  tilelon[ 0][0] =-180.0;
-  tilelat[ 0][1] = 90.0;  tilelon[ 0][1] =-140.0;
-  tilelat[ 0][2] = 40.0;  tilelon[ 0][2] =-140.0;
-  tilelat[ 0][3] = 40.0;  tilelon[ 0][3] =-180.0;
-  tilelat[ 0][4] = 90.0;  tilelon[ 0][4] =-180.0;
-  strcpy(tilename[ 1],"W140N90.DEM\0");
-  tilelat[ 1][0] = 90.0;  tilelon[ 1][0] =-140.0;
-  tilelat[ 1][1] = 90.0;  tilelon[ 1][1] =-100.0;
-  tilelat[ 1][2] = 40.0;  tilelon[ 1][2] =-100.0;
-  tilelat[ 1][3] = 40.0;  tilelon[ 1][3] =-140.0;
-  tilelat[ 1][4] = 90.0;  tilelon[ 1][4] =-140.0;
-  strcpy(tilename[ 2],"W100N90.DEM\0");
-  tilelat[ 2][0] = 90.0;  tilelon[ 2][0] =-100.0;
-  tilelat[ 2][1] = 90.0;  tilelon[ 2][1] =-060.0;
-  tilelat[ 2][2] = 40.0;  tilelon[ 2][2] =-060.0;
-  tilelat[ 2][3] = 40.0;  tilelon[ 2][3] =-100.0;
-  tilelat[ 2][4] = 90.0;  tilelon[ 2][4] =-100.0;
-  strcpy(tilename[ 3],"W060N90.DEM\0");
-  tilelat[ 3][0] = 90.0;  tilelon[ 3][0] =-060.0;
-  tilelat[ 3][1] = 90.0;  tilelon[ 3][1] =-020.0;
-  tilelat[ 3][2] = 40.0;  tilelon[ 3][2] =-020.0;
-  tilelat[ 3][3] = 40.0;  tilelon[ 3][3] =-060.0;
-  tilelat[ 3][4] = 90.0;  tilelon[ 3][4] =-060.0;
-  strcpy(tilename[ 4],"W020N90.DEM\0");
-  tilelat[ 4][0] = 90.0;  tilelon[ 4][0] =-020.0;
-  tilelat[ 4][1] = 90.0;  tilelon[ 4][1] = 020.0;
-  tilelat[ 4][2] = 40.0;  tilelon[ 4][2] = 020.0;
-  tilelat[ 4][3] = 40.0;  tilelon[ 4][3] =-020.0;
-  tilelat[ 4][4] = 90.0;  tilelon[ 4][4] =-020.0;
-  strcpy(tilename[ 5],"E020N90.DEM\0");
-  tilelat[ 5][0] = 90.0;  tilelon[ 5][0] = 020.0;
-  tilelat[ 5][1] = 90.0;  tilelon[ 5][1] = 060.0;
-  tilelat[ 5][2] = 40.0;  tilelon[ 5][2] = 060.0;
-  tilelat[ 5][3] = 40.0;  tilelon[ 5][3] = 020.0;
-  tilelat[ 5][4] = 90.0;  tilelon[ 5][4] = 020.0;
-  strcpy(tilename[ 6],"E060N90.DEM\0");
-  tilelat[ 6][0] = 90.0;  tilelon[ 6][0] = 060.0;
-  tilelat[ 6][1] = 90.0;  tilelon[ 6][1] = 100.0;
-  tilelat[ 6][2] = 40.0;  tilelon[ 6][2] = 100.0;
-  tilelat[ 6][3] = 40.0;  tilelon[ 6][3] = 060.0;
-  tilelat[ 6][4] = 90.0;  tilelon[ 6][4] = 060.0;
-  strcpy(tilename[ 7],"E100N90.DEM\0");
-  tilelat[ 7][0] = 90.0;  tilelon[ 7][0] = 100.0;
-  tilelat[ 7][1] = 90.0;  tilelon[ 7][1] = 140.0;
-  tilelat[ 7][2] = 40.0;  tilelon[ 7][2] = 140.0;
-  tilelat[ 7][3] = 40.0;  tilelon[ 7][3] = 100.0;
-  tilelat[ 7][4] = 90.0;  tilelon[ 7][4] = 100.0;
-  strcpy(tilename[ 8],"E140N90.DEM\0");
-  tilelat[ 8][0] = 90.0;  tilelon[ 8][0] = 140.0;
-  tilelat[ 8][1] = 90.0;  tilelon[ 8][1] = 180.0;
-  tilelat[ 8][2] = 40.0;  tilelon[ 8][2] = 180.0;
-  tilelat[ 8][3] = 40.0;  tilelon[ 8][3] = 140.0;
-  tilelat[ 8][4] = 90.0;  tilelon[ 8][4] = 140.0;
-  strcpy(tilename[ 9],"W180N40.DEM\0");
-  tilelat[ 9][0] = 40.0;  tilelon[ 9][0] =-180.0;
-  tilelat[ 9][1] = 40.0;  tilelon[ 9][1] =-140.0;
-  tilelat[ 9][2] =-10.0;  tilelon[ 9][2] =-140.0;
-  tilelat[ 9][3] =-10.0;  tilelon[ 9][3] =-180.0;
-  tilelat[ 9][4] = 40.0;  tilelon[ 9][4] =-180.0;
-  strcpy(tilename[10],"W140N40.DEM\0");
-  tilelat[10][0] = 40.0;  tilelon[10][0] =-140.0;
-  tilelat[10][1] = 40.0;  tilelon[10][1] =-100.0;
-  tilelat[10][2] =-10.0;  tilelon[10][2] =-100.0;
-  tilelat[10][3] =-10.0;  tilelon[10][3] =-140.0;
-  tilelat[10][4] = 40.0;  tilelon[10][4] =-140.0;
-  strcpy(tilename[11],"W100N40.DEM\0");
-  tilelat[11][0] = 40.0;  tilelon[11][0] =-100.0;
-  tilelat[11][1] = 40.0;  tilelon[11][1] =-060.0;
-  tilelat[11][2] =-10.0;  tilelon[11][2] =-060.0;
-  tilelat[11][3] =-10.0;  tilelon[11][3] =-100.0;
-  tilelat[11][4] = 40.0;  tilelon[11][4] =-100.0;
-  strcpy(tilename[12],"W060N40.DEM\0");
-  tilelat[12][0] = 40.0;  tilelon[12][0] =-060.0;
-  tilelat[12][1] = 40.0;  tilelon[12][1] =-020.0;
-  tilelat[12][2] =-10.0;  tilelon[12][2] =-020.0;
-  tilelat[12][3] =-10.0;  tilelon[12][3] =-060.0;
-  tilelat[12][4] = 40.0;  tilelon[12][4] =-060.0;
-  strcpy(tilename[13],"W020N40.DEM\0");
-  tilelat[13][0] = 40.0;  tilelon[13][0] =-020.0;
-  tilelat[13][1] = 40.0;  tilelon[13][1] = 020.0;
-  tilelat[13][2] =-10.0;  tilelon[13][2] = 020.0;
-  tilelat[13][3] =-10.0;  tilelon[13][3] =-020.0;
-  tilelat[13][4] = 40.0;  tilelon[13][4] =-020.0;
-  strcpy(tilename[14],"E020N40.DEM\0");
-  tilelat[14][0] = 40.0;  tilelon[14][0] = 020.0;
-  tilelat[14][1] = 40.0;  tilelon[14][1] = 060.0;
-  tilelat[14][2] =-10.0;  tilelon[14][2] = 060.0;
-  tilelat[14][3] =-10.0;  tilelon[14][3] = 020.0;
-  tilelat[14][4] = 40.0;  tilelon[14][4] = 020.0;
-  strcpy(tilename[15],"E060N40.DEM\0");
-  tilelat[15][0] = 40.0;  tilelon[15][0] = 060.0;
-  tilelat[15][1] = 40.0;  tilelon[15][1] = 100.0;
-  tilelat[15][2] =-10.0;  tilelon[15][2] = 100.0;
-  tilelat[15][3] =-10.0;  tilelon[15][3] = 060.0;
-  tilelat[15][4] = 40.0;  tilelon[15][4] = 060.0;
-  strcpy(tilename[16],"E100N40.DEM\0");
-  tilelat[16][0] = 40.0;  tilelon[16][0] = 100.0;
-  tilelat[16][1] = 40.0;  tilelon[16][1] = 140.0;
-  tilelat[16][2] =-10.0;  tilelon[16][2] = 140.0;
-  tilelat[16][3] =-10.0;  tilelon[16][3] = 100.0;
-  tilelat[16][4] = 40.0;  tilelon[16][4] = 100.0;
-  strcpy(tilename[17],"E140N40.DEM\0");
-  tilelat[17][0] = 40.0;  tilelon[17][0] = 140.0;
-  tilelat[17][1] = 40.0;  tilelon[17][1] = 180.0;
-  tilelat[17][2] =-10.0;  tilelon[17][2] = 180.0;
-  tilelat[17][3] =-10.0;  tilelon[17][3] = 140.0;
-  tilelat[17][4] = 40.0;  tilelon[17][4] = 140.0;
-  strcpy(tilename[18],"W180S10.DEM\0");
-  tilelat[18][0] =-10.0;  tilelon[18][0] =-180.0;
-  tilelat[18][1] =-10.0;  tilelon[18][1] =-140.0;
-  tilelat[18][2] =-60.0;  tilelon[18][2] =-140.0;
-  tilelat[18][3] =-60.0;  tilelon[18][3] =-180.0;
-  tilelat[18][4] =-10.0;  tilelon[18][4] =-180.0;
-  strcpy(tilename[19],"W140S10.DEM\0");
-  tilelat[19][0] =-10.0;  tilelon[19][0] =-140.0;
-  tilelat[19][1] =-10.0;  tilelon[19][1] =-100.0;
-  tilelat[19][2] =-60.0;  tilelon[19][2] =-100.0;
-  tilelat[19][3] =-60.0;  tilelon[19][3] =-140.0;
-  tilelat[19][4] =-10.0;  tilelon[19][4] =-140.0;
-  strcpy(tilename[20],"W100S10.DEM\0");
-  tilelat[20][0] =-10.0;  tilelon[20][0] =-100.0;
-  tilelat[20][1] =-10.0;  tilelon[20][1] =-060.0;
-  tilelat[20][2] =-60.0;  tilelon[20][2] =-060.0;
-  tilelat[20][3] =-60.0;  tilelon[20][3] =-100.0;
-  tilelat[20][4] =-10.0;  tilelon[20][4] =-100.0;
-  strcpy(tilename[21],"W060S10.DEM\0");
-  tilelat[21][0] =-10.0;  tilelon[21][0] =-060.0;
-  tilelat[21][1] =-10.0;  tilelon[21][1] =-020.0;
-  tilelat[21][2] =-60.0;  tilelon[21][2] =-020.0;
-  tilelat[21][3] =-60.0;  tilelon[21][3] =-060.0;
-  tilelat[21][4] =-10.0;  tilelon[21][4] =-060.0;
-  strcpy(tilename[22],"W020S10.DEM\0");
-  tilelat[22][0] =-10.0;  tilelon[22][0] =-020.0;
-  tilelat[22][1] =-10.0;  tilelon[22][1] = 020.0;
-  tilelat[22][2] =-60.0;  tilelon[22][2] = 020.0;
-  tilelat[22][3] =-60.0;  tilelon[22][3] =-020.0;
-  tilelat[22][4] =-10.0;  tilelon[22][4] =-020.0;
-  strcpy(tilename[23],"W020S10.DEM\0");
-  tilelat[23][0] =-10.0;  tilelon[23][0] = 020.0;
-  tilelat[23][1] =-10.0;  tilelon[23][1] = 060.0;
-  tilelat[23][2] =-60.0;  tilelon[23][2] = 060.0;
-  tilelat[23][3] =-60.0;  tilelon[23][3] = 020.0;
-  tilelat[23][4] =-10.0;  tilelon[23][4] = 020.0;
-  strcpy(tilename[24],"W060S10.DEM\0");
-  tilelat[24][0] =-10.0;  tilelon[24][0] = 060.0;
-  tilelat[24][1] =-10.0;  tilelon[24][1] = 100.0;
-  tilelat[24][2] =-60.0;  tilelon[24][2] = 100.0;
-  tilelat[24][3] =-60.0;  tilelon[24][3] = 060.0;
-  tilelat[24][4] =-10.0;  tilelon[24][4] = 060.0;
-  strcpy(tilename[25],"W100S10.DEM\0");
-  tilelat[25][0] =-10.0;  tilelon[25][0] = 100.0;
-  tilelat[25][1] =-10.0;  tilelon[25][1] = 140.0;
-  tilelat[25][2] =-60.0;  tilelon[25][2] = 140.0;
-  tilelat[25][3] =-60.0;  tilelon[25][3] = 100.0;
-  tilelat[25][4] =-10.0;  tilelon[25][4] = 100.0;
-  strcpy(tilename[26],"E140S10.DEM\0");
-  tilelat[26][0] =-10.0;  tilelon[26][0] = 140.0;
-  tilelat[26][1] =-10.0;  tilelon[26][1] = 180.0;
-  tilelat[26][2] =-60.0;  tilelon[26][2] = 180.0;
-  tilelat[26][3] =-60.0;  tilelon[26][3] = 140.0;
-  tilelat[26][4] =-10.0;  tilelon[26][4] = 140.0;
-  strcpy(tilename[27],"W180S60.DEM\0");
-  tilelat[27][0] =-60.0;  tilelon[27][0] =-180.0;
-  tilelat[27][1] =-60.0;  tilelon[27][1] =-120.0;
-  tilelat[27][2] =-90.0;  tilelon[27][2] =-120.0;
-  tilelat[27][3] =-90.0;  tilelon[27][3] =-180.0;
-  tilelat[27][4] =-60.0;  tilelon[27][4] =-180.0;
-  strcpy(tilename[28],"W120S60.DEM\0");
-  tilelat[28][0] =-60.0;  tilelon[28][0] =-120.0;
-  tilelat[28][1] =-60.0;  tilelon[28][1] =-060.0;
-  tilelat[28][2] =-90.0;  tilelon[28][2] =-060.0;
-  tilelat[28][3] =-90.0;  tilelon[28][3] =-120.0;
-  tilelat[28][4] =-60.0;  tilelon[28][4] =-120.0;
-  strcpy(tilename[29],"W060S60.DEM\0");
-  tilelat[29][0] =-60.0;  tilelon[29][0] =-060.0;
-  tilelat[29][1] =-60.0;  tilelon[29][1] = 000.0;
-  tilelat[29][2] =-90.0;  tilelon[29][2] = 000.0;
-  tilelat[29][3] =-90.0;  tilelon[29][3] =-060.0;
-  tilelat[29][4] =-60.0;  tilelon[29][4] =-060.0;
-  strcpy(tilename[30],"W000S60.DEM\0");
-  tilelat[30][0] =-60.0;  tilelon[30][0] = 000.0;
-  tilelat[30][1] =-60.0;  tilelon[30][1] = 060.0;
-  tilelat[30][2] =-90.0;  tilelon[30][2] = 060.0;
-  tilelat[30][3] =-90.0;  tilelon[30][3] = 000.0;
-  tilelat[30][4] =-60.0;  tilelon[30][4] = 000.0;
-  strcpy(tilename[31],"E060S60.DEM\0");
-  tilelat[31][0] =-60.0;  tilelon[31][0] = 060.0;
-  tilelat[31][1] =-60.0;  tilelon[31][1] = 120.0;
-  tilelat[31][2] =-90.0;  tilelon[31][2] = 120.0;
-  tilelat[31][3] =-90.0;  tilelon[31][3] = 060.0;
-  tilelat[31][4] =-60.0;  tilelon[31][4] = 060.0;
-  strcpy(tilename[32],"E120S60.DEM\0");
-  tilelat[32][0] =-60.0;  tilelon[32][0] = 120.0;
-  tilelat[32][1] =-60.0;  tilelon[32][1] = 180.0;
-  tilelat[32][2] =-90.0;  tilelon[32][2] = 180.0;
-  tilelat[32][3] =-90.0;  tilelon[32][3] = 120.0;
-  tilelat[32][4] =-60.0;  tilelon[32][4] = 120.0;
-
-  // Loop over all tiles
-  if (lat<=-89.9) return(2772.0); // Special case for bottom of GTOPO30 grids
-  for (i=0;i<33;i++)
+  // Work down the grid, writing each block of rows once it is done
+  for (row=0;row<g.ny;)
   {
-
-    // If point is within current tile, query that tile
-    flag = pointinpolygon(lon,lat,tilelon[i],tilelat[i],5);
-    //printf("flag=%d\n",flag);
-    if (flag) 
+    for (njobs=0;njobs<nthreads&&row<g.ny;njobs++)
     {
-      //printf("%s\n",tilename[i]);
-      nlon = int(120.0*(tilelon[i][1]-tilelon[i][0]));
-      nlat = int(120.0*(tilelat[i][1]-tilelat[i][2]));
-      mdbl = 120.0*(lon-tilelon[i][0])-0.5;
-      if (mdbl<0.0)
-      {
-        m1 = 0;
-        m2 = 0;
-      }
-      else if (mdbl>(nlon-1)) 
-      {
-        m1 = nlon-1;
-        m2 = nlon-1;
-      }
-      else
-      {
-        m1 = int(mdbl);
-        m2 = m1+1;
-      }
-      ndbl = 120.0*(tilelat[i][0]-lat)-0.5;
-      if (ndbl<0.0)
-      {
-        n1 = 0;
-        n2 = 0;
-      }
-      else if (ndbl>(nlat-1)) 
-      {
-        n1 = nlat-1;
-        n2 = nlat-1;
-      }
-      else
-      {
-        n1 = int(ndbl);
-        n2 = n1+1;
-      }
-      offsetq11 = 2*(n1*nlon+m1);
-      offsetq21 = 2*(n1*nlon+m2);
-      offsetq12 = 2*(n2*nlon+m1);
-      offsetq22 = 2*(n2*nlon+m2);
-      //printf("ncols: %d  nrows: %d\n",nlon,nlat);
-      //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-      //printf("m1: %d  m2:%d\n",m1,m2);
-      //printf("n1: %d  n2: %d\n",n1,n2);
-      //printf("offsetq11=%ld  offsetq21=%ld\n",offsetq11,offsetq21);
-      //printf("offsetq12=%ld  offsetq22=%ld\n",offsetq12,offsetq22);
-
-      // Open this GTOPO30 DEM tile if not already open
-      strcpy(filename,GTOPO30PATH);
-      strcat(filename,tilename[i]);
-      if (opendem==-1)
+      jobs[njobs].row0 = row;
+      jobs[njobs].nrows = (g.ny-row<rows) ? g.ny-row : rows;
+      row += jobs[njobs].nrows;
+    }
+    if (njobs==1)
+      rungridjob(&jobs[0]);
+    else
+    {
+      for (j=0;j<njobs;j++)
       {
-        //printf("no DEM open, opening GTOPO30 DEM tile %d\n",i);
-        if ((fptrdem=fopen(filename,"r"))==NULL) return(-9999.9);
-        opendem = i;
+        started[j] = (pthread_create(&threads[j],NULL,rungridjob,&jobs[j])==0);
+        if (!started[j]) rungridjob(&jobs[j]);  // no thread available, do it here
       }
-      else if (opendem!=i)
+      for (j=0;j<njobs;j++)
+        if (started[j]) pthread_join(threads[j],NULL);
+    }
+    for (j=0;j<njobs;j++)
+    {
+      if (jobs[j].status==-1)
       {
-        //printf("closing previously open DEM, opening GTOPO30 DEM tile %d\n",i);
-        fclose(fptrdem);
-        if ((fptrdem=fopen(filename,"r"))==NULL) return(-9999.9);
-        opendem = i;    
+        printf("Out of memory - exiting\n");
+        exit(-1);
       }
-
-      // Read the four surrounding pixels from the DEM file
-      fseek(fptrdem,offsetq11,SEEK_SET);
-      fread(&sdtemp,2,1,fptrdem);
-      byteswap((char *)&sdtemp,(char *)&q11,2);
-      if (q11==-9999.0) q11 = 0.0;
-      fseek(fptrdem,offsetq21,SEEK_SET);
-      fread(&sdtemp,2,1,fptrdem);
-      byteswap((char *)&sdtemp,(char *)&q21,2);
-      if (q21==-9999.0) q21 = 0.0;
-      fseek(fptrdem,offsetq12,SEEK_SET);
-      fread(&sdtemp,2,1,fptrdem);
-      byteswap((char *)&sdtemp,(char *)&q12,2);
-      if (q12==-9999.0) q12 = 0.0;
-      fseek(fptrdem,offsetq22,SEEK_SET);
-      fread(&sdtemp,2,1,fptrdem);
-      byteswap((char *)&sdtemp,(char *)&q22,2);
-      if (q22==-9999.0) q22 = 0.0;
-      //printf("q11 = %d  q21 = %d\n",q11,q21);
-      //printf("q12 = %d  q22 = %d\n",q12,q22);
-      
-      // Compute terrain at requested lat/lon by bilinear interpolation
-      if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-        p = -9999.0;
-      else
-      {
-        //printf("point b\n");
-        lon1 = tilelon[i][0]+(m1+0.5)/120.0;
-        lon2 = tilelon[i][0]+(m2+0.5)/120.0;
-        lat1 = tilelat[i][0]-(n1+0.5)/120.0;
-        lat2 = tilelat[i][0]-(n2+0.5)/120.0;
-        //printf("lon1 = %lf  lon2 = %lf\n",lon1,lon2);
-        //printf("lat1 = %lf  lat2 = %lf\n",lat1,lat2);
-        if (lat1==lat2 && lon1==lon2)  // at a corner of a tile
-        {
-          //printf("at corner of tile\n");
-          p = q11;
-        }
-        else if (lat1==lat2) // at top or bottom edge of a tile
-        {
-          //printf("at top or bottom edge of tile\n");
-          p = q11+(q21-q11)*(lon-lon1)/(lon2-lon1);
-        }
-        else if (lon1==lon2) // at right or left edge of a tile
-        {
-          //printf("at right or left edge of tile\n");
-          p = q11+(q12-q11)*(lat-lat1)/(lat2-lat1);
-        }
-        else // within a tile, the usual case
-        {
-          denom = (lon2-lon1)*(lat2-lat1);
-          f1 = ((lon2-lon)*(lat2-lat))/denom;
-          f2 = ((lon-lon1)*(lat2-lat))/denom;
-          f3 = ((lon2-lon)*(lat-lat1))/denom;
-          f4 = ((lon-lon1)*(lat-lat1))/denom;
-          //printf("f1=%lf f2=%lf f3=%lf f4=%lf\n",f1,f2,f3,f4);
-          p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
-        }
-      }
-      return(p);
-
+      fwrite(jobs[j].out,sizeof(float),jobs[j].nrows*g.nx,stdout);
     }
-
   }
+  fflush(stdout);
+  for (j=0;j<nthreads;j++) free(jobs[j].out);
+  free(jobs);
 
 }
 
 
-double querygeoid(double lat, double lon, char *geoidid)
+void *rungridjob(void *arg)
 {
-  double geoid;
-  double queryegm96(double, double);
-  double queryegm2008(double, double);
-  
-  // EGM96 is our only available geoid currently
-  //if (1)
-  //{
-  //  strcpy(geoidid,"E96\0");
-  //  geoid = queryegm96(lat,lon);
-  //}
-
-  // Query the EGM2008 1'x1' geoid grid
-  if (1)
-  {
-    strcpy(geoidid,"E08\0");
-    geoid = queryegm2008(lat,lon);
-  }
+  struct gridjob *job = (struct gridjob *)arg;
 
-}
+  job->status = resamplegrid(job->ctx,job->g,job->htrefflag,job->row0,job->nrows,job->out);
+  return(NULL);
 
+}
 
 
-double queryegm2008(double y,double x)
+void printmaxtopo(struct topocontext *ctx,double topo,double lat,double lon,int demid,
+                  const char *from,const char *to)
 {
-  int nx,nxtg,ny,m1,m2,n1,n2;
-  long long int offsetq11,offsetq12,offsetq21,offsetq22;
-  float ftemp,q11,q12,q21,q22;
-  double x0,y0,res,mdbl,ndbl,lat1,lon1,lat2,lon2,p,denom,f1,f2,f3,f4;
-
-  // The EGM2008 geoid grid files are odd, and poorly documented.  After lots of trial
-  // and error I determined that the grid dimensions are 10801 rows by 21602 columns.
-  // The first and last columns are filled with 0s, padding I suppose.
-
-  // Offset longitude to between 0 and 360
-  while (x<0.0) x+=360.0;
-
-  // Define size of grid
-  x0 = 0.0;
-  y0 = 90.0;
-  nx = 21602;
-  ny = 10801;
-  res = 1.0/60.0;
-
-  // Determine row and column of surrounding grid cells
-  // for now, we ignore the padding columns at left and right
-  nxtg = nx-2;
-  mdbl = (x-x0)/res;
-  //printf("mdbl=%lf nxtg=%d\n",mdbl,nxtg);
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nxtg-1))
-  {
-    m1 = nxtg-1;
-    m2 = 1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = (y0-y)/res;
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
-  {
-    n1 = ny-1;
-    n2 = ny-1;
-  }
-  else
-  {
-    n1 = int(ndbl);
-    n2 = n1+1;
-  }
-  m1 += 1; // add the padding column
-  m2 += 1; // add the padding column
-  offsetq11 = 4*(n1*nx+m1);
-  offsetq21 = 4*(n1*nx+m2);
-  offsetq12 = 4*(n2*nx+m1);
-  offsetq22 = 4*(n2*nx+m2);
-  //printf("ncols: %d  nrows: %d\n",nx,ny);
-  //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-  //printf("m1: %d  m2:%d\n",m1,m2);
-  //printf("n1: %d  n2: %d\n",n1,n2);
-  //printf("offsetq11=%lld  offsetq21=%lld\n",offsetq11,offsetq21);
-  //printf("offsetq12=%lld  offsetq22=%lld\n",offsetq12,offsetq22);
-
-  // Open EGM2008 geoid file if not already open
-  if (opengeoid==-1)
-  {
-    if ((fptrgeoid=fopen(EGM08PATH,"r"))==NULL) return(-9999.9);
-    opengeoid = 0;
-  }
+  // One answer of runmaxtopo, as a querytopo2 line for the highest point
+  // followed by the names of what it is for
+  char geoidid[10];
+  double geoid;
 
-  // Read the four surrounding pixels from the geoid file
-  fseek(fptrgeoid,offsetq11,SEEK_SET);
-  fread(&q11,4,1,fptrgeoid);
-  fseek(fptrgeoid,offsetq21,SEEK_SET);
-  fread(&q21,4,1,fptrgeoid);
-  fseek(fptrgeoid,offsetq12,SEEK_SET);
-  fread(&q12,4,1,fptrgeoid);
-  fseek(fptrgeoid,offsetq22,SEEK_SET);
-  fread(&q22,4,1,fptrgeoid);
-  //printf("q11 = %f  q21 = %f\n",q11,q21);
-  //printf("q12 = %f  q22 = %f\n",q12,q22);
-
-  // Compute geoid at requested lat/lon by bilinear interpolation
-  if (q11==-9999.0||q21==-9999.0||q12==-9999.0||q22==-9999.0)
-    p = -9999.0;
+  if (demid==DEM_NONE)
+    printf("no terrain");
   else
   {
-    lon1 = x0+(m1-1)*res;
-    lon2 = x0+(m2-1)*res;
-    lat1 = y0-n1*res;
-    lat2 = y0-n2*res;
-    denom = (lon2-lon1)*(lat2-lat1);
-    f1 = ((lon2-x)*(lat2-y))/denom;
-    f2 = ((x-lon1)*(lat2-y))/denom;
-    f3 = ((lon2-x)*(y-lat1))/denom;
-    f4 = ((x-lon1)*(y-lat1))/denom;
-    p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
+    geoid = querygeoid(ctx,lat,lon,geoidid);
+    printf("%8.4lf %9.4lf %8.2lf %3s %7.2lf %3s",lat,lon,topo,demproductname(demid),geoid,geoidid);
   }
-
-  // Return the result
-  return(p);
+  if (from!=NULL) printf(" %s",from);
+  if (to!=NULL) printf(" %s",to);
+  printf("\n");
 
 }
 
 
+long long nowms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((long long)ts.tv_sec*1000+ts.tv_nsec/1000000);
+
+}
+
 
-double queryegm96(double y,double x)
+const char *parsedouble(const char *p,const char *end,double *v)
 {
-  short sdtemp,q11,q21,q12,q22;
-  int nx,ny,mdbl,ndbl,m1,m2,n1,n2;
-  double x0,y0,lon1,lon2,lat1,lat2,denom,f1,f2,f3,f4,p;
-  long int offsetq11,offsetq21,offsetq12,offsetq22;
-  void byteswap(char *,char *,int);
-
-  // Offset longitude to between 0 and 360
-  while (x<0.0) x+=360.0;
-
-  // Define size of grid
-  x0 = 0.0;
-  y0 = 90.0;
-  nx = 1440;
-  ny = 721;
-
-  // Determine row and column of surrounding grid cells
-  mdbl = 4.0*(x-x0);
-  if (mdbl<0.0)
-  {
-    m1 = 0;
-    m2 = 0;
-  }
-  else if (mdbl>(nx-1)) 
-  {
-    m1 = nx-1;
-    m2 = nx-1;
-  }
-  else
-  {
-    m1 = int(mdbl);
-    m2 = m1+1;
-  }
-  ndbl = 4.0*(y0-y);
-  if (ndbl<0.0)
-  {
-    n1 = 0;
-    n2 = 0;
-  }
-  else if (ndbl>(ny-1)) 
-  {
-    n1 = ny-1;
-    n2 = ny-1;
-  }
-  else
+  // Parses a number as %lf in sscanf would, returning the end of it, or
+  // NULL with *v untouched if there is none
+  const char *start,*q;
+  char *e;
+  double d;
+  std::from_chars_result r;
+
+  while (p<end&&(*p==' '||(*p>='\t'&&*p<='\r'))) p++;
+  start = p;
+  if (p<end&&*p=='+')  // from_chars takes no leading +
   {
-    n1 = int(ndbl);
-    n2 = n1+1;
+    p++;
+    if (p<end&&(*p=='+'||*p=='-')) return(NULL);
   }
-  offsetq11 = 2*(n1*nx+m1);
-  offsetq21 = 2*(n1*nx+m2);
-  offsetq12 = 2*(n2*nx+m1);
-  offsetq22 = 2*(n2*nx+m2);
-  //printf("ncols: %d  nrows: %d\n",nx,ny);
-  //printf("double col# %lf  double row# %lf\n",mdbl,ndbl);
-  //printf("m1: %d  m2:%d\n",m1,m2);
-  //printf("n1: %d  n2: %d\n",n1,n2);
-  //printf("offsetq11=%ld  offsetq21=%ld\n",offsetq11,offsetq21);
-  //printf("offsetq12=%ld  offsetq22=%ld\n",offsetq12,offsetq22);
-
-  // Open EGM96 geoid file if not already open
-  if (opengeoid==-1)
+  q = (p<end&&*p=='-') ? p+1 : p;
+
+  // Hex and out of range values are left to strtod, which sscanf uses
+  if (q+1<end&&q[0]=='0'&&(q[1]=='x'||q[1]=='X'))
   {
-    if ((fptrgeoid=fopen(EGM96PATH,"r"))==NULL) return(-9999.9);
-    opengeoid = 0;
+    d = strtod(start,&e);
+    if (e==start) return(NULL);
+    *v = d;
+    return(e);
   }
-
-  // Read the four surrounding pixels from the geoid file
-  fseek(fptrgeoid,offsetq11,SEEK_SET);
-  fread(&sdtemp,2,1,fptrgeoid);
-  byteswap((char *)&sdtemp,(char *)&q11,2);
-  if (q11==-9999.0) q11 = 0.0;
-  fseek(fptrgeoid,offsetq21,SEEK_SET);
-  fread(&sdtemp,2,1,fptrgeoid);
-  byteswap((char *)&sdtemp,(char *)&q21,2);
-  if (q21==-9999.0) q21 = 0.0;
-  fseek(fptrgeoid,offsetq12,SEEK_SET);
-  fread(&sdtemp,2,1,fptrgeoid);
-  byteswap((char *)&sdtemp,(char *)&q12,2);
-  if (q12==-9999.0) q12 = 0.0;
-  fseek(fptrgeoid,offsetq22,SEEK_SET);
-  fread(&sdtemp,2,1,fptrgeoid);
-  byteswap((char *)&sdtemp,(char *)&q22,2);
-  if (q22==-9999.0) q22 = 0.0;
-  //printf("q11 = %d  q21 = %d\n",q11,q21);
-  //printf("q12 = %d  q22 = %d\n",q12,q22);
-
-  // Compute geoid at requested lat/lon by bilinear interpolation
-  lon1 = x0+m1/4.0;
-  lon2 = x0+m2/4.0;
-  lat1 = y0-n1/4.0;
-  lat2 = y0-n2/4.0;
-  //printf("lon1 = %lf  lon2 = %lf\n",lon1,lon2);
-  //printf("lat1 = %lf  lat2 = %lf\n",lat1,lat2);
-  denom = (lon2-lon1)*(lat2-lat1);
-  f1 = ((lon2-x)*(lat2-y))/denom;
-  f2 = ((x-lon1)*(lat2-y))/denom;
-  f3 = ((lon2-x)*(y-lat1))/denom;
-  f4 = ((x-lon1)*(y-lat1))/denom;
-  p = f1*q11 + f2*q21 + f3*q12 + f4*q22;
-  return(p/100.0); // heights in database are in cm
+  r = std::from_chars(p,end,d);
+  if (r.ec==std::errc::invalid_argument) return(NULL);
+  if (r.ec==std::errc::result_out_of_range) d = strtod(p,NULL);
+  *v = d;
+  return(r.ptr);
 
 }
 
 
-bool pointinpolygon(double x, double y,double xpoly[],double ypoly[],int npoly)
+void parselatlon(const char *p,const char *end,double *lat,double *lon,char *name)
 {
-  int i,j=npoly-2;
-  bool oddnodes=false;
+  // Parses "lat lon [name]" as sscanf("%lf %lf %9s") would, leaving lat
+  // and lon as they were if missing.  name, unless NULL, gets the name or
+  // "-" if there is none.
+  long n;
+  const char *parsedouble(const char *,const char *,double *);
+
+  if ((p=parsedouble(p,end,lat))!=NULL) p = parsedouble(p,end,lon);
+  if (name==NULL) return;
+  strcpy(name,"-");
+  if (p==NULL) return;
+  while (p<end&&(*p==' '||(*p>='\t'&&*p<='\r'))) p++;
+  for (n=0;n<9&&p+n<end&&!(p[n]==' '||(p[n]>='\t'&&p[n]<='\r'));n++) name[n] = p[n];
+  if (n>0) name[n] = '\0';
 
-  for (i=0; i<(npoly-1); i++) 
+}
+
+
+double wraplon(double lon)
+{
+  // Wraps a longitude into (-180,180] in one step, however far out it is.
+  // fmod is exact, so a huge value cannot land outside the range.  NaN and
+  // infinite values are returned as they are.
+  if (isfinite(lon)&&(lon<=-180.0||lon>180.0))
   {
-    if (ypoly[i]<y && ypoly[j]>=y || ypoly[j]<y && ypoly[i]>=y) 
-    {
-      if (xpoly[i]+(y-ypoly[i])/(ypoly[j]-ypoly[i])*(xpoly[j]-xpoly[i])<x) 
-      {
-        oddnodes=!oddnodes; 
-      }
-    }
-    j=i; 
+    lon = fmod(lon,360.0);
+    if (lon<=-180.0) lon += 360.0;
+    if (lon>180.0) lon -= 360.0;
   }
+  return(lon);
+
+}
 
-  return(oddnodes);
+
+long putfixed(char *out,double v,int width,int prec)
+{
+  // Writes v as printf("%*.*lf",width,prec) would, returning its length
+  char tmp[400];
+  long n,pad;
+  std::to_chars_result r;
+
+  r = std::to_chars(tmp,tmp+sizeof(tmp),v,std::chars_format::fixed,prec);
+  n = r.ptr-tmp;
+  pad = (width>n) ? width-n : 0;
+  memset(out,' ',pad);
+  memcpy(out+pad,tmp,n);
+  return(pad+n);
 
 }
 
 
-void byteswap(char *in,char *out,int len)
+long putstring(char *out,const char *s,int width)
 {
-  int i,len2;
+  // Writes s as printf("%*s",width,s) would, returning its length
+  long n,pad;
 
-  len2 = len-1;
-  for (i=0;i<len;i++)
-  {
-    out[i]=in[len2-i];
-    //out[i] = in[i];
-  }
+  n = strlen(s);
+  pad = (width>n) ? width-n : 0;
+  memset(out,' ',pad);
+  memcpy(out+pad,s,n);
+  return(pad+n);
 
 }
-
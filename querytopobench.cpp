@@ -0,0 +1,566 @@
+/*------------------------------------------------------------------------*
+ NAME:     querytopobench.cpp
+
+ PURPOSE:  Benchmark for libquerytopo.  Generates synthetic grids with the
+           real geometries of the DEMs and geoids queried by querytopo2
+           in a scratch directory, points a topocontext at them through a
+           dataset file, and times standard workloads with each I/O
+           backend:
+             global    points scattered uniformly over the sphere
+             polar     dense along-track lines over Antarctica and Greenland
+             coast     lines running off the polar DEMs onto GTOPO30
+             gtopo30   scattered points answered by GTOPO30 alone
+           For each it reports points/s through querytopobatch in blocks
+           of 4096, as querytopo2 queries them, read syscalls and page
+           faults per point, and the p50/p99 latency of single-point
+           queries.
+
+           With -p it instead checks the library's polar stereographic
+           projection against geod2ps on points over both hemispheres,
+           a tenth of them within 1e-9 deg of a pole, and fails if any
+           differs by a millimetre or more.
+
+           The grids are sparse files.  Bands of rows hold a synthetic
+           terrain with patches of no data, the rest read as 0.  They are
+           made once per directory and reused by later runs given the same
+           -d.  Every workload is run once untimed first, so timings are
+           with the grids in the page cache; the syscall and fault counts
+           are the numbers to compare between I/O changes.
+
+ DATE:     17 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "querytopo.h"
+#include "/home/sonntag/Include/mission.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+
+#define BENCHBLOCK 4096   // points per querytopobatch call, as in querytopo2
+#define NLATENCY 2000     // single-point queries timed per run
+#define MAXTHREADS 256
+#define NWORKLOADS 4
+#define AE 6378137.0      // WGS-84, as the polar DEMs are projected
+#define FLAT (1.0/298.257223563)
+
+#define GRID_FLOAT32 0    // native float32 DEM
+#define GRID_BEINT16 1    // big-endian int16 DEM (GTOPO30)
+#define GRID_GEOID08 2    // native float32 geoid with a padding column each side (EGM2008)
+#define GRID_GEOID96 3    // big-endian int16 geoid in cm (EGM96)
+
+// A synthetic grid file.  Rows are written in bands of bandrows every
+// bandgap rows, the rest of the file is left as a hole.
+struct benchgrid
+{
+  char name[32];           // file name within the scratch directory
+  long long nx,ny;
+  int type;                // GRID_FLOAT32 ...
+  int bandrows,bandgap;
+};
+
+// A share of the points of a timed run
+struct benchjob
+{
+  struct topocontext *ctx;
+  long n;
+  const double *lat,*lon;
+  double *topo,*geoid;
+  int *demid;
+};
+
+static const char *workloads[NWORKLOADS] = {"global","polar","coast","gtopo30"};
+
+
+main(int argc, char *argv[])
+{
+  char dir[1024],conf[1100];
+  const char *backends[2];
+  int opt,nbackends,nthreads,sort,w,b,only,checkps;
+  long npts;
+  double cachemb,*lat,*lon,*topo,*geoid;
+  int *demid;
+  int makegrids(const char *,char *);
+  void makeworkload(int,long,double *,double *);
+  void runbench(const char *,const char *,const char *,double,int,int,long,
+                const double *,const double *,double *,double *,int *);
+  int checkprojection(long);
+
+  // Check input
+  backends[0] = "mmap";
+  backends[1] = "stdio";
+  nbackends = 2;
+  nthreads = 1;
+  npts = 200000;
+  cachemb = 0.0;
+  sort = 0;
+  only = -1;
+  checkps = 0;
+  dir[0] = '\0';
+  while ((opt=getopt(argc,argv,"b:c:d:j:n:psw:"))!=-1)
+  {
+    if (opt=='b'&&(!strcmp(optarg,"mmap")||!strcmp(optarg,"stdio"))) { backends[0] = optarg; nbackends = 1; continue; }
+    if (opt=='c'&&(cachemb=atof(optarg))>=0.0) continue;
+    if (opt=='d'&&strlen(optarg)<sizeof(dir)) { strcpy(dir,optarg); continue; }
+    if (opt=='j'&&(nthreads=atoi(optarg))>=1&&nthreads<=MAXTHREADS) continue;
+    if (opt=='n'&&(npts=atol(optarg))>=1) continue;
+    if (opt=='p') { checkps = 1; continue; }
+    if (opt=='s') { sort = 1; continue; }
+    if (opt=='w')
+    {
+      for (only=0;only<NWORKLOADS&&strcmp(optarg,workloads[only]);only++);
+      if (only<NWORKLOADS) continue;
+    }
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind != 0)
+  {
+    printf("Usage: querytopobench [-b mmap|stdio] [-c cache MB] [-d scratch dir] [-j threads] [-n points] [-p] [-s] [-w global|polar|coast|gtopo30]\n");
+    exit(0);
+  }
+
+  // The projection check needs no grids
+  if (checkps)
+  {
+    if (checkprojection(npts)==-1)
+    {
+      printf("Projection differs from geod2ps by 1 mm or more - exiting\n");
+      exit(-1);
+    }
+    exit(0);
+  }
+
+  // Make the grids and the dataset file pointing at them
+  if (dir[0]=='\0')
+    snprintf(dir,sizeof(dir),"%s/querytopobench",getenv("TMPDIR")!=NULL ? getenv("TMPDIR") : "/tmp");
+  mkdir(dir,0755);
+  printf("Synthetic grids in %s\n",dir);
+  fflush(stdout);
+  if (makegrids(dir,conf)==-1)
+  {
+    printf("Cannot write grids in %s - exiting\n",dir);
+    exit(-1);
+  }
+
+  // Run each workload with each backend
+  lat = (double *)malloc(npts*sizeof(double));
+  lon = (double *)malloc(npts*sizeof(double));
+  topo = (double *)malloc(npts*sizeof(double));
+  geoid = (double *)malloc(npts*sizeof(double));
+  demid = (int *)malloc(npts*sizeof(int));
+  if (lat==NULL||lon==NULL||topo==NULL||geoid==NULL||demid==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+  printf("%ld points, %d thread%s, cache %.0lf MB%s\n",npts,nthreads,(nthreads>1) ? "s" : "",cachemb,
+         sort ? ", spatial sort" : "");
+  printf("workload  backend     points/s   reads/pt  faults/pt     p50 us     p99 us\n");
+  for (w=0;w<NWORKLOADS;w++)
+  {
+    if (only>=0&&w!=only) continue;
+    makeworkload(w,npts,lat,lon);
+    for (b=0;b<nbackends;b++)
+      runbench(workloads[w],backends[b],conf,cachemb,sort,nthreads,npts,lat,lon,topo,geoid,demid);
+  }
+
+  free(lat);
+  free(lon);
+  free(topo);
+  free(geoid);
+  free(demid);
+
+}
+
+
+int makegrids(const char *dir,char *conf)
+{
+  // Writes any grid missing from dir, and the dataset file naming them
+  int i,lat0,lon0;
+  char path[1100];
+  struct benchgrid grids[40];
+  int ngrids;
+  FILE *fptr;
+  int writegrid(const char *,const struct benchgrid *);
+
+  // The polar DEMs get one band of 64 rows in 2048, GTOPO30 tiles and
+  // EGM2008 one in 4, EGM96 is whole
+  ngrids = 0;
+  grids[ngrids++] = (struct benchgrid){"arcticdem100.flt",74000,75000,GRID_FLOAT32,64,2048};
+  grids[ngrids++] = (struct benchgrid){"remp100.flt",8000,10000,GRID_FLOAT32,64,2048};
+  grids[ngrids++] = (struct benchgrid){"rema100.flt",55000,45042,GRID_FLOAT32,64,2048};
+  grids[ngrids++] = (struct benchgrid){"egm2008.grd",21602,10801,GRID_GEOID08,64,256};
+  grids[ngrids++] = (struct benchgrid){"egm96.dac",1440,721,GRID_GEOID96,721,721};
+  for (lat0=90;lat0>-60;lat0-=50)
+    for (lon0=-180;lon0<180;lon0+=40)
+    {
+      grids[ngrids] = (struct benchgrid){"",4800,6000,GRID_BEINT16,64,256};
+      snprintf(grids[ngrids++].name,32,"gtopo30/%c%03d%c%02d.DEM",(lon0<=0) ? 'W' : 'E',abs(lon0),
+               (lat0<0) ? 'S' : 'N',abs(lat0));
+    }
+  for (lon0=-180;lon0<180;lon0+=60)
+  {
+    grids[ngrids] = (struct benchgrid){"",7200,3600,GRID_BEINT16,64,256};
+    snprintf(grids[ngrids++].name,32,"gtopo30/%c%03dS60.DEM",(lon0<=0) ? 'W' : 'E',abs(lon0));
+  }
+  snprintf(path,sizeof(path),"%s/gtopo30",dir);
+  mkdir(path,0755);
+  for (i=0;i<ngrids;i++)
+  {
+    if (snprintf(path,sizeof(path),"%s/%s",dir,grids[i].name)>=(int)sizeof(path)) return(-1);
+    if (writegrid(path,&grids[i])==-1) return(-1);
+  }
+
+  // Point the library at them, geometry included so a mismatch is caught
+  snprintf(conf,1100,"%s/datasets.conf",dir);
+  if ((fptr=fopen(conf,"w"))==NULL) return(-1);
+  fprintf(fptr,"# Synthetic grids written by querytopobench\n");
+  fprintf(fptr,"AD1 - - %s/arcticdem100.flt -4000000 4100000 100 74000 75000\n",dir);
+  fprintf(fptr,"REP - - %s/remp100.flt -2700000 1800000 100 8000 10000\n",dir);
+  fprintf(fptr,"REM - - %s/rema100.flt -2700000 2300000 100 55000 45042\n",dir);
+  fprintf(fptr,"GT3 - - %s/gtopo30\n",dir);
+  fprintf(fptr,"E08 - - %s/egm2008.grd\n",dir);
+  fprintf(fptr,"E96 - - %s/egm96.dac\n",dir);
+  fclose(fptr);
+  return(0);
+
+}
+
+
+int writegrid(const char *path,const struct benchgrid *g)
+{
+  // Writes one grid unless a file of the right size is already there.
+  // It is written under a temporary name and renamed once complete, so
+  // an interrupted run leaves no grid to be taken for a finished one.
+  char tmppath[1200];
+  int fd,size;
+  long long r,c;
+  float *row;
+  short v;
+  unsigned char *brow;
+  struct stat sb;
+
+  size = (g->type==GRID_BEINT16||g->type==GRID_GEOID96) ? 2 : 4;
+  if (stat(path,&sb)==0&&sb.st_size==g->nx*g->ny*size) return(0);
+  printf("  writing %s\n",g->name);
+  fflush(stdout);
+  if (snprintf(tmppath,sizeof(tmppath),"%s.part",path)>=(int)sizeof(tmppath)) return(-1);
+  if ((fd=open(tmppath,O_WRONLY|O_CREAT|O_TRUNC,0644))==-1) return(-1);
+  if (ftruncate(fd,g->nx*g->ny*size)==-1||(row=(float *)malloc(g->nx*4))==NULL)
+  {
+    close(fd);
+    unlink(tmppath);
+    return(-1);
+  }
+  brow = (unsigned char *)row;
+  for (r=0;r<g->ny;r++)
+  {
+    if (r%g->bandgap>=g->bandrows) continue;
+    for (c=0;c<g->nx;c++)
+    {
+      if (g->type==GRID_FLOAT32)
+      {
+        row[c] = 500.0*sin(r*0.0021)+300.0*cos(c*0.0017)+(r%13)*0.25+(c%7)*0.5;
+        if ((r/700+c/900)%6==0) row[c] = -9999.0;
+      }
+      else if (g->type==GRID_GEOID08)
+        row[c] = (c==0||c==g->nx-1) ? 0.0 : 40.0*sin(r*0.0007)+30.0*cos(c*0.0005);
+      else
+      {
+        if (g->type==GRID_GEOID96)
+          v = (short)(4000.0*sin(r*0.02)+3000.0*cos(c*0.01));
+        else
+          v = ((r/400+c/500)%5==0) ? -9999 : (short)(1000.0*sin(r*0.003)+800.0*cos(c*0.002));
+        brow[2*c] = (v>>8)&0xff;
+        brow[2*c+1] = v&0xff;
+      }
+    }
+    if (pwrite(fd,row,g->nx*size,r*g->nx*size)!=g->nx*size)
+    {
+      free(row);
+      close(fd);
+      unlink(tmppath);
+      return(-1);
+    }
+  }
+  free(row);
+  if (close(fd)==-1||rename(tmppath,path)==-1)
+  {
+    unlink(tmppath);
+    return(-1);
+  }
+  return(0);
+
+}
+
+
+void makeworkload(int w,long n,double *lat,double *lon)
+{
+  // Fills lat/lon with n points of workload w, the same on every run
+  long i;
+  int south;
+  double step,heading,dlat,dlon;
+  unsigned short seed[3];
+
+  seed[0] = 0x5154;
+  seed[1] = 0x4f50;
+  seed[2] = (unsigned short)w;
+  for (i=0;i<n;i++)
+  {
+    if (w==0)  // global, uniform over the sphere
+    {
+      lat[i] = asin(2.0*erand48(seed)-1.0)*180.0/M_PI;
+      lon[i] = 360.0*erand48(seed)-180.0;
+    }
+    else if (w==3)  // gtopo30, south of the equator and north of REMA
+    {
+      lat[i] = -1.0-57.0*erand48(seed);
+      lon[i] = 360.0*erand48(seed)-180.0;
+    }
+    else if (i%1000==0)  // start a new line of 1000 points
+    {
+      south = (erand48(seed)<0.5);
+      if (w==1)  // polar, 100 m apart in any direction over the ice sheets
+      {
+        lat[i] = south ? -70.0-15.0*erand48(seed) : 65.0+15.0*erand48(seed);
+        lon[i] = south ? 360.0*erand48(seed)-180.0 : -55.0+25.0*erand48(seed);
+        heading = 2.0*M_PI*erand48(seed);
+        step = 100.0;
+      }
+      else  // coast, 500 m apart poleward off the DEM edges
+      {
+        lat[i] = south ? -58.0-4.0*erand48(seed) : 40.0+10.0*erand48(seed);
+        lon[i] = 360.0*erand48(seed)-180.0;
+        heading = south ? M_PI : 0.0;
+        step = 500.0;
+      }
+      dlat = step*cos(heading)/111195.0;
+      dlon = step*sin(heading)/111195.0;
+    }
+    else
+    {
+      lat[i] = lat[i-1]+dlat;
+      lon[i] = lon[i-1]+dlon/cos(lat[i-1]*M_PI/180.0);
+      if (lat[i]>89.9) lat[i] = 89.9;
+      if (lat[i]<-89.9) lat[i] = -89.9;
+    }
+    while (lon[i]<=-180.0) lon[i]+=360.0;
+    while (lon[i]>180.0) lon[i]-=360.0;
+  }
+
+}
+
+
+int checkprojection(long n)
+{
+  // Projects n points with projectpolar and with geod2ps and reports the
+  // largest difference and the time per point of each.  Returns -1 if
+  // any point differs by 1 mm or more.
+  long i,worst;
+  long long t0,t1,t2;
+  double d,maxd,gx,gy,*lat,*lon,*x,*y;
+  unsigned short seed[3];
+  struct topocontext *ctx;
+  long long nowus();
+
+  lat = (double *)malloc(n*sizeof(double));
+  lon = (double *)malloc(n*sizeof(double));
+  x = (double *)malloc(n*sizeof(double));
+  y = (double *)malloc(n*sizeof(double));
+  if (lat==NULL||lon==NULL||x==NULL||y==NULL||(ctx=inittopocontext())==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+
+  // Alternate hemispheres, over the polar DEMs and on towards the
+  // equator, with every tenth point within 1e-9 deg of the pole and
+  // every thousandth on it
+  seed[0] = 0x5053;
+  seed[1] = 0x4348;
+  seed[2] = 0x4b00;
+  for (i=0;i<n;i++)
+  {
+    if (i%1000<2) lat[i] = 90.0;
+    else if (i%10<2) lat[i] = 90.0-1.0e-9*erand48(seed);
+    else lat[i] = 90.0*erand48(seed);
+    if (i%2) lat[i] = -lat[i];
+    lon[i] = (i%500<2) ? 180.0 : 360.0*erand48(seed)-180.0;
+  }
+
+  // Both ways, timed
+  t0 = nowus();
+  projectpolar(ctx,n,lat,lon,x,y);
+  t1 = nowus();
+  maxd = 0.0;
+  worst = 0;
+  for (i=0;i<n;i++)
+  {
+    geod2ps(lat[i],lon[i],(lat[i]<0.0) ? -71.0 : 70.0,(lat[i]<0.0) ? 0.0 : -45.0,1.0,AE,FLAT,&gx,&gy);
+    if ((d=hypot(x[i]-gx,y[i]-gy))>maxd||d!=d)
+    {
+      maxd = d;
+      worst = i;
+    }
+  }
+  t2 = nowus();
+  printf("Polar stereographic, %ld points: max difference from geod2ps %.3g m at %.10lf %.10lf\n",n,maxd,
+         lat[worst],lon[worst]);
+  printf("%.0lf ns/point, geod2ps %.0lf\n",1000.0*(t1-t0)/n,1000.0*(t2-t1)/n);
+
+  closetopocontext(ctx);
+  free(lat);
+  free(lon);
+  free(x);
+  free(y);
+  return((maxd<1.0e-3) ? 0 : -1);
+
+}
+
+
+void runbench(const char *workload,const char *backend,const char *conf,double cachemb,int sort,
+              int nthreads,long n,const double *lat,const double *lon,double *topo,double *geoid,int *demid)
+{
+  // Times one workload through one backend and prints a line of results
+  char geoidid[10];
+  int j,pass;
+  long i,share;
+  long long t0,t1,reads0,reads1,faults0,faults1,us[NLATENCY];
+  struct topocontext *ctx;
+  struct benchjob jobs[MAXTHREADS];
+  pthread_t threads[MAXTHREADS];
+  void *runbenchjob(void *);
+  long long nowus();
+  long long readcount();
+  long long faultcount();
+  int comparelonglong(const void *,const void *);
+
+  if ((ctx=inittopocontext())==NULL||setiobackend(ctx,backend)==-1||
+      setcachesize(ctx,(long long)(cachemb*1048576.0))==-1||loaddatasets(ctx,conf)!=0)
+  {
+    printf("Cannot set up a %s context - exiting\n",backend);
+    exit(-1);
+  }
+  setspatialsort(ctx,sort);
+
+  // Split the points between the threads, then run once to open the
+  // files and fill the page cache, and once timed
+  share = (n+nthreads-1)/nthreads;
+  for (j=0;j<nthreads;j++)
+  {
+    jobs[j].ctx = ctx;
+    jobs[j].lat = lat+j*share;
+    jobs[j].lon = lon+j*share;
+    jobs[j].topo = topo+j*share;
+    jobs[j].geoid = geoid+j*share;
+    jobs[j].demid = demid+j*share;
+    jobs[j].n = (j*share>=n) ? 0 : ((n-j*share<share) ? n-j*share : share);
+  }
+  for (pass=0;pass<2;pass++)
+  {
+    t0 = nowus();
+    reads0 = readcount();
+    faults0 = faultcount();
+    for (j=0;j<nthreads;j++)
+      if (pthread_create(&threads[j],NULL,runbenchjob,&jobs[j])!=0)
+      {
+        printf("Cannot start threads - exiting\n");
+        exit(-1);
+      }
+    for (j=0;j<nthreads;j++) pthread_join(threads[j],NULL);
+    t1 = nowus();
+    reads1 = readcount();
+    faults1 = faultcount();
+  }
+
+  // Latency of single-point queries over a sample of the points
+  for (i=0;i<NLATENCY&&i<n;i++)
+  {
+    us[i] = nowus();
+    querytopobatch(ctx,1,&lat[i*(n/NLATENCY+1)%n],&lon[i*(n/NLATENCY+1)%n],1,topo,geoid,demid,geoidid);
+    us[i] = nowus()-us[i];
+  }
+  qsort(us,i,sizeof(long long),comparelonglong);
+  printf("%-9s %-7s %12.0lf %10.3lf %10.3lf %10.1lf %10.1lf\n",workload,backend,
+         n/((t1-t0+1)/1.0e6),(double)(reads1-reads0)/n,(double)(faults1-faults0)/n,
+         (double)us[i/2],(double)us[(i*99)/100]);
+  fflush(stdout);
+  closetopocontext(ctx);
+
+}
+
+
+void *runbenchjob(void *arg)
+{
+  char geoidid[10];
+  long k,m;
+  struct benchjob *job = (struct benchjob *)arg;
+
+  for (k=0;k<job->n;k+=BENCHBLOCK)
+  {
+    m = (job->n-k<BENCHBLOCK) ? job->n-k : BENCHBLOCK;
+    if (querytopobatch(job->ctx,m,job->lat+k,job->lon+k,1,job->topo+k,job->geoid+k,job->demid+k,geoidid)==-1)
+    {
+      printf("Out of memory - exiting\n");
+      exit(-1);
+    }
+  }
+  return(NULL);
+
+}
+
+
+long long readcount()
+{
+  // Read syscalls made by the process so far
+  char line[128];
+  long long n;
+  FILE *fptr;
+
+  n = 0;
+  if ((fptr=fopen("/proc/self/io","r"))==NULL) return(0);
+  while (fgets(line,sizeof(line),fptr)!=NULL)
+    if (!strncmp(line,"syscr:",6)) n = atoll(line+6);
+  fclose(fptr);
+  return(n);
+
+}
+
+
+long long faultcount()
+{
+  // Page faults taken by the process so far
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF,&ru);
+  return((long long)ru.ru_minflt+ru.ru_majflt);
+
+}
+
+
+long long nowus()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((long long)ts.tv_sec*1000000+ts.tv_nsec/1000);
+
+}
+
+
+int comparelonglong(const void *a,const void *b)
+{
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+
+  return((x>y)-(x<y));
+
+}
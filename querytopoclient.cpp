@@ -0,0 +1,191 @@
+/*------------------------------------------------------------------------*
+ NAME:     querytopoclient.cpp
+
+ PURPOSE:  Test client for querytopod.  Sends the points of a lat/lon
+           file to the server in requests of up to -n points and prints
+           the results in the same format as querytopo2, so the two can
+           be compared directly.  With -s it prints the server statistics
+           afterwards, or only those if no file is given.
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "querytopo.h"
+#include "querytopod.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+main(int argc, char *argv[])
+{
+  char *line,wpname[10];
+  int opt,fd,htrefflag,npoints,stats,i;
+  size_t linesize;
+  double lat,lon,*latlon;
+  struct sockaddr_un addr;
+  struct qtrequest req;
+  struct qtreply rep;
+  struct qtresult *res;
+  struct qtstats st;
+  FILE *fptr;
+  int readall(int,void *,long);
+  int writeall(int,const void *,long);
+
+  // Check input
+  npoints = 4096;
+  stats = 0;
+  while ((opt=getopt(argc,argv,"n:s"))!=-1)
+  {
+    if (opt=='n'&&(npoints=atoi(optarg))>=1&&npoints<=QTMAXPOINTS) continue;
+    if (opt=='s') { stats = 1; continue; }
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind!=3&&!(stats&&argc-optind==1))
+  {
+    printf("Usage: querytopoclient [-n points per request] [-s] <socket path> [<latlon filename> <height ref (1=geoid 2=ellipsoid)>]\n");
+    exit(0);
+  }
+
+  // Connect to the server
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path,sizeof(addr.sun_path),"%s",argv[optind]);
+  if ((fd=socket(AF_UNIX,SOCK_STREAM,0))==-1||connect(fd,(struct sockaddr *)&addr,sizeof(addr))==-1)
+  {
+    printf("Cannot connect to %s - exiting\n",argv[optind]);
+    exit(-1);
+  }
+  latlon = (double *)malloc(16L*npoints);
+  res = (struct qtresult *)malloc(sizeof(struct qtresult)*npoints);
+  if (latlon==NULL||res==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+
+  // Query the points of the file a request at a time
+  if (argc-optind==3)
+  {
+    if ((fptr=fopen(argv[optind+1],"r"))==NULL)
+    {
+      printf("Input file %s not found - exiting\n",argv[optind+1]);
+      exit(-1);
+    }
+    htrefflag = atoi(argv[optind+2]);
+    if (htrefflag<1||htrefflag>2)
+    {
+      printf("Unrecognized height reference - exiting\n");
+      exit(-1);
+    }
+    line = NULL;
+    linesize = 0;
+    lat = lon = 0.0;
+    req.magic = QTMAGIC;
+    req.op = QT_QUERY;
+    req.htrefflag = htrefflag;
+    req.npoints = 0;
+    while (1)
+    {
+      i = getline(&line,&linesize,fptr);
+      if (i!=-1)
+      {
+        sscanf(line,"%lf %lf %9s",&lat,&lon,wpname);
+        latlon[2*req.npoints] = lat;
+        latlon[2*req.npoints+1] = lon;
+        req.npoints++;
+      }
+      if (req.npoints==0||(req.npoints<npoints&&i!=-1))
+      {
+        if (i==-1) break;
+        continue;
+      }
+
+      // Send the request and print its results
+      if (writeall(fd,&req,sizeof(req))==-1||writeall(fd,latlon,16L*req.npoints)==-1||
+          readall(fd,&rep,sizeof(rep))==-1||rep.status!=0||
+          readall(fd,res,(long)sizeof(struct qtresult)*rep.npoints)==-1)
+      {
+        printf("Request to %s failed - exiting\n",argv[optind]);
+        exit(-1);
+      }
+      for (i=0;i<rep.npoints;i++)
+      {
+        lon = latlon[2*i+1];
+        if (isfinite(lon)&&(lon<=-180.0||lon>180.0))
+        {
+          lon = fmod(lon,360.0);
+          if (lon<=-180.0) lon += 360.0;
+          if (lon>180.0) lon -= 360.0;
+        }
+        if (res[i].demid!=DEM_NONE)
+          printf("%8.4lf %9.4lf %8.2lf %3s %7.2lf %3s\n",latlon[2*i],lon,res[i].topo,
+                 demproductname(res[i].demid),res[i].geoid,rep.geoidid);
+        else if (!isfinite(latlon[2*i])||!isfinite(lon))
+          printf("position %lf %lf is not finite\n",latlon[2*i],latlon[2*i+1]);
+        else
+          printf("latitude of %lf is out of bounds\n",latlon[2*i]);
+      }
+      req.npoints = 0;
+    }
+    free(line);
+    fclose(fptr);
+  }
+
+  // Server statistics
+  if (stats)
+  {
+    req.magic = QTMAGIC;
+    req.op = QT_STATS;
+    req.htrefflag = 0;
+    req.npoints = 0;
+    if (writeall(fd,&req,sizeof(req))==-1||readall(fd,&rep,sizeof(rep))==-1||rep.status!=0||
+        readall(fd,&st,sizeof(st))==-1)
+    {
+      printf("Request to %s failed - exiting\n",argv[optind]);
+      exit(-1);
+    }
+    printf("%lld requests, %lld points, %d of %d workers busy\n",st.requests,st.points,st.busy,st.workers);
+    printf("latency ms: p50 %.3lf  p90 %.3lf  p99 %.3lf  max %.3lf\n",st.p50,st.p90,st.p99,st.max);
+    printf("block cache: %lld hits, %lld misses\n",st.cachehits,st.cachemisses);
+  }
+  close(fd);
+  free(latlon);
+  free(res);
+
+}
+
+
+int readall(int fd,void *buf,long len)
+{
+  long n;
+
+  while (len>0)
+  {
+    if ((n=read(fd,buf,len))<=0) return(-1);
+    buf = (char *)buf+n;
+    len -= n;
+  }
+  return(0);
+
+}
+
+
+int writeall(int fd,const void *buf,long len)
+{
+  long n;
+
+  while (len>0)
+  {
+    if ((n=write(fd,buf,len))<=0) return(-1);
+    buf = (const char *)buf+n;
+    len -= n;
+  }
+  return(0);
+
+}
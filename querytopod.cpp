@@ -0,0 +1,521 @@
+/*------------------------------------------------------------------------*
+ NAME:     querytopod.cpp
+
+ PURPOSE:  Long-running query server.  Opens one topocontext and answers
+           batched point queries from any number of local clients over a
+           Unix domain socket, using the protocol in querytopod.h.  Grid
+           files are mapped once and the block cache and geoid grids stay
+           warm between requests, instead of each planner forking its
+           own querytopo2.  The main thread accepts connections and polls
+           the idle ones, handing each request as it arrives to a pool of
+           worker threads, so a client that holds its connection open
+           between requests doesn't tie up a worker.  querytopoclient is a
+           small client for testing.  -b, -c, -d, -g/-G, -s and -v are as
+           for querytopo2, and -j sets the number of workers.
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "querytopo.h"
+#include "querytopod.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+#define MAXWORKERS 256
+#define MAXCONNS 1024   // open connections, more wait in the listen queue
+#define IOTIMEOUT 10    // s a worker waits on a client partway through a request
+#define NLATBINS 256    // latency histogram, 8 bins per doubling of us
+
+// Shared by all workers
+struct server
+{
+  struct topocontext *ctx;
+  int listenfd;
+  int wakefd[2];           // pipe on which workers hand connections back, -1 for one closed
+  int workers;
+  pthread_mutex_t lock;    // guards the queue and counts below
+  pthread_cond_t ready;    // signalled when a connection is queued
+  int queue[MAXCONNS];     // connections with a request waiting, oldest at head
+  int head,nqueue;
+  int busy;
+  long long requests,points;
+  long long latbins[NLATBINS];
+  double maxms;
+};
+
+// Each worker's buffers, grown with the largest request it has served
+struct workbuffers
+{
+  long maxpoints;
+  double *latlon,*lat,*lon,*topo,*geoid;
+  int *demid;
+  struct qtresult *res;
+};
+
+char *socketpath;
+
+
+main(int argc, char *argv[])
+{
+  int opt,i,status;
+  double geoidmb;
+  const char *dsfile;
+  int geoidpacked;
+  struct sockaddr_un addr;
+  struct server srv;
+  pthread_t threads[MAXWORKERS];
+  void *serverequests(void *);
+  void dispatchrequests(struct server *);
+  void stopserver(int);
+
+  // Check input
+  if ((srv.ctx=inittopocontext())==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+  srv.workers = 4;
+  geoidmb = -1.0;
+  geoidpacked = 0;
+  dsfile = NULL;
+  while ((opt=getopt(argc,argv,"b:c:d:g:G:j:sv"))!=-1)
+  {
+    if (opt=='b'&&setiobackend(srv.ctx,optarg)==0) continue;
+    if (opt=='c'&&atof(optarg)>=0.0&&setcachesize(srv.ctx,(long long)(atof(optarg)*1048576.0))==0) continue;
+    if (opt=='d') { dsfile = optarg; continue; }
+    if ((opt=='g'||opt=='G')&&(geoidmb=atof(optarg))>=0.0) { geoidpacked = (opt=='G'); continue; }
+    if (opt=='j'&&(srv.workers=atoi(optarg))>=1&&srv.workers<=MAXWORKERS) continue;
+    if (opt=='s'&&setspatialsort(srv.ctx,1)==0) continue;
+    if (opt=='v'&&setprereferenced(srv.ctx,1)==0) continue;
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind != 1)
+  {
+    printf("Usage: querytopod [-b mmap|stdio] [-c cache MB] [-d dataset file] [-g|-G geoid MB] [-j workers] [-s] [-v] <socket path>\n");
+    exit(0);
+  }
+  socketpath = argv[optind];
+  if (strlen(socketpath)>=sizeof(addr.sun_path))
+  {
+    printf("Socket path %s is too long - exiting\n",socketpath);
+    exit(-1);
+  }
+
+  // Dataset locations, before any file is opened
+  if ((status=loaddatasets(srv.ctx,dsfile))!=0)
+  {
+    if (status==-1) printf("Cannot read dataset file - exiting\n");
+    else printf("Line %d of dataset file not understood - exiting\n",status);
+    exit(-1);
+  }
+
+  // Load the geoid grids once up front if asked, -G packs EGM2008 in cm
+  if (geoidmb>=0.0&&setgeoidmemory(srv.ctx,(long long)(geoidmb*1048576.0),geoidpacked)==-1)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+
+  // Listen on the socket, replacing one left by an earlier server
+  if ((srv.listenfd=socket(AF_UNIX,SOCK_STREAM,0))==-1)
+  {
+    printf("Cannot create socket - exiting\n");
+    exit(-1);
+  }
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path,socketpath);
+  unlink(socketpath);
+  if (bind(srv.listenfd,(struct sockaddr *)&addr,sizeof(addr))==-1||listen(srv.listenfd,128)==-1)
+  {
+    printf("Cannot listen on %s - exiting\n",socketpath);
+    exit(-1);
+  }
+  if (pipe(srv.wakefd)==-1)
+  {
+    printf("Cannot create pipe - exiting\n");
+    exit(-1);
+  }
+  signal(SIGINT,stopserver);
+  signal(SIGTERM,stopserver);
+  signal(SIGPIPE,SIG_IGN);  // a client that hangs up just ends its connection
+
+  // Start the worker pool and serve until stopped
+  pthread_mutex_init(&srv.lock,NULL);
+  pthread_cond_init(&srv.ready,NULL);
+  srv.head = srv.nqueue = 0;
+  srv.busy = 0;
+  srv.requests = 0;
+  srv.points = 0;
+  srv.maxms = 0.0;
+  memset(srv.latbins,0,sizeof(srv.latbins));
+  for (i=0;i<srv.workers;i++)
+    if (pthread_create(&threads[i],NULL,serverequests,&srv)!=0)
+    {
+      printf("Cannot start worker threads - exiting\n");
+      exit(-1);
+    }
+  printf("Serving on %s with %d workers\n",socketpath,srv.workers);
+  fflush(stdout);
+  dispatchrequests(&srv);
+
+}
+
+
+void stopserver(int sig)
+{
+  unlink(socketpath);
+  _exit(0);
+}
+
+
+void dispatchrequests(struct server *srv)
+{
+  int fd,i,n,nconns,nopen,full,conns[MAXCONNS];
+  struct pollfd pfd[MAXCONNS+2];
+  struct timeval tv;
+
+  // Poll the listening socket, the workers' pipe and every connection not
+  // with a worker.  A connection with a request waiting is queued for the
+  // workers, who hand it back on the pipe once they have answered.
+  nconns = nopen = full = 0;
+  while (1)
+  {
+    pfd[0].fd = (nopen<MAXCONNS) ? srv->listenfd : -1;
+    pfd[1].fd = srv->wakefd[0];
+    pfd[0].events = pfd[1].events = POLLIN;
+    for (i=0;i<nconns;i++)
+    {
+      pfd[2+i].fd = conns[i];
+      pfd[2+i].events = POLLIN;
+    }
+    if (poll(pfd,2+nconns,-1)==-1) continue;
+
+    // Queue connections with a request, or hung up, for the workers
+    pthread_mutex_lock(&srv->lock);
+    for (i=nconns-1;i>=0;i--)
+      if (pfd[2+i].revents)
+      {
+        srv->queue[(srv->head+srv->nqueue++)%MAXCONNS] = conns[i];
+        conns[i] = conns[--nconns];
+        pthread_cond_signal(&srv->ready);
+      }
+    pthread_mutex_unlock(&srv->lock);
+
+    // Connections handed back, still open or closed
+    if (pfd[1].revents&&read(srv->wakefd[0],&fd,sizeof(fd))==sizeof(fd))
+    {
+      if (fd>=0) conns[nconns++] = fd;
+      else nopen--;
+    }
+
+    // New clients.  Out of file descriptors, back off and let the clients
+    // wait in the listen queue rather than spin on accept.
+    if (pfd[0].revents)
+    {
+      if ((fd=accept(srv->listenfd,NULL,NULL))==-1)
+      {
+        if (errno==EMFILE||errno==ENFILE)
+        {
+          if (!full) printf("Out of file descriptors with %d connections open\n",nopen);
+          fflush(stdout);
+          full = 1;
+          usleep(100000);
+        }
+        continue;
+      }
+      full = 0;
+
+      // A client stalling partway through a request is dropped rather
+      // than holding its worker
+      tv.tv_sec = IOTIMEOUT;
+      tv.tv_usec = 0;
+      setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+      setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+      conns[nconns++] = fd;
+      nopen++;
+    }
+  }
+
+}
+
+
+void *serverequests(void *arg)
+{
+  int fd,more;
+  struct pollfd pfd;
+  struct workbuffers buf;
+  struct server *srv = (struct server *)arg;
+  int serverequest(struct server *,int,struct workbuffers *);
+
+  memset(&buf,0,sizeof(buf));
+  while (1)
+  {
+    pthread_mutex_lock(&srv->lock);
+    while (srv->nqueue==0) pthread_cond_wait(&srv->ready,&srv->lock);
+    fd = srv->queue[srv->head];
+    srv->head = (srv->head+1)%MAXCONNS;
+    srv->nqueue--;
+    srv->busy++;
+    pthread_mutex_unlock(&srv->lock);
+
+    // Answer the request waiting, and any more the client has already
+    // sent while no other connection is waiting for a worker
+    do
+    {
+      if (serverequest(srv,fd,&buf)==-1)
+      {
+        close(fd);
+        fd = -1;
+        break;
+      }
+      pthread_mutex_lock(&srv->lock);
+      more = (srv->nqueue==0);
+      pthread_mutex_unlock(&srv->lock);
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+    }
+    while (more&&poll(&pfd,1,0)==1);
+    pthread_mutex_lock(&srv->lock);
+    srv->busy--;
+    pthread_mutex_unlock(&srv->lock);
+    write(srv->wakefd[1],&fd,sizeof(fd));
+  }
+  return(NULL);
+
+}
+
+
+int serverequest(struct server *srv,int fd,struct workbuffers *buf)
+{
+  // Reads one request from a connection and answers it.  Returns -1 if
+  // the client has closed the connection, timed out or is out of step,
+  // and the connection should be closed.
+  int status;
+  long long t0,us;
+  struct qtrequest req;
+  struct qtreply rep;
+  struct qtstats stats;
+  int readall(int,void *,long);
+  int writeall(int,const void *,long);
+  int growbuffers(long,struct workbuffers *);
+  int runquery(struct topocontext *,long,int,const double *,double *,double *,double *,double *,
+               int *,struct qtresult *,char *);
+  void getstats(struct server *,struct qtstats *);
+  void addlatency(struct server *,long long);
+  long long nowus();
+
+  if (readall(fd,&req,sizeof(req))==-1) return(-1);
+  t0 = nowus();
+  memset(&rep,0,sizeof(rep));
+  rep.magic = QTMAGIC;
+  if (req.magic!=QTMAGIC||req.npoints<0||req.npoints>QTMAXPOINTS||
+      (req.op!=QT_QUERY&&req.op!=QT_STATS)||req.htrefflag<0||req.htrefflag>2)
+  {
+    rep.status = -1;
+    writeall(fd,&rep,sizeof(rep));
+    return(-1);  // out of step with the client, drop it
+  }
+
+  // Statistics are just the reply header and counts
+  if (req.op==QT_STATS)
+  {
+    getstats(srv,&stats);
+    if (writeall(fd,&rep,sizeof(rep))==-1||writeall(fd,&stats,sizeof(stats))==-1) return(-1);
+    return(0);
+  }
+
+  // Read the points, query them and send back the results
+  if (req.npoints>buf->maxpoints)
+  {
+    if (growbuffers(req.npoints,buf)==-1)
+    {
+      buf->maxpoints = 0;
+      rep.status = -2;
+      writeall(fd,&rep,sizeof(rep));
+      return(-1);
+    }
+    buf->maxpoints = req.npoints;
+  }
+  if (readall(fd,buf->latlon,16L*req.npoints)==-1) return(-1);
+  status = runquery(srv->ctx,req.npoints,req.htrefflag,buf->latlon,buf->lat,buf->lon,buf->topo,buf->geoid,
+                    buf->demid,buf->res,rep.geoidid);
+  if (status==-1)
+  {
+    rep.status = -2;
+    writeall(fd,&rep,sizeof(rep));
+    return(-1);
+  }
+  rep.npoints = req.npoints;
+  if (writeall(fd,&rep,sizeof(rep))==-1||writeall(fd,buf->res,(long)sizeof(struct qtresult)*req.npoints)==-1)
+    return(-1);
+  us = nowus()-t0;
+  pthread_mutex_lock(&srv->lock);
+  srv->requests++;
+  srv->points += req.npoints;
+  pthread_mutex_unlock(&srv->lock);
+  addlatency(srv,us);
+  return(0);
+
+}
+
+
+int runquery(struct topocontext *ctx,long n,int htrefflag,const double *latlon,double *lat,double *lon,
+             double *topo,double *geoid,int *demid,struct qtresult *res,char *geoidid)
+{
+  long i;
+  double x;
+
+  // Split the pairs into columns, wrapping longitudes into (-180,180].
+  // A point with a NaN or infinite coordinate is given an out of bounds
+  // latitude, so it is answered DEM_NONE like any other.
+  for (i=0;i<n;i++)
+  {
+    lat[i] = latlon[2*i];
+    x = latlon[2*i+1];
+    if (!isfinite(lat[i])||!isfinite(x))
+    {
+      lat[i] = -999.0;
+      x = 0.0;
+    }
+    if (x<=-180.0||x>180.0)
+    {
+      x = fmod(x,360.0);  // exact, so even a huge value lands in range
+      if (x<=-180.0) x += 360.0;
+      if (x>180.0) x -= 360.0;
+    }
+    lon[i] = x;
+  }
+  if (querytopobatch(ctx,n,lat,lon,htrefflag,topo,geoid,demid,geoidid)==-1) return(-1);
+  for (i=0;i<n;i++)
+  {
+    res[i].topo = (demid[i]!=DEM_NONE) ? topo[i] : -9999.0;
+    res[i].geoid = geoid[i];
+    res[i].demid = demid[i];
+    res[i].spare = 0;
+  }
+  return(0);
+
+}
+
+
+int growbuffers(long n,struct workbuffers *buf)
+{
+  free(buf->latlon);
+  free(buf->lat);
+  free(buf->lon);
+  free(buf->topo);
+  free(buf->geoid);
+  free(buf->demid);
+  free(buf->res);
+  buf->latlon = (double *)malloc(16*n);
+  buf->lat = (double *)malloc(8*n);
+  buf->lon = (double *)malloc(8*n);
+  buf->topo = (double *)malloc(8*n);
+  buf->geoid = (double *)malloc(8*n);
+  buf->demid = (int *)malloc(sizeof(int)*n);
+  buf->res = (struct qtresult *)malloc(sizeof(struct qtresult)*n);
+  if (buf->latlon==NULL||buf->lat==NULL||buf->lon==NULL||buf->topo==NULL||buf->geoid==NULL||
+      buf->demid==NULL||buf->res==NULL)
+    return(-1);
+  return(0);
+
+}
+
+
+void addlatency(struct server *srv,long long us)
+{
+  int bin;
+
+  bin = (int)(8.0*log2(us+1.0));
+  if (bin>=NLATBINS) bin = NLATBINS-1;
+  pthread_mutex_lock(&srv->lock);
+  srv->latbins[bin]++;
+  if (us/1000.0>srv->maxms) srv->maxms = us/1000.0;
+  pthread_mutex_unlock(&srv->lock);
+
+}
+
+
+void getstats(struct server *srv,struct qtstats *stats)
+{
+  int bin,k;
+  long long total,sum;
+  double frac[3],*pct[3];
+
+  memset(stats,0,sizeof(*stats));
+  getcachestats(srv->ctx,&stats->cachehits,&stats->cachemisses);
+  pthread_mutex_lock(&srv->lock);
+  stats->requests = srv->requests;
+  stats->points = srv->points;
+  stats->workers = srv->workers;
+  stats->busy = srv->busy;
+  stats->max = srv->maxms;
+
+  // Percentiles are the upper edge of the bin they fall in
+  frac[0] = 0.50; pct[0] = &stats->p50;
+  frac[1] = 0.90; pct[1] = &stats->p90;
+  frac[2] = 0.99; pct[2] = &stats->p99;
+  for (total=0,bin=0;bin<NLATBINS;bin++) total += srv->latbins[bin];
+  for (k=0;k<3&&total>0;k++)
+  {
+    for (sum=0,bin=0;bin<NLATBINS-1&&(sum+=srv->latbins[bin])<frac[k]*total;bin++);
+    *pct[k] = (pow(2.0,(bin+1)/8.0)-1.0)/1000.0;
+    if (*pct[k]>stats->max) *pct[k] = stats->max;
+  }
+  pthread_mutex_unlock(&srv->lock);
+
+}
+
+
+int readall(int fd,void *buf,long len)
+{
+  long n;
+
+  while (len>0)
+  {
+    if ((n=read(fd,buf,len))<=0) return(-1);
+    buf = (char *)buf+n;
+    len -= n;
+  }
+  return(0);
+
+}
+
+
+int writeall(int fd,const void *buf,long len)
+{
+  long n;
+
+  while (len>0)
+  {
+    if ((n=write(fd,buf,len))<=0) return(-1);
+    buf = (const char *)buf+n;
+    len -= n;
+  }
+  return(0);
+
+}
+
+
+long long nowus()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((long long)ts.tv_sec*1000000+ts.tv_nsec/1000);
+
+}
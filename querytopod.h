@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------------*
+ NAME:     querytopod.h
+
+ PURPOSE:  Protocol spoken over the Unix domain socket of querytopod, the
+           long-running query server.  A client connects, then sends any
+           number of requests on the connection, each answered in turn.
+           All values are in native byte order, the socket being local.
+
+           Query:  struct qtrequest (op QT_QUERY), then npoints pairs of
+                   float64 lat, lon
+           Reply:  struct qtreply, then npoints struct qtresult
+           Stats:  struct qtrequest (op QT_STATS, npoints 0)
+           Reply:  struct qtreply (npoints 0), then struct qtstats
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#ifndef QUERYTOPOD_H
+#define QUERYTOPOD_H
+
+#define QTMAGIC 0x51545044     // "QTPD"
+#define QTMAXPOINTS 1048576    // points allowed in one request
+
+#define QT_QUERY 1
+#define QT_STATS 2
+
+struct qtrequest
+{
+  int magic;               // QTMAGIC
+  int op;                  // QT_QUERY or QT_STATS
+  int htrefflag;           // 0 native, 1 geoid, 2 ellipsoid, as in querytopobatch
+  int npoints;
+};
+
+struct qtreply
+{
+  int magic;               // QTMAGIC
+  int status;              // 0 ok, -1 bad request, -2 out of memory
+  int npoints;             // results that follow
+  char geoidid[4];         // 3-character geoid id
+};
+
+struct qtresult
+{
+  double topo;             // topography, -9999 if out of bounds
+  double geoid;            // geoid height
+  int demid;               // enum demproduct, DEM_NONE if out of bounds or not finite
+  int spare;
+};
+
+// Server-wide counts since start.  Latencies are from a request being
+// read to its reply being written, in ms, to the resolution of the
+// server's histogram (about 9%).
+struct qtstats
+{
+  long long requests;
+  long long points;
+  long long cachehits,cachemisses;
+  int workers;             // size of the worker pool
+  int busy;                // workers serving a request now
+  double p50,p90,p99,max;
+};
+
+#endif
@@ -0,0 +1,48 @@
+/*------------------------------------------------------------------------*
+ NAME:     refgrid.h
+
+ PURPOSE:  Layout of the pre-referenced DEM (.ref) files written by
+           buildrefgrid and read by libquerytopo.  A .ref file holds the
+           pixels of one DEM grid, or of one GTOPO30 tile, in both height
+           references side by side: above the WGS-84 ellipsoid and above
+           the geoid, the two differing by the geoid height at the pixel
+           centre.  A query can then take its height in either reference,
+           and the geoid height as the difference, from the same four
+           corner reads, instead of reading the geoid grid as well.
+
+           File layout, all values in native byte order:
+             struct refgridheader               at offset 0
+             struct refgridpixel[nx*ny]         row-major, from offset
+                                                sizeof(struct refgridheader)
+
+           DEM no data (-9999) is kept as -9999 in both; GTOPO30 ocean is
+           stored as 0 above the geoid, as the point queries count it.
+           A .ref file describes the DEM and geoid it was built from, so
+           rebuild it whenever either is replaced.
+
+ DATE:     17 October 2026
+ *------------------------------------------------------------------------*/
+
+#ifndef REFGRID_H
+#define REFGRID_H
+
+#define REFGRIDMAGIC "QTREFGR"  // 7 characters plus the terminating 0
+#define REFGRIDVERSION 1
+
+struct refgridheader
+{
+  char magic[8];           // REFGRIDMAGIC
+  int version;             // REFGRIDVERSION
+  int nx,ny;               // columns and rows of the DEM grid or tile
+  int demid;               // enum demproduct of the DEM
+  char geoidid[4];         // geoid the heights were referenced with, "E08" or "E96"
+  char spare[4];
+};
+
+struct refgridpixel
+{
+  float ell;               // height above the WGS-84 ellipsoid, m
+  float orth;              // height above the geoid, m
+};
+
+#endif
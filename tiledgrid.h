@@ -0,0 +1,95 @@
+/*------------------------------------------------------------------------*
+ NAME:     tiledgrid.h
+
+ PURPOSE:  Layout of the tiled grid (.tfl) files written by tileflt and
+           read by libquerytopo.  A tiled grid holds the same float32
+           pixels as a row-major .flt raster, cut into square tiles that
+           are each stored contiguously.  With the default 32x32 pixel
+           tiles each tile is exactly one 4 KB page, so the four corners
+           of a bilinear lookup nearly always come from a single page.
+
+           File layout, all values in native byte order:
+             struct tiledheader          at offset 0
+             struct tileentry[ntiles]    at indexoffset, row-major by tile
+             tile data                   from dataoffset, page aligned
+           Tiles on the right and bottom edges are padded to full size.
+
+           Each tile has its own codec.  Plain tiles are stored raw.
+           Files made with tileflt -z store tiles of a single value
+           (mostly -9999 no data) as just that value in the index, and
+           deflate the rest when that makes them smaller.
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#ifndef TILEDGRID_H
+#define TILEDGRID_H
+
+#include <string.h>
+
+#define TILEDMAGIC "QTTILED"  // 7 characters plus the terminating 0
+#define TILEDVERSION 1
+#define TILEDALIGN 4096       // tile data starts on a page boundary
+#define TILEDDEFAULTDIM 32    // 32x32 float32 pixels = 4096 bytes
+
+#define TILECODEC_RAW 0       // tiledim*tiledim float32 pixels, row-major
+#define TILECODEC_CONST 1     // every pixel is value, nothing stored
+#define TILECODEC_DEFLATE 2   // pixels XOR'd with their predecessor, byte-shuffled, deflated
+
+struct tiledheader
+{
+  char magic[8];           // TILEDMAGIC
+  int version;             // TILEDVERSION
+  int nx,ny;               // columns and rows of the full grid
+  int tiledim;             // pixels on a side of a tile
+  int ntilesx,ntilesy;     // tiles across and down the grid
+  long long indexoffset;   // byte offset of the tile index
+  long long dataoffset;    // byte offset of the first tile
+  char spare[16];
+};
+
+struct tileentry
+{
+  union
+  {
+    long long offset;      // byte offset of the tile
+    float value;           // pixel value of a TILECODEC_CONST tile
+  };
+  int size;                // stored bytes of the tile
+  int codec;               // TILECODEC_*
+};
+
+
+// Forward and inverse pixel transforms of TILECODEC_DEFLATE.  XOR with
+// the previous pixel zeroes the sign, exponent and leading mantissa bits
+// of smooth terrain, and shuffling gathers like bytes together, so
+// deflate finds long runs.
+static inline void packtile(const float *tile,unsigned char *out,int npix)
+{
+  int i,b;
+  unsigned int prev,bits;
+
+  prev = 0;
+  for (i=0;i<npix;i++)
+  {
+    memcpy(&bits,&tile[i],4);
+    for (b=0;b<4;b++) out[b*npix+i] = ((bits^prev)>>(8*b))&0xff;
+    prev = bits;
+  }
+}
+
+static inline void unpacktile(const unsigned char *in,float *tile,int npix)
+{
+  int i;
+  unsigned int prev,bits;
+
+  prev = 0;
+  for (i=0;i<npix;i++)
+  {
+    bits = in[i]|(in[npix+i]<<8)|(in[2*npix+i]<<16)|((unsigned int)in[3*npix+i]<<24);
+    prev ^= bits;
+    memcpy(&tile[i],&prev,4);
+  }
+}
+
+#endif
@@ -0,0 +1,212 @@
+/*------------------------------------------------------------------------*
+ NAME:     tileflt.cpp
+
+ PURPOSE:  One-time conversion of a row-major float32 .flt raster (REMA,
+           ArcticDEM, Bedmap-2) to the tiled .tfl layout described in
+           tiledgrid.h.  libquerytopo reads a .tfl file in place of the
+           .flt file of the same name whenever one of the grid's size is
+           present, so once a DEM is converted querytopo2 picks it up with
+           no other changes.
+           With -z, tiles of a single value are reduced to an index entry
+           and the others are deflated (about 10x smaller for the polar
+           mosaics, which are mostly ocean and fill).
+
+ DATE:     16 October 2026
+ *------------------------------------------------------------------------*/
+
+#include "tiledgrid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+
+int main(int argc, char *argv[])
+{
+  char outname[1024];
+  int opt,tiledim,compress,nx,ny,ntilesx,ntilesy,tx,ty,r,c,nr,nc,npix,i;
+  long long ntiles,k,offset,nconst,ndeflate;
+  float *band,*tile;
+  unsigned char *packed,*zbuf,*data;
+  uLongf zlen;
+  struct tiledheader hdr;
+  struct tileentry *index;
+  FILE *fin,*fout;
+
+  // Check input
+  tiledim = TILEDDEFAULTDIM;
+  compress = 0;
+  while ((opt=getopt(argc,argv,"t:z"))!=-1)
+  {
+    if (opt=='t'&&(tiledim=atoi(optarg))>=2&&tiledim<=4096) continue;
+    if (opt=='z') { compress = 1; continue; }
+    argc = 0;  // unrecognized option or value, force the usage message
+    break;
+  }
+  if (argc-optind<3||argc-optind>4)
+  {
+    printf("Usage: tileflt [-t tile pixels] [-z] <input .flt> <ncols> <nrows> [output .tfl]\n");
+    exit(0);
+  }
+  nx = atoi(argv[optind+1]);
+  ny = atoi(argv[optind+2]);
+  if (nx<=0||ny<=0)
+  {
+    printf("Grid dimensions must be positive - exiting\n");
+    exit(-1);
+  }
+
+  // Output goes next to the input, with .flt replaced by .tfl, unless named
+  if (snprintf(outname,sizeof(outname),"%s",argv[(argc-optind==4) ? optind+3 : optind])>=(int)sizeof(outname))
+  {
+    printf("Output file name too long - exiting\n");
+    exit(-1);
+  }
+  if (argc-optind<4)
+  {
+    k = strlen(outname);
+    if (k<4||strcmp(outname+k-4,".flt"))
+    {
+      printf("Input does not end in .flt, name the output file - exiting\n");
+      exit(-1);
+    }
+    strcpy(outname+k-4,".tfl");
+  }
+
+  // Open the files
+  if ((fin=fopen(argv[optind],"r"))==NULL)
+  {
+    printf("Input file %s not found - exiting\n",argv[optind]);
+    exit(-1);
+  }
+  fseeko(fin,0,SEEK_END);
+  if (ftello(fin)!=(off_t)4*nx*ny)
+  {
+    printf("Input file %s is not %d x %d float32 pixels - exiting\n",argv[optind],nx,ny);
+    exit(-1);
+  }
+  if ((fout=fopen(outname,"w"))==NULL)
+  {
+    printf("Cannot create output file %s - exiting\n",outname);
+    exit(-1);
+  }
+
+  // Lay out the header, tile index and page-aligned tile data.  Only the
+  // start of the data is aligned when tiles are compressed.
+  ntilesx = (nx+tiledim-1)/tiledim;
+  ntilesy = (ny+tiledim-1)/tiledim;
+  ntiles = (long long)ntilesx*ntilesy;
+  memset(&hdr,0,sizeof(hdr));
+  memcpy(hdr.magic,TILEDMAGIC,8);
+  hdr.version = TILEDVERSION;
+  hdr.nx = nx;
+  hdr.ny = ny;
+  hdr.tiledim = tiledim;
+  hdr.ntilesx = ntilesx;
+  hdr.ntilesy = ntilesy;
+  hdr.indexoffset = sizeof(hdr);
+  hdr.dataoffset = hdr.indexoffset+ntiles*sizeof(struct tileentry);
+  hdr.dataoffset = (hdr.dataoffset+TILEDALIGN-1)/TILEDALIGN*TILEDALIGN;
+  band = (float *)malloc((long long)tiledim*nx*sizeof(float));
+  tile = (float *)malloc((long long)tiledim*tiledim*sizeof(float));
+  index = (struct tileentry *)malloc(ntiles*sizeof(struct tileentry));
+  npix = tiledim*tiledim;
+  zlen = compressBound(4*npix);
+  packed = (unsigned char *)malloc(4*npix);
+  zbuf = (unsigned char *)malloc(zlen);
+  if (band==NULL||tile==NULL||index==NULL||packed==NULL||zbuf==NULL)
+  {
+    printf("Out of memory - exiting\n");
+    exit(-1);
+  }
+
+  // Work down the raster a band of tiledim rows at a time
+  fseeko(fin,0,SEEK_SET);
+  fseeko(fout,hdr.dataoffset,SEEK_SET);
+  offset = hdr.dataoffset;
+  nconst = ndeflate = 0;
+  for (ty=0;ty<ntilesy;ty++)
+  {
+    nr = (ny-ty*tiledim<tiledim) ? ny-ty*tiledim : tiledim;
+    if (fread(band,sizeof(float)*nx,nr,fin)!=(size_t)nr)
+    {
+      printf("Error reading %s - exiting\n",argv[optind]);
+      exit(-1);
+    }
+
+    // Cut the band into tiles, padding the edges with no data
+    for (tx=0;tx<ntilesx;tx++)
+    {
+      nc = (nx-tx*tiledim<tiledim) ? nx-tx*tiledim : tiledim;
+      for (r=0;r<tiledim;r++)
+        for (c=0;c<tiledim;c++)
+          tile[r*tiledim+c] = (r<nr&&c<nc) ? band[(long long)r*nx+tx*tiledim+c] : -9999.0;
+      k = (long long)ty*ntilesx+tx;
+      index[k].offset = offset;
+      index[k].size = sizeof(float)*npix;
+      index[k].codec = TILECODEC_RAW;
+      data = (unsigned char *)tile;
+
+      // A tile of one value needs no data, just the value (compared
+      // bitwise so -0.0 and NaN payloads survive)
+      if (compress)
+      {
+        for (i=1;i<npix&&!memcmp(&tile[i],&tile[0],sizeof(float));i++);
+        if (i==npix)
+        {
+          index[k].value = tile[0];
+          index[k].size = 0;
+          index[k].codec = TILECODEC_CONST;
+          nconst++;
+          continue;
+        }
+
+        // Otherwise deflate the tile if that saves anything
+        packtile(tile,packed,npix);
+        zlen = compressBound(4*npix);
+        if (compress2(zbuf,&zlen,packed,4*npix,6)==Z_OK&&zlen<(uLongf)(4*npix))
+        {
+          index[k].size = zlen;
+          index[k].codec = TILECODEC_DEFLATE;
+          data = zbuf;
+          ndeflate++;
+        }
+      }
+      if (fwrite(data,index[k].size,1,fout)!=1)
+      {
+        printf("Error writing %s - exiting\n",outname);
+        exit(-1);
+      }
+      offset += index[k].size;
+    }
+  }
+
+  // Write the header and tile index last, so a partial file is never valid
+  fseeko(fout,hdr.indexoffset,SEEK_SET);
+  if (fwrite(index,sizeof(struct tileentry),ntiles,fout)!=(size_t)ntiles)
+  {
+    printf("Error writing %s - exiting\n",outname);
+    exit(-1);
+  }
+  fseeko(fout,0,SEEK_SET);
+  fwrite(&hdr,sizeof(hdr),1,fout);
+  if (fclose(fout)!=0)
+  {
+    printf("Error writing %s - exiting\n",outname);
+    exit(-1);
+  }
+  fclose(fin);
+  printf("Wrote %d x %d tiles of %d x %d pixels to %s\n",ntilesx,ntilesy,tiledim,tiledim,outname);
+  if (compress)
+    printf("%lld constant, %lld deflated, %lld raw tiles, %lld data bytes\n",
+           nconst,ndeflate,ntiles-nconst-ndeflate,offset-hdr.dataoffset);
+  free(band);
+  free(tile);
+  free(index);
+  free(packed);
+  free(zbuf);
+  return(0);
+
+}